@@ -5,13 +5,21 @@
 #include <stdio.h>
 #include <string.h>
 
-uint8_t UNUSED_PATTERN[] = {
-    0xA1, 0xB2, 0xC3, 0xD4,
-    0xE5};  // Default pattern if there isn't one detected for whatever reason
-freeBlockHeader* freeListHead =
-    NULL;                // Pointer to the first free block in the free list
-uint8_t* g_heap = NULL;  // Pointer to the start of the heap
-size_t g_heap_size = 0;  // Size of the heap in bytes
+#include "arena.h"
+#include "checksum.h"
+#include "ecc.h"
+#include "policy.h"
+#include "profile.h"
+#include "record.h"
+#include "slab.h"
+#include "stats.h"
+#include "storm.h"
+#include "tcache.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "wipe.h"
+
+int g_lease_debug = 0;  // Re-verify read-only leases on release
 
 // Heap as a block of memory allocated outside of this file (in runme.c) and
 // passed to mm_init
@@ -33,126 +41,522 @@ size_t g_heap_size = 0;  // Size of the heap in bytes
  */
 
 /* Each "Allocated Block":
- * [Padding][Header][Payload]
+ * [Padding][Header][Payload][Digest Table][Slack]
  * Padding: Variable size to align payload to 40 bytes, filled with
- * UNUSED_PATTERN Header: Size (of payload), Status flag, checksum, padding
- * amount Payload: User data
+ * g_arena->pattern Header: Size (of payload), Status flag, checksum, padding
+ * amount, slack amount Payload: User data Digest Table: Only for payloads over
+ * PAYLOAD_CHUNK bytes, a CRC32C per chunk plus one over the table, so reads
+ * only verify the chunks they touch Slack: Leftover bytes too small to split
  */
 
 /* Each "Free Block":
- * [Header][FreeBlockStruct][Unused Space]
+ * [Header][FreeBlockStruct][Unused Space][Footer]
  * Header: Size (of entire free block inc Header and freeBlock), Status Flag,
  * Checksum, Padding Amount (0) FreeBlockStruct: Next Pointer, Previous Pointer,
- * Pointer to Header
+ * Pointer to Header Footer: Copy of the size and status (boundary tag) so the
+ * block can be found from the block physically after it
  */
 
 // Helper Functions
-void quaranBlock(header* head) {
+void quaranBlock(header* head) {  // Set block as quarantined
+  if (head->status != 2) {
+    quarantineAdd(head, statsQuarantine(head));  // Once per block
+  }
   head->status = 2;
-}  // Set block as quarantined
+  head->ecc = headerCode(head);  // Or the new status reads as a flipped bit
+}
 
 // 1 = True, 0 = False
 int in_heap(void* ptr) {
-  return (uint8_t*)ptr >= g_heap &&
-         (uint8_t*)ptr < g_heap + g_heap_size;  // Within heap bounds
+  return (uint8_t*)ptr >= g_arena->heap &&
+         (uint8_t*)ptr < g_arena->heap + g_arena->heap_size;  // Within bounds
 }
 
 size_t paddingCalc(header* first_byte) {
   uintptr_t addr = (uintptr_t)first_byte;  // Header as an integer address
   uintptr_t after_header = addr + sizeof(header);  // If a header was added
-  after_header -=
-      g_heap ? (uintptr_t)g_heap : 0;  // Adjust relative to heap start
+  after_header -= g_arena->heap ? (uintptr_t)g_arena->heap
+                                : 0;  // Adjust relative to heap start
   size_t misalignment =
       after_header %
-      40;  // Calculate misalignment (Distance from previous multiple of 40)
+      ALIGN;  // Calculate misalignment (Distance from previous multiple of 40)
   if (misalignment == 0) {
     return (size_t)0;
   }
-  return (size_t)40 - misalignment;  // Distance to next multiple of 40 bytes
+  return (size_t)ALIGN - misalignment;  // Distance to next multiple of 40
+}
+
+size_t blockSize(header* hdr) {  // Total block size
+  return sizeof(header) + hdr->padding + hdr->size + digestBytes(hdr->size) +
+         hdr->slack;
 }
 
-size_t blockSize(header* hdr) {
-  return sizeof(header) + hdr->padding + hdr->size;  // Total block size
+uint8_t* blockEndFinder(header* hdr) {  // First byte after an allocated block
+  return (uint8_t*)hdr + sizeof(header) + hdr->size + digestBytes(hdr->size) +
+         hdr->slack;
 }
 
 uint8_t* payloadFinder(header* hdr) {
   return ((uint8_t*)hdr + sizeof(header));
 }  // Add header size to get payload
 
-header* searchBestFree(
-    size_t size_requested) {  // Uses best-fit strategy to find free block
-  freeBlock* curr = freeListHead;
-  header* best = NULL;          // NULL=0 for initialization
-  size_t best_size = SIZE_MAX;  // For comparison
-
-  while (curr != NULL) {  // Loop through free blocks
-    header* currHeader = curr->hdr;
-    if (currHeader->status == 0) {
-      size_t size_needed =
-          paddingCalc(currHeader) + sizeof(header) + size_requested;
-      if (size_needed < sizeof(header) + sizeof(freeBlock)) {
-        size_needed += sizeof(header) + sizeof(freeBlock);
-      }  // For ensuring blocks are >=40 bytes for a free block afterwards
-      if (currHeader->size >= size_needed && currHeader->size < best_size) {
-        // Found a new best suitable block
-        best_size = currHeader->size;
-        best = currHeader;
-        // printf("BESTFIT | Found a new best suitable block at address: %p\n",
-        // (void*)currHeader); printf("BESTFIT | Size: %zu\n",
-        // (size_t)currHeader->size);
-      }
+// Heap walk: the header of the block that starts at start, the first byte
+// after it in *end and whether it's a free block (quarantined ones included).
+// NULL if no plausible block starts there (a corrupted size or status).
+header* blockAt(uint8_t* start, uint8_t** end, int* is_free) {
+  uint8_t* heap_end = g_arena->heap + g_arena->heap_size;
+  if (in_heap(start) == 0 || (size_t)(heap_end - start) < MIN_FREE_BLOCK) {
+    return NULL;
+  }
+  header* h = (header*)start;
+  *is_free = h->padding == 0 &&
+             (h->status == 0 ||
+              (h->status == 2 && h->size >= MIN_FREE_BLOCK &&
+               h->size <= (size_t)(heap_end - start) &&
+               footerFinder(h)->size == h->size));  // Quarantined free block
+  size_t padding = paddingCalc(h);  // Allocated, [Padding][Header]...
+  header* padded = (header*)(start + padding);
+  if (*is_free && padding > 0 &&
+      (padded->status == 1 || padded->status == 2) &&
+      padded->padding == padding) {
+    // Padding markers and the start of the size can read as a free header
+    *is_free = 0;
+    for (size_t i = 0; i < padding && !*is_free; i++) {
+      *is_free = start[i] != 0x33;
+    }
+  }
+  if (*is_free) {
+    if (h->size < MIN_FREE_BLOCK || h->size > (size_t)(heap_end - start)) {
+      return NULL;
+    }
+    *end = start + h->size;
+  } else {
+    h = padded;
+    if ((h->status != 1 && h->status != 2) || h->padding != padding ||
+        h->size > g_arena->heap_size || blockEndFinder(h) > heap_end) {
+      return NULL;
     }
-    curr = curr->next;  // Next block
+    *end = blockEndFinder(h);
+  }
+  return wipeQueued(start) ? NULL : h;  // A freed header not wiped yet
+}
+
+// Bytes a block would need at freeHdr to hold a size byte payload
+size_t fitSize(header* freeHdr, size_t size) {
+  size_t size_needed =
+      paddingCalc(freeHdr) + sizeof(header) + size + digestBytes(size);
+  if (size_needed < MIN_FREE_BLOCK) {
+    size_needed = MIN_FREE_BLOCK;
+  }  // For ensuring blocks can hold a free block afterwards (as mm_malloc)
+  return size_needed;
+}
+
+header* searchBestFree(size_t size_requested) {  // Active placement policy
+  size_t visits = g_arena->stats.search_visits;
+  header* found = policyActive()->find(size_requested);
+  statsSearch(g_arena->stats.search_visits - visits);
+  return found;
+}
+
+// Payload digest functions
+size_t chunkCount(size_t size) {  // Number of PAYLOAD_CHUNK sized chunks
+  return (size + PAYLOAD_CHUNK - 1) / PAYLOAD_CHUNK;
+}
+
+size_t digestBytes(size_t size) {  // Size of the digest table after a payload
+  if (size <= PAYLOAD_CHUNK) {
+    return 0;  // Single chunk, the header checksum covers the payload itself
+  }
+  return (chunkCount(size) + 1) * sizeof(uint32_t);
+}
+
+// Index 0 is the digest of the table, index i + 1 the digest of chunk i
+uint32_t digestGet(header* h, size_t index) {
+  uint32_t value;
+  memcpy(&value, payloadFinder(h) + h->size + index * sizeof(uint32_t),
+         sizeof(value));  // Table isn't aligned
+  return value;
+}
+
+void digestSet(header* h, size_t index, uint32_t value) {
+  memcpy(payloadFinder(h) + h->size + index * sizeof(uint32_t), &value,
+         sizeof(value));
+}
+
+uint32_t chunkSumCalc(header* h, size_t chunk) {  // CRC32C of one chunk
+  size_t start = chunk * PAYLOAD_CHUNK;
+  size_t len =
+      h->size - start < PAYLOAD_CHUNK ? h->size - start : PAYLOAD_CHUNK;
+  return crc32c(0, payloadFinder(h) + start, len);
+}
+
+uint32_t tableSumCalc(header* h) {  // CRC32C of all the chunk digests
+  return crc32c(0, payloadFinder(h) + h->size + sizeof(uint32_t),
+                chunkCount(h->size) * sizeof(uint32_t));
+}
+
+uint32_t checkSumCalc(header* h) {  // Calculates a CRC32C using: size, status,
+                                    // padding, slack, and payload
+  if (h == NULL) {                  // Valid pointer?
+    return 0;
+  }
+  // Size, status, padding and slack are contiguous, one pass covers them all
+  uint32_t sum = crc32c(0, h, offsetof(header, slack) + sizeof(h->slack));
+  if (h->status == 0) {
+    // Free blocks only cover their metadata (the freeBlock's back pointer),
+    // the unused space is checked separately by checkFreePattern
+    freeBlock* fb = (freeBlock*)payloadFinder(h);
+    sum = crc32c(sum, &fb->hdr, sizeof(fb->hdr));
+  } else if (digestBytes(h->size) > 0) {
+    uint32_t tableSum = digestGet(h, 0);  // Chunks are covered by the table
+    sum = crc32c(sum, &tableSum, sizeof(tableSum));
+  } else if (h->size > 0) {
+    sum = crc32c(sum, payloadFinder(h), h->size);  // Payload
   }
-  // Return best found block or NULL
-  return best;
+  return sum;
 }
 
-uint8_t checkSumCalc(header* h) {  // Calculates a checksum using: size, status,
-                                   // payload, and padding
-  if (h == NULL) {                 // Valid pointer?
+uint8_t headerCode(header* h) {  // SECDED code over the rest of the header
+  return eccEncode((const uint8_t*)h, offsetof(header, ecc));
+}
+
+void sealHeader(header* h) {  // After the fields or the payload changed
+  h->checksum = checkSumCalc(h);
+  h->ecc = headerCode(h);
+}
+
+// Whether checkSumCalc can read what a free or allocated header points at
+static int headerInBounds(header* h) {
+  uint8_t* heap_end = g_arena->heap + g_arena->heap_size;
+  if (h->status == 0) {
+    return h->size >= MIN_FREE_BLOCK &&
+           h->size <= (size_t)(heap_end - (uint8_t*)h);
+  }
+  return h->status == 1 && h->size <= g_arena->heap_size &&
+         blockEndFinder(h) <= heap_end;
+}
+
+// Correct a single flipped bit of a header (its fields or its checksum) in
+// place with the header's SECDED code. The correction only stands if the
+// header then passes its checksum, so a miscorrection of three or more
+// flipped bits (or a pointer that was never a header) is undone.
+// 0 = Corrected, 1 = Nothing to correct or uncorrectable
+int headerRepair(header* h) {
+  if (in_heap(h) == 0 ||
+      (size_t)(g_arena->heap + g_arena->heap_size - (uint8_t*)h) <
+          sizeof(header)) {
+    return 1;
+  }
+  int bit = eccLocate((const uint8_t*)h, offsetof(header, ecc));
+  if (bit < 0) {
+    return 1;  // Intact (the damage is elsewhere) or two bits flipped
+  }
+  uint8_t* byte = (uint8_t*)h + bit / 8;
+  *byte ^= (uint8_t)(1u << (bit % 8));
+  if (headerInBounds(h) && checkSumCalc(h) == h->checksum) {
+    statsCorrected();
     return 0;
   }
-  uint32_t sum = 0;
-  uint8_t* data = (uint8_t*)&h->size;  // Add data from size field
-  for (size_t i = 0; i < sizeof(h->size); i++) {
-    sum += data[i];
+  *byte ^= (uint8_t)(1u << (bit % 8));
+  return 1;
+}
+
+// Status check of the fast paths, a flipped status bit is corrected first.
+// 1 = Allocated, 0 = Not (free, quarantined or not a header)
+int isAllocated(header* h) {
+  return h->status == 1 || (headerRepair(h) == 0 && h->status == 1);
+}
+
+// Recompute every digest of an allocated block and its header checksum
+void sealBlock(header* h) {
+  if (digestBytes(h->size) > 0) {
+    for (size_t i = 0; i < chunkCount(h->size); i++) {
+      digestSet(h, i + 1, chunkSumCalc(h, i));
+    }
+    digestSet(h, 0, tableSumCalc(h));
+  }
+  sealHeader(h);
+}
+
+// Copy len bytes from src to offset in the payload, updating the digests from
+// the old and new bytes of the range only (CRC linearity, see crc32c_patch)
+void patchBlock(header* h, size_t offset, const void* src, size_t len) {
+  uint8_t* payload = payloadFinder(h);
+  const uint8_t* in = (const uint8_t*)src;
+  if (digestBytes(h->size) == 0) {  // Header CRC ends with the payload
+    h->checksum = crc32c_patch(h->checksum, payload + offset, in, len,
+                               h->size - offset - len);
+    h->ecc = headerCode(h);
+    memcpy(payload + offset, in, len);
+    return;
   }
-  sum += h->status;         // Add data from status byte
-  data = payloadFinder(h);  // Add data from payload
-  if (data != NULL && h->size > 0) {
-    for (size_t i = 0; i < h->size; i++) {
-      sum += data[i];
+  size_t chunks = chunkCount(h->size);
+  size_t first = offset / PAYLOAD_CHUNK;
+  size_t last = (offset + len - 1) / PAYLOAD_CHUNK;
+  uint8_t* entries = payload + h->size + sizeof(uint32_t) * (first + 1);
+  size_t entryBytes = (last - first + 1) * sizeof(uint32_t);
+  uint32_t oldEntries = crc32c(0, entries, entryBytes);
+  for (size_t i = first; i <= last; i++) {
+    size_t chunkStart = i * PAYLOAD_CHUNK;
+    size_t chunkEnd = chunkStart + PAYLOAD_CHUNK < h->size
+                          ? chunkStart + PAYLOAD_CHUNK
+                          : h->size;
+    size_t from = offset > chunkStart ? offset : chunkStart;
+    size_t to = offset + len < chunkEnd ? offset + len : chunkEnd;
+    if (from == chunkStart && to == chunkEnd) {  // Whole chunk, just hash it
+      digestSet(h, i + 1, crc32c(0, in + (from - offset), to - from));
+    } else {
+      digestSet(h, i + 1,
+                crc32c_patch(digestGet(h, i + 1), payload + from,
+                             in + (from - offset), to - from, chunkEnd - to));
     }
   }
-  sum += h->padding;  // Add data from padding byte
-  return (uint8_t)sum;
+  // The touched entries are contiguous, so patch the table digest in one go
+  uint32_t diff = oldEntries ^ crc32c(0, entries, entryBytes);
+  digestSet(h, 0,
+            digestGet(h, 0) ^
+                crc32c_shift(diff, (chunks - 1 - last) * sizeof(uint32_t)));
+  memcpy(payload + offset, in, len);
+  sealHeader(h);  // The checksum only covers the metadata and table digest
 }
 
-// 0 = Valid, 1 = Invalid
-int checkBlock(header* h) {
+// Recompute the digests of the chunks overlapping [offset, offset + len) after
+// they were changed directly (leases), without touching the other chunks
+void resealChunks(header* h, size_t offset, size_t len) {
+  if (digestBytes(h->size) == 0) {
+    sealHeader(h);  // Header CRC covers the payload
+    return;
+  }
+  size_t first = offset / PAYLOAD_CHUNK;
+  size_t last = (offset + len - 1) / PAYLOAD_CHUNK;
+  uint8_t* entries =
+      payloadFinder(h) + h->size + sizeof(uint32_t) * (first + 1);
+  size_t entryBytes = (last - first + 1) * sizeof(uint32_t);
+  uint32_t oldEntries = crc32c(0, entries, entryBytes);
+  for (size_t i = first; i <= last; i++) {
+    digestSet(h, i + 1, chunkSumCalc(h, i));
+  }
+  uint32_t diff = oldEntries ^ crc32c(0, entries, entryBytes);
+  size_t tail = (chunkCount(h->size) - 1 - last) * sizeof(uint32_t);
+  digestSet(h, 0, digestGet(h, 0) ^ crc32c_shift(diff, tail));
+  sealHeader(h);
+}
+
+// Verify an allocated header (and the table digest it covers) without reading
+// the payload of multi-chunk blocks. 0 = Valid, 1 = Invalid
+int checkHeader(header* h) {
   if (h == NULL) {  // Header isn't found
     return 1;       // Invalid
   }
-  if (h->checksum !=
-      (uint8_t)(~(h->checksumNOT))) {  // Checksum and NOT checksum mismatch
-    quaranBlock(h);                    // Quarantine block
-    return 1;                          // Invalid
+  if ((h->status == 1 &&
+       (h->size > g_arena->heap_size ||
+        blockEndFinder(h) >
+            g_arena->heap + g_arena->heap_size)) ||  // Corrupted size
+      checkSumCalc(h) != h->checksum) {              // Checksum mismatch
+    if (headerRepair(h) == 0) {
+      return 0;  // A single flipped bit, corrected
+    }
+    quaranBlock(h);  // Quarantine block
+    return 1;        // Invalid
   }
-  uint8_t computedSum = checkSumCalc(h);
-  if (computedSum != h->checksum ||
-      (uint8_t)(~computedSum) != h->checksumNOT) {  // Checksum mismatch
-    quaranBlock(h);
-    return 1;  // Invalid
+  return 0;  // Valid
+}
+
+// Verify the chunks overlapping [offset, offset + len) of a checked header.
+// 0 = Valid, 1 = Invalid
+int checkChunks(header* h, size_t offset, size_t len) {
+  if (digestBytes(h->size) == 0 || len == 0) {
+    return 0;  // Already covered by checkHeader
+  }
+  size_t last = (offset + len - 1) / PAYLOAD_CHUNK;
+  for (size_t i = offset / PAYLOAD_CHUNK; i <= last; i++) {
+    if (chunkSumCalc(h, i) != digestGet(h, i + 1)) {
+      quaranBlock(h);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Full check: header, digest table and every chunk. 0 = Valid, 1 = Invalid
+int checkBlock(header* h) {
+  if (checkHeader(h) != 0) {
+    return 1;
   }
-  computedSum = h->checksum ^ h->checksumNOT;
-  if (computedSum != h->checksumXOR) {  // XOR checksum mismatch
-    quaranBlock(h);
-    return 1;  // Invalid
+  if (h->status != 0 && digestBytes(h->size) > 0) {
+    if (tableSumCalc(h) != digestGet(h, 0)) {  // Digest table mismatch
+      quaranBlock(h);
+      return 1;
+    }
+    return checkChunks(h, 0, h->size);
   }
   return 0;  // Valid
 }
 
+// Boundary tag functions
+footer* footerFinder(header* freeHdr) {
+  return (footer*)((uint8_t*)freeHdr + freeHdr->size - sizeof(footer));
+}  // Footer sits in the last bytes of a free block
+
+uint32_t footerSumCalc(footer* f) {  // Calculates a CRC32C using: size, status
+  uint32_t sum = crc32c(0, &f->size, sizeof(f->size));
+  return crc32c(sum, &f->status, sizeof(f->status));
+}
+
+void writeFooter(header* freeHdr) {  // Mirror a free header into its footer
+  footer* f = footerFinder(freeHdr);
+  f->size = freeHdr->size;
+  f->status = freeHdr->status;
+  f->checksum = footerSumCalc(f);
+}
+
+// 1 = Header agrees with a valid footer, 0 = Not a (healthy) free block
+int freeTagsMatch(header* h, footer* f) {
+  if (footerSumCalc(f) != f->checksum) {  // Footer checksum mismatch
+    return 0;
+  }
+  if (f->status != 0) {
+    return 0;
+  }
+  // Free checksums only cover metadata so this is as cheap as the footer check
+  if ((h->status != 0 || h->size != f->size ||
+       checkSumCalc(h) != h->checksum) &&
+      (headerRepair(h) != 0 || h->status != 0 || h->size != f->size)) {
+    return 0;  // Header and footer disagree, or header checksum mismatch
+  }
+  freeBlock* fb = (freeBlock*)payloadFinder(h);
+  if (fb->hdr != h) {
+    return 0;  // Free block struct must point back at its header
+  }
+  return 1;
+}
+
+// Find the free block that ends exactly at blockStart using its footer
+header* prevFreeNeighbour(uint8_t* blockStart) {
+  if (blockStart < g_arena->heap + MIN_FREE_BLOCK) {
+    return NULL;  // Not enough room before us for a free block
+  }
+  footer* f = (footer*)(blockStart - sizeof(footer));
+  if (f->status != 0 || f->size < MIN_FREE_BLOCK ||
+      f->size > (size_t)(blockStart - g_arena->heap)) {
+    return NULL;  // Not a footer (allocated payload or corrupted)
+  }
+  header* h = (header*)(blockStart - f->size);
+  return freeTagsMatch(h, f) ? h : NULL;
+}
+
+// Find the free block that starts exactly at blockEnd using its header
+header* nextFreeNeighbour(uint8_t* blockEnd) {
+  if (blockEnd + MIN_FREE_BLOCK > g_arena->heap + g_arena->heap_size) {
+    return NULL;  // Not enough room after us for a free block
+  }
+  header* h = (header*)blockEnd;
+  if (h->status != 0 || h->size < MIN_FREE_BLOCK ||
+      h->size > (size_t)(g_arena->heap + g_arena->heap_size - blockEnd)) {
+    return NULL;  // Allocated padding/header or corrupted
+  }
+  return freeTagsMatch(h, footerFinder(h)) ? h : NULL;
+}
+
+// Fill len bytes at dst with the unused pattern as it lies from heap offset
+// absolute_offset on. Copies PATTERN_RUN bytes at a time from the arena's
+// pattern_run (a multiple of the period, so the phase carries over)
+void patternWrite(uint8_t* dst, size_t absolute_offset, size_t len) {
+  const uint8_t* run = g_arena->pattern_run + absolute_offset % 5;
+  while (len >= PATTERN_RUN) {
+    memcpy(dst, run, PATTERN_RUN);
+    dst += PATTERN_RUN;
+    len -= PATTERN_RUN;
+  }
+  memcpy(dst, run, len);
+}
+
+// Fill [start, start + len) with the unused pattern in its heap-relative phase
+void patternFill(uint8_t* start, size_t len) {
+  patternWrite(start, start - g_arena->heap, len);
+}
+
+// Pattern the part of [dirtyStart, dirtyEnd) that will be the unused space of
+// a free block at [start, start + size). Everything else is already patterned
+void wipeFreeBody(uint8_t* start, size_t size, uint8_t* dirtyStart,
+                  uint8_t* dirtyEnd) {
+  uint8_t* body_start = start + sizeof(header) + sizeof(freeBlock);
+  uint8_t* body_end = start + size - sizeof(footer);
+  if (dirtyStart < body_start) {
+    dirtyStart = body_start;
+  }
+  if (dirtyEnd > body_end) {
+    dirtyEnd = body_end;
+  }
+  wipeDefer(dirtyStart, dirtyEnd);  // Now, or queued in MM_WIPE_DEFERRED
+}
+
+// Turn [start, start + size) into a free block on the free list. The space
+// between the freeBlock struct and the footer must already hold the pattern.
+header* createFreeBlock(uint8_t* start, size_t size) {
+  wipeDrop(start, start + sizeof(header) + sizeof(freeBlock));  // Tags now
+  wipeDrop(start + size - sizeof(footer), start + size);
+  header* freeHdr = (header*)start;
+  freeHdr->size = size;
+  freeHdr->status = 0;  // Free
+  freeHdr->padding = 0;
+  freeHdr->slack = 0;
+
+  // Create new free block struct and insert into free list
+  freeBlock* fb = (freeBlock*)payloadFinder(freeHdr);
+  fb->hdr = freeHdr;
+  policyActive()->insert(freeHdr);
+  statsFreeAdd(size);
+  writeFooter(freeHdr);
+
+  sealHeader(freeHdr);
+  return freeHdr;
+}
+
+// Take a free block off the free list so its space can be reused
+void claimFreeBlock(header* freeHdr) {
+  policyActive()->remove(freeHdr);
+  statsFreeRemove(freeHdr->size);
+  footerFinder(freeHdr)->status = 1;  // Old boundary tag is no longer valid
+}
+
+// Deferred check of a free block's unused space (between the freeBlock struct
+// and the footer) against the unused pattern. 0 = Valid, 1 = Invalid
+int checkFreePattern(header* h) {
+  uint8_t* body = payloadFinder(h) + sizeof(freeBlock);
+  wipeFlush(body, body + h->size - MIN_FREE_BLOCK);  // Deferred wipes first
+  return checkPattern(body, h->size - MIN_FREE_BLOCK);
+}
+
+// Whether len bytes at start hold the unused pattern. 0 = Valid, 1 = Invalid
+int checkPattern(uint8_t* start, size_t len) {
+  const uint8_t* run = g_arena->pattern_run + (start - g_arena->heap) % 5;
+  for (size_t i = 0; i < len; i += PATTERN_RUN) {
+    size_t n = len - i < PATTERN_RUN ? len - i : PATTERN_RUN;
+    if (memcmp(start + i, run, n) != 0) {
+      return 1;  // Something wrote into (or flipped bits in) free space
+    }
+  }
+  return 0;
+}
+
+// Take a corrupted free block out of circulation so it's never reused/merged
+void quaranFreeBlock(header* h) {
+  freeBlock* fb = (freeBlock*)payloadFinder(h);
+  if ((fb->prev == NULL || in_heap(fb->prev)) &&
+      (fb->next == NULL || in_heap(fb->next))) {  // Links are safe to follow
+    policyActive()->remove(h);
+  }
+  quaranBlock(h);
+  // Neighbours must not merge into it either. A footer found through a
+  // corrupted size belongs to some other block, so it's only marked if it
+  // agrees with the header (the header status already blocks merges)
+  if (h->size >= MIN_FREE_BLOCK && h->size <= g_arena->heap_size &&
+      in_heap((uint8_t*)h + h->size - 1) && footerFinder(h)->size == h->size) {
+    footerFinder(h)->status = 2;
+  }
+}
+
 // Free list management functions
 void insert_free(freeBlock** head, freeBlock* block) {  // Add a new free block
   block->next = *head;  // Next block is the current head of the list
@@ -164,17 +568,31 @@ void insert_free(freeBlock** head, freeBlock* block) {  // Add a new free block
   *head = block;  // Update header to new block
 }
 
+// A free list neighbour that is safe to follow: a whole freeBlock inside the
+// heap (the links aren't checksummed, a storm can point them anywhere)
+static int linkInHeap(freeBlock* link) {
+  return in_heap(link) && in_heap((uint8_t*)link + sizeof(freeBlock) - 1);
+}
+
 void remove_free(freeBlock** head,
                  freeBlock* block) {  // Remove block from the free list
-  if (block->prev !=
-      NULL) {  // If the removed is not a head (Could be middle or tail)
-    block->prev->next = block->next;
-  } else {                // It's a head
-    *head = block->next;  // Update head to the next block
+  // Corrupted links are cut instead of followed: a neighbour has to point
+  // back at block, else the list ends there (the blocks after it are lost)
+  freeBlock* prev = block->prev;
+  freeBlock* next = block->next;
+  if (next != NULL && (linkInHeap(next) == 0 || next->prev != block)) {
+    next = NULL;
+  }
+  if (prev != NULL && (linkInHeap(prev) == 0 || prev->next != block)) {
+    prev = NULL;
   }
-  if (block->next !=
-      NULL) {  // If the removed is not a tail (Could be header or middle)
-    block->next->prev = block->prev;
+  if (*head == block) {  // It's a head
+    *head = next;        // Update head to the next block
+  } else if (prev != NULL) {  // Middle or tail
+    prev->next = next;
+  }
+  if (next != NULL) {  // Head or middle
+    next->prev = prev;
   }
   block->next = block->prev = NULL;  // Clear pointers
 }
@@ -183,8 +601,8 @@ void remove_free(freeBlock** head,
 void printWholeHeap() {
   printf("===== Whole Heap Dump =====\n");  // Print entire heap byte-by-byte
                                             // with 16 byte lines
-  for (size_t i = 0; i < g_heap_size; i++) {
-    printf("%02X ", g_heap[i]);
+  for (size_t i = 0; i < g_arena->heap_size; i++) {
+    printf("%02X ", g_arena->heap[i]);
     if ((i + 1) % 16 == 0) {
       printf("\n");
     }
@@ -211,29 +629,27 @@ void printBlock(
   printf("===== End of Block =====\n");
 }
 
-void printFreeList() {  // Print the entire free list
-  printf("===== Free List =====\n");
-  freeBlock* curr = freeListHead;
+void printFreeBlock(header* hdr, void* ctx) {
+  int* idx = (int*)ctx;
+  printf(
+      "Block %d: FreeBlock Addr: %p | Header Addr: %p | Size: %zu | status: "
+      "%u | Checksum: %08X\n",
+      (*idx)++, (void*)payloadFinder(hdr), (void*)hdr, hdr->size, hdr->status,
+      hdr->checksum);
+}
+
+void printFreeList() {  // Print every block the placement policy indexes
+  printf("===== Free List (%s) =====\n", policyActive()->name);
   int idx = 0;
-  while (curr != NULL) {
-    if (curr == freeListHead) {
-      printf("*");
-    }
-    header* hdr = curr->hdr;
-    printf(
-        "Block %d: FreeBlock Addr: %p | Header Addr: %p | Size: %zu | status: "
-        "%u | Checksum: %u\n",
-        idx++, (void*)curr, (void*)hdr, hdr->size, hdr->status, hdr->checksum);
-    curr = curr->next;
-  }
+  policyActive()->forEach(printFreeBlock, &idx);
   printf("===== End of Free List =====\n");
 }
 
 void printHeap() {  // Print the entire heap block-by-block
-  printf("===== Heap Dump %p =====\n", (void*)g_heap);
-  uintptr_t addr = (uintptr_t)g_heap;  // Start of the heap
-  uintptr_t end = addr + g_heap_size;  // End of the heap
-  // Check if current byte is UNUSED_PATTERN (DANGEROUS WAY OF DOING THIS...)
+  printf("===== Heap Dump %p =====\n", (void*)g_arena->heap);
+  uintptr_t addr = (uintptr_t)g_arena->heap;  // Start of the heap
+  uintptr_t end = addr + g_arena->heap_size;  // End of the heap
+  // Check if current byte is the pattern (DANGEROUS WAY OF DOING THIS...)
   while (addr < end) {
     while (*((uint8_t*)addr) ==
            0x33) {  // Find the first block (header) VERY UNSAFE
@@ -243,7 +659,7 @@ void printHeap() {  // Print the entire heap block-by-block
     }
     // printf("Current Byte: %02X\n", *((uint8_t *)addr));
     header* hdr = (header*)addr;
-    if ((uint8_t*)hdr < g_heap || (uint8_t*)hdr >= g_heap + g_heap_size) {
+    if (in_heap(hdr) == 0) {
       printf("Reached invalid header address: %p\n", (void*)hdr);
       break;  // Invalid header address
     }
@@ -256,12 +672,11 @@ void printHeap() {  // Print the entire heap block-by-block
     }
     printf(
         "Header: %p | Payload: %p | Payload Size: %zu | Padding: %u | status: "
-        "%u | Checksum: %u / %u / %u\n",
+        "%u | Checksum: %08X\n",
         (void*)hdr, (void*)payloadFinder(hdr), hdr->size, hdr->padding,
-        hdr->status, hdr->checksum, hdr->checksumNOT,
-        hdr->checksumXOR);   // Print block info
+        hdr->status, hdr->checksum);  // Print block info
     if (hdr->status == 1) {  // Allocated
-      addr = (uintptr_t)(hdr) + hdr->size + sizeof(header);
+      addr = (uintptr_t)blockEndFinder(hdr);
     } else if (hdr->status == 0) {  // If it's free
       addr = (uintptr_t)(hdr) + hdr->size;
     } else {
@@ -271,17 +686,17 @@ void printHeap() {  // Print the entire heap block-by-block
   printf("===== End of Heap Dump =====\n");
 }
 
-// Initialize the allocator over a provided memory block.
+// Initialize the current arena over a provided memory block.
 // Returns 0 on success, non-zero on failure.
-int mm_init(uint8_t* heap, size_t heap_size) {
-  printf("Init | Address of heap: %p\n", (void*)heap);
+int arenaInit(uint8_t* heap, size_t heap_size) {
+  MM_LOCKED();
+  MM_TRACE_STEP(TRACE_INIT, heap, heap_size);
   // Find default heap pattern:
   if (!heap || heap_size < 5) {
     return -1;  // Failure
   }
   uint8_t pattern[5];
   for (size_t i = 0; i < 5; ++i) {
-    printf("Init | Reading pattern byte %zu: %02X\n", i, heap[i]);
     pattern[i] = heap[i];  // Copy pattern
   }
   // Check that the pattern repeats (at least for the first 20 bytes)
@@ -292,116 +707,137 @@ int mm_init(uint8_t* heap, size_t heap_size) {
   }
   // Set pattern
   for (size_t i = 0; i < 5; ++i) {
-    UNUSED_PATTERN[i] = pattern[i];
+    g_arena->pattern[i] = pattern[i];
+  }
+  for (size_t i = 0; i < sizeof(g_arena->pattern_run); ++i) {
+    g_arena->pattern_run[i] = pattern[i % 5];
   }
 
   // Ensure program can read the heap
-  g_heap = heap;
-  g_heap_size = heap_size;
+  g_arena->heap = heap;
+  memset(g_arena->leases, 0, sizeof(g_arena->leases));  // Not after a re-init
+  g_arena->lease_count = 0;
+  g_arena->heap_size = heap_size;
 
   // Basic sanity checks
-  if (g_heap == NULL || g_heap_size < sizeof(header) + sizeof(freeBlock)) {
+  if (g_arena->heap == NULL || g_arena->heap_size < MIN_FREE_BLOCK) {
     return -1;  // Failure
   }
 
-  // Create initial free block (whole heap)
-  header* initialHeader = (header*)g_heap;
-  printf("Init | Address of initialHeader: %p\n", (void*)initialHeader);
-  initialHeader->size = heap_size;
-  initialHeader->status = 0;   // Free
-  initialHeader->padding = 0;  // Padding to the freeBlock pointer
-
-  // Initialize free list with the initial free block
-  freeBlock* initialFreeBlock = (freeBlock*)payloadFinder(initialHeader);
-  initialFreeBlock->next = NULL;
-  initialFreeBlock->prev = NULL;
-  initialFreeBlock->hdr = initialHeader;
-  // Set free list head (first block ever)
-  freeListHead = initialFreeBlock;
-  initialHeader->checksum = checkSumCalc(initialHeader);  // Compute checksum
-  initialHeader->checksumNOT = ~initialHeader->checksum;  // Inverse checksum
-  initialHeader->checksumXOR =
-      initialHeader->checksum ^ initialHeader->checksumNOT;
-
-  printf("Init | Address of freeListHead: %p\n", (void*)freeListHead);
+  // Create initial free block (whole heap) as the only entry of the index
+  g_arena->policy = policySelected();
+  policyActive()->reset();
+  statsReset();
+  scrubReset();
+  quarantineReset();
+  wipeReset();
+  slabReset();
+  profileForget(g_arena);
+#ifdef MM_THREADS
+  remoteDiscard();  // Queued blocks belonged to the old heap
+#endif
+  createFreeBlock(g_arena->heap, heap_size);
   return 0;  // Success
 }
 
+// mm_init with a named placement policy (see policy.c), -1 if it's unknown
+int mm_init_policy(uint8_t* heap, size_t heap_size, const char* policy) {
+  if (policy == NULL || policySelect(policy) != 0) {
+    MM_TRACE_ERROR(TRACE_INIT, heap, heap_size, TRACE_INVALID_ARG);
+    return -1;  // Failure
+  }
+  return mm_init(heap, heap_size);
+}
+
 // Allocate a block with ALIGN-byte aligned payload. Returns NULL on failure.
-void* mm_malloc(size_t size) {
+// Small sizes come from a slab (slab.c), everything else from the heap.
+void* arenaMalloc(size_t size) {
+  if (size == 0) {
+    MM_TRACE_ERROR(TRACE_MALLOC, NULL, size, TRACE_INVALID_SIZE);
+    return NULL;
+  }
+#ifdef MM_THREADS
+  remoteDrain();  // Blocks other threads freed into this arena
+#endif
+  if (g_slab_enabled && size <= SLAB_MAX_SIZE) {
+#ifdef MM_THREADS
+    void* slot = tcacheMalloc(size);  // This thread's cache, no lock if warm
+#else
+    void* slot = slabMalloc(size);
+#endif
+    if (slot != NULL) {
+      return slot;
+    }
+  }
+  MM_LOCKED();
+  return heapMalloc(size);
+}
+
+// Allocate a block with a header straight from the heap.
+void* heapMalloc(size_t size) {
   // When allocating, need to assign a header (metadata) of size 16 and padding
   // to push data to alignment 40
-  if (size == 0 || size > g_heap_size - sizeof(header)) {
-    printf("Malloc | Invalid size requested: %zu\n", size);
+  if (size == 0 || size > g_arena->heap_size - sizeof(header)) {
+    MM_TRACE_ERROR(TRACE_MALLOC, NULL, size, TRACE_INVALID_SIZE);
     return NULL;
   }
-  printf("Malloc | Req For: %zu\n", size);
 
-  // printf("Malloc | Looking for a block to fit allocated: %zu Bytes\n", size);
   //  Find a space in the heap
   header* best_fit = searchBestFree(size);
+  while (best_fit != NULL && checkBlock(best_fit) != 0) {
+    statsCorruption(TRACE_MALLOC, best_fit, best_fit->size);
+    quaranFreeBlock(best_fit);
+    best_fit = searchBestFree(size);
+  }
   // Check if a suitable block was found
   if (best_fit == NULL) {
-    printf("Malloc | No suitable block found for size: %zu\n", size);
+    MM_TRACE_ERROR(TRACE_MALLOC, NULL, size, TRACE_NO_SPACE);
     return NULL;  // Suitable block wasn't found
   }
   size_t padding = paddingCalc(best_fit);
-  size_t total_block_size = padding + sizeof(header) + size;
-  printf("MALLOC | TOTAL BLOCK SIZE AT CHECK: %zu\n", total_block_size);
-  // Ensure the block is large enough to hold header + freeBlock if freed later
-  if (total_block_size < sizeof(header) + sizeof(freeBlock)) {
-    printf(
-        "Malloc | Allocation size of %zu is too small, adding to padding "
-        "%zu.\n",
-        total_block_size, padding);
-    padding += (sizeof(header) + sizeof(freeBlock));
-    total_block_size = padding + sizeof(header) + size;
-    printf("Malloc | New padding needed: %zu\n", padding);
-    printf("New Size: %zu\n", total_block_size);
+  size_t slack = 0;
+  size_t total_block_size =
+      padding + sizeof(header) + size + digestBytes(size);
+  // Ensure the block is large enough to hold header + freeBlock + footer if
+  // freed later
+  if (total_block_size < MIN_FREE_BLOCK) {  // Too small, add slack
+    slack = MIN_FREE_BLOCK - total_block_size;
+    total_block_size = MIN_FREE_BLOCK;
   }
 
-  freeBlock* freeBlk = (freeBlock*)payloadFinder(
-      best_fit);                        // Find the original free block struct
-  remove_free(&freeListHead, freeBlk);  // Remove from free list
+  claimFreeBlock(best_fit);  // Remove from free list
 
   size_t remaining_size = best_fit->size - total_block_size;
+  // Queued wipes under the new block are moot (the rest stay with the split)
+  wipeDrop((uint8_t*)best_fit,
+           (uint8_t*)best_fit + (remaining_size >= MIN_FREE_BLOCK
+                                     ? total_block_size
+                                     : best_fit->size));
 
-  printf(
-      "Malloc | First byte found at: %p | Allocation: %zu | Free Block Size: "
-      "%zu | Requested Size: %zu\n",
-      (void*)best_fit, total_block_size, best_fit->size, size);
-  printf("Malloc | Padding needed: %zu\n", padding);
+  MM_TRACE_STEP(TRACE_PLACE, best_fit, total_block_size);
   header* newHead = (header*)((int8_t*)best_fit + padding);
-  printf("Malloc | Header after padding will be at: %p\n", (void*)newHead);
-  printf("Malloc | Payload will be at: %p\n", (void*)payloadFinder(newHead));
 
   // Check if we can split the block
   size_t min_split_size =
-      sizeof(header) +
-      sizeof(freeBlock);  // Minimum size to split off a new free block
+      MIN_FREE_BLOCK;  // Minimum size to split off a new free block
   if (remaining_size >=
       min_split_size) {  // A minimum size is available to split
-    // Create a new free header after the allocation ends
-    header* new_free_header = (header*)((uint8_t*)best_fit + total_block_size);
-    new_free_header->size = remaining_size;
-    new_free_header->status = 0;  // Free
-    new_free_header->padding = 0;
-
-    // Create new free block struct and insert into free list
-    freeBlock* new_free_block = (freeBlock*)payloadFinder(new_free_header);
-    new_free_block->hdr = new_free_header;
-    insert_free(&freeListHead, new_free_block);
-    new_free_header->checksum = checkSumCalc(new_free_header);
-    new_free_header->checksumNOT = ~new_free_header->checksum;
+    // Create a new free block after the allocation ends
+    createFreeBlock((uint8_t*)best_fit + total_block_size, remaining_size);
+    MM_TRACE_STEP(TRACE_SPLIT, (uint8_t*)best_fit + total_block_size,
+                  remaining_size);
   } else {  // If not enough space to split
-    size +=
+    slack +=
         remaining_size;  // Absorb the remaining space into the allocated block
   }
 
   // Update allocated block size
   newHead->size = size;
+  g_arena->stats.payload_bytes += size;
+  slabHeapTally(0, size);
   newHead->status = 1;  // Allocated
   newHead->padding = (uint8_t)padding;
+  newHead->slack = (uint8_t)slack;
 
   // Set data in padding area to mark it as being USED
   uint8_t* pad_start = (uint8_t*)best_fit;
@@ -409,183 +845,168 @@ void* mm_malloc(size_t size) {
     pad_start[i] = 0x33;  // Padding marker
   }
 
-  newHead->checksum = checkSumCalc(newHead);  // Update checksum
-  newHead->checksumNOT = ~newHead->checksum;
-  newHead->checksumXOR = newHead->checksum ^ newHead->checksumNOT;
+  sealBlock(newHead);  // Update digests and checksum
   return (void*)payloadFinder(newHead);  // Return pointer to payload
 }
 
 // Free a previously-allocated pointer (ignore NULL).
 // Must detect double-free.
+void arenaFree(void* ptr) {
+#ifdef MM_THREADS
+  if (ptr != NULL && tcacheFree(ptr)) {
+    return;  // Small object, now in this thread's cache
+  }
+  if (ptr != NULL && remotePush(ptr)) {
+    return;  // Another thread's arena, freed by its next malloc
+  }
+#endif
+  MM_LOCKED();
+  arenaFreeLocked(ptr);
+#ifdef MM_THREADS
+  remoteDrain();  // Have the lock anyway
+#endif
+}
+
+// arenaFree once the lock is held (also frees the remote stack's blocks)
+void arenaFreeLocked(void* ptr) {
+  slab* s = ptr != NULL ? slabFind(ptr) : NULL;
+  if (s != NULL) {  // Small object
+    if (leaseFind((header*)((uint8_t*)ptr - sizeof(header))) != NULL) {
+      MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_LEASED);
+      return;
+    }
+    slabFree(s, ptr);
+    return;
+  }
+  heapFree(ptr);
+}
+
+// Free a block with a header back to the heap.
 // Check to see if the block is corrupted before freeing.
 // Check to see if the previous and next blocks are free and merge if possible.
-void mm_free(void* ptr) {
+void heapFree(void* ptr) {
   if (ptr == NULL) {  // Check the pointer is real and ignoring NULL
-    printf("Free | Invalid pointer.\n");
-    return NULL;
+    MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_INVALID_PTR);
+    return;
   }
   if (in_heap(ptr) == 0) {  // Check pointer is in heap
-    printf("Free | Invalid pointer (not in heap).\n");
-    return NULL;  // Ignore NULL
+    MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_INVALID_PTR);
+    return;  // Ignore NULL
   }
   // Get header from payload pointer (16 bytes before)
   header* hdr = (header*)((uint8_t*)ptr - sizeof(header));
   if (in_heap(hdr) == 0) {  // Check the supposed header is in the heap
-    printf("Free | Invalid header from calc.\n");
-    return NULL;  // Ignore NULL
+    MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_INVALID_PTR);
+    return;  // Ignore NULL
   }
   uint8_t* blockStart = ((uint8_t*)ptr - hdr->padding - sizeof(header));
   if (in_heap(blockStart) == 0) {  // Check the supposed header is in the heap
-    printf("Free | Invalid blockStart from calc.\n");
-    return NULL;  // Ignore NULL
+    MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_INVALID_PTR);
+    return;  // Ignore NULL
   }
 
-  printf("Free | Payload to free at: %p\n", (void*)ptr);
-  printf("Free | I found the header to free at: %p\n", (void*)hdr);
-  printf("Free | The start of the block is at: %p\n", (void*)(blockStart));
-
   // Validate block
-  if (hdr->status != 1) {
-    printf("Free | I think it's already free\n");
-    return NULL;  // Ignore NULL
+  if (!isAllocated(hdr)) {
+    MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_NOT_ALLOCATED);
+    return;  // Ignore NULL
+  }
+  if (leaseFind(hdr) != NULL) {
+    MM_TRACE_ERROR(TRACE_FREE, ptr, hdr->size, TRACE_LEASED);
+    return;
   }
   if (checkBlock(hdr) != 0) {
-    printf("Free | I think it's corrupted...\n");
-    return NULL;  // Corrupted block
+    statsCorruption(TRACE_FREE, ptr, hdr->size);
+    return;  // Corrupted block
   }
 
-  printf("Freeing block at: %p | Size: %zu\n", (void*)hdr, blockSize(hdr));
-
+  g_arena->stats.payload_bytes -= hdr->size;
+  slabHeapTally(hdr->size, 0);
   // Look for the next block's first byte
-  header* next_block_addr =
-      (header*)((uint8_t*)hdr + hdr->size + sizeof(header));
-  printf("Free | Next Block Addr Calc: %p\n", (void*)next_block_addr);
-
-  // Look for neighbours
-  header* prev = NULL;
-  header* next = NULL;
-  // Traverse the free list
-  freeBlock* curr = freeListHead;
-  while (curr != NULL) {
-    printf("----\n");
-    header* currHdr = curr->hdr;
-    uint8_t* currEnd =
-        (uint8_t*)currHdr + currHdr->size;  // End of allocated block
-    printf("Block %p ends at %p\n", (void*)currHdr, (void*)currEnd);
-    if (currEnd == blockStart) {
-      printf("Found previous block to merge with at: %p\n", (void*)currHdr);
-      prev = currHdr;  // Previous block found
-    }
-    if (currHdr == next_block_addr) {
-      printf("Found next block to merge with at: %p\n", (void*)currHdr);
-      next = currHdr;  // Next block found
-    }
-    printf(
-        "Looking at Block | Addr: %p | Header Addr: %p | Size: %zu | status: "
-        "%u | Checksum: %u\n",
-        (void*)curr, (void*)currHdr, currHdr->size, currHdr->status,
-        currHdr->checksum);
-    curr = curr->next;
-  }
-  printf("----\n");
+  uint8_t* blockEnd = blockEndFinder(hdr);
+
+  // Look for neighbours using their boundary tags
+  header* prev = prevFreeNeighbour(blockStart);
+  header* next = nextFreeNeighbour(blockEnd);
 
   header* newHeader = (header*)blockStart;
   size_t newSize = blockSize(hdr);
   // Check if we can coalesce with next block
   if (next != NULL) {
-    printf("Free | Opportunity to merge with next block at: %p | Size: %zu\n",
-           (void*)next_block_addr, next_block_addr->size);
-
+    MM_TRACE_STEP(TRACE_MERGE_NEXT, next, next->size);
     // Remove next block from free list
-    freeBlock* next_fb = (freeBlock*)payloadFinder(next_block_addr);
-    remove_free(&freeListHead, next_fb);
+    claimFreeBlock(next);
 
     // Merge sizes
-    newSize += next_block_addr->size;
-    printf("Free | Updated our block and removed next block! New Size: %zu\n",
-           newSize);
-  } else {
-    printf("Free | No next block to merge with\n");
+    newSize += next->size;
   }
   // Check if we can coalesce with previous block
   if (prev != NULL) {
-    printf("Opportunity to merge with previous block at: %p | Size: %zu\n",
-           (void*)prev, prev->size);
-
+    MM_TRACE_STEP(TRACE_MERGE_PREV, prev, prev->size);
     // Remove previous block from free list
-    freeBlock* prev_fb = (freeBlock*)payloadFinder(prev);
-    remove_free(&freeListHead, prev_fb);
+    claimFreeBlock(prev);
 
     // Merge sizes
-    prev->size = prev->size + newSize;
-    printf(
-        "Free | Updated previous block and removed our block! New Size: %zu\n",
-        prev->size);
+    newSize += prev->size;
 
     // Update newHeader to now be pointing where prev is
     newHeader = prev;
-    newSize = prev->size;
-  } else {
-    printf("Free | No previous block to merge with\n");
-  }
-  // Update block as free
-  printf("Free | Finishing block %p with size %zu\n", (void*)newHeader,
-         newSize);
-  newHeader->size = newSize;
-  newHeader->status = 0;  // Free
-  newHeader->padding = 0;
-
-  // Put in the new free block into the free list
-  freeBlock* newFreeBlock = (freeBlock*)payloadFinder(newHeader);
-  newFreeBlock->hdr = newHeader;
-  insert_free(&freeListHead, newFreeBlock);
-  printf("Free | Inserting free block at: %p\n", (void*)newFreeBlock);
-
-  // Wipe payload area after freeBlock with UNUSED_PATTERN
-  uint8_t* wipe_start = (uint8_t*)newFreeBlock + sizeof(freeBlock);
-  size_t wipe_area_size = newHeader->size - sizeof(freeBlock) - sizeof(header);
-  printf("Free | Wiping from %p for %zu bytes\n", (void*)wipe_start,
-         wipe_area_size);
-  if (wipe_area_size > 0) {
-    for (size_t i = 0; i < wipe_area_size; ++i) {
-      size_t absolute_offset = (uint8_t*)wipe_start - g_heap;
-      wipe_start[i] = UNUSED_PATTERN[(absolute_offset + i) % 5];
-    }
   }
-
-  newHeader->checksum = checkSumCalc(newHeader);
-  newHeader->checksumNOT = ~newHeader->checksum;
-  newHeader->checksumXOR = newHeader->checksum ^ newHeader->checksumNOT;
+  // Wipe only what isn't patterned yet: our own block, the footer of prev and
+  // the header + freeBlock of next. The rest of the merged free space is
+  // already patterned, so the cost doesn't grow with the neighbours' sizes
+  uint8_t* wipe_start = blockStart - (prev != NULL ? sizeof(footer) : 0);
+  uint8_t* wipe_end =
+      blockEnd + (next != NULL ? sizeof(header) + sizeof(freeBlock) : 0);
+  MM_TRACE_STEP(TRACE_WIPE, wipe_start, (size_t)(wipe_end - wipe_start));
+  wipeFreeBody((uint8_t*)newHeader, newSize, wipe_start, wipe_end);
+
+  // Update block as free (header, free list entry and footer)
+  createFreeBlock((uint8_t*)newHeader, newSize);
 }
 
 // Safely read data from an allocated block at offset bytes into buf.
 // Returns the number of bytes read, or -1 if corruption or invalid pointer
 // detected.
-int mm_read(void* ptr, size_t offset, void* buf, size_t len) {
+int arenaRead(void* ptr, size_t offset, void* buf, size_t len) {
+  MM_LOCKED();
   // Basic checks
   if (ptr == NULL || buf == NULL) {  // Check the pointers are real
     return -1;
   }
   if (in_heap(ptr) == 0) {  // Check pointer is in heap
-    printf("Read | Invalid pointer (not in heap).\n");
+    MM_TRACE_ERROR(TRACE_READ, ptr, len, TRACE_INVALID_PTR);
     return -1;  // Ignore NULL
   }
   // Get header from payload pointer
   header* hdr = (header*)((uint8_t*)ptr - sizeof(header));
+  slab* s = slabFind(ptr);
+  if (s != NULL) {  // Small object, hdr is only its lease key
+    lease* l = leaseFind(hdr);
+    if (l != NULL && l->mode == LEASE_RW) {
+      MM_TRACE_ERROR(TRACE_READ, ptr, len, TRACE_LEASED);
+      return -1;
+    }
+    return slabRead(s, ptr, offset, buf, len);
+  }
   if (in_heap(hdr) == 0) {  // Check the supposed header
-    printf("Read | Invalid header from calc.\n");
+    MM_TRACE_ERROR(TRACE_READ, ptr, len, TRACE_INVALID_PTR);
     return -1;  // Ignore NULL
   }
-  // Validate block
-  if (checkBlock(hdr) != 0) {  // Check for corruption
-    printf("Read | I think it's corrupted...\n");
-    return -1;  // Corrupted block
-  }
-  if (hdr->status != 1) {  // Check if allocated
-    printf("Read | I think it's already free\n");
+  // Validate block (header only, the payload is checked chunk by chunk)
+  if (!isAllocated(hdr)) {  // Check if allocated
+    MM_TRACE_ERROR(TRACE_READ, ptr, len, TRACE_NOT_ALLOCATED);
     return -1;  // Double free or invalid/broken block
   }
-  if (len == 0 || offset == hdr->size) {
+  lease* l = leaseFind(hdr);
+  if (l != NULL && l->mode == LEASE_RW) {  // Checksums are stale until release
+    MM_TRACE_ERROR(TRACE_READ, ptr, len, TRACE_LEASED);
+    return -1;
+  }
+  if (checkHeader(hdr) != 0) {  // Check for corruption
+    statsCorruption(TRACE_READ, ptr, len);
+    return -1;  // Corrupted block
+  }
+  if (len == 0 || offset >= hdr->size) {
     return 0;  // Nothing to read
   }
 
@@ -594,6 +1015,10 @@ int mm_read(void* ptr, size_t offset, void* buf, size_t len) {
   uint8_t* payload = (uint8_t*)ptr + offset;
   size_t available = hdr->size - offset;
   size_t to_read = (len < available) ? len : available;
+  if (checkChunks(hdr, offset, to_read) != 0) {  // Only the chunks we touch
+    statsCorruption(TRACE_READ, ptr, len);
+    return -1;  // Corrupted block
+  }
   memcpy(buf, payload, to_read);
   count = to_read;
   return count;  // Return number of bytes read
@@ -602,311 +1027,670 @@ int mm_read(void* ptr, size_t offset, void* buf, size_t len) {
 // Safely write data into an allocated block at offset bytes from src.
 // Returns the number of bytes written, or -1 if corruption or invalid pointer
 // detected.
-int mm_write(void* ptr, size_t offset, const void* src, size_t len) {
+int arenaWrite(void* ptr, size_t offset, const void* src, size_t len) {
+  MM_LOCKED();
   // Basic checks
   if (ptr == NULL || src == NULL) {  // Check the pointers are real
     return -1;
   }
-  if ((uint8_t*)ptr < g_heap ||
-      (uint8_t*)ptr >= g_heap + g_heap_size) {  // Check pointer is in heap
-    printf("Write | Invalid pointer (not in heap).\n");
+  if (in_heap(ptr) == 0) {  // Check pointer is in heap
+    MM_TRACE_ERROR(TRACE_WRITE, ptr, len, TRACE_INVALID_PTR);
     return -1;  // Ignore NULL
   }
   // Get header from payload pointer
   header* hdr = (header*)((uint8_t*)ptr - sizeof(header));
-  if ((uint8_t*)hdr < g_heap ||
-      (uint8_t*)hdr >= g_heap + g_heap_size) {  // Check the supposed header
-                                                // from payload is in the heap
-    printf("Write | Invalid header from calc.\n");
-    return -1;  // Ignore NULL
+  slab* s = slabFind(ptr);
+  if (s != NULL) {  // Small object, hdr is only its lease key
+    if (leaseFind(hdr) != NULL) {
+      MM_TRACE_ERROR(TRACE_WRITE, ptr, len, TRACE_LEASED);
+      return -1;
+    }
+    return slabWrite(s, ptr, offset, src, len);
   }
-  // Validate block
-  if (checkBlock(hdr) != 0) {  // Check for corruption
-    printf("Write | I think it's corrupted...\n");
-    return -1;  // Corrupted block
+  if (in_heap(hdr) == 0) {  // Check the supposed header
+                            // from payload is in the heap
+    MM_TRACE_ERROR(TRACE_WRITE, ptr, len, TRACE_INVALID_PTR);
+    return -1;  // Ignore NULL
   }
-  if (hdr->status != 1) {  // Check if allocated
-    printf("Write | I think it's already free\n");
+  // Validate block (header only, the payload is checked chunk by chunk)
+  if (!isAllocated(hdr)) {  // Check if allocated
+    MM_TRACE_ERROR(TRACE_WRITE, ptr, len, TRACE_NOT_ALLOCATED);
     return -1;  // Double free or invalid/broken block
   }
-  if (len + offset != hdr->size) {
+  if (leaseFind(hdr) != NULL) {  // Lease holders expect nobody else to write
+    MM_TRACE_ERROR(TRACE_WRITE, ptr, len, TRACE_LEASED);
     return -1;
   }
-  if (len == 0 || offset == hdr->size) {
+  if (checkHeader(hdr) != 0) {  // Check for corruption
+    statsCorruption(TRACE_WRITE, ptr, len);
+    return -1;  // Corrupted block
+  }
+  if (len == 0 || offset >= hdr->size) {
     return 0;  // Nothing to write
   }
   // Perform the write
   size_t count = 0;
-  uint8_t* payload = (uint8_t*)ptr + offset;
   size_t available = hdr->size - offset;
 
   size_t to_write = (len < available) ? len : available;
-  memcpy(payload, src, to_write);
+  if (checkChunks(hdr, offset, to_write) != 0) {  // Only the chunks we touch
+    statsCorruption(TRACE_WRITE, ptr, len);
+    return -1;  // Corrupted block
+  }
+  // Copy and update digests and checksum from the old and new bytes
+  patchBlock(hdr, offset, src, to_write);
   count = to_write;
-
-  // Update checksum after write
-  hdr->checksum = checkSumCalc(hdr);
-  hdr->checksumNOT = ~hdr->checksum;
-  hdr->checksumXOR = hdr->checksum ^ hdr->checksumNOT;
   return count;  // Return number of bytes written
 }
 
+// Leases
+lease* leaseFind(header* h) {
+  if (g_arena->lease_count == 0) {
+    return NULL;  // Nothing leased, skip the scan
+  }
+  for (size_t i = 0; i < MAX_LEASES; i++) {
+    if (g_arena->leases[i].hdr == h) {
+      return &g_arena->leases[i];
+    }
+  }
+  return NULL;
+}
+
+// Header of the allocated block that ptr is the payload of, NULL if invalid
+header* leaseTarget(const void* ptr) {
+  if (ptr == NULL || in_heap((void*)ptr) == 0) {
+    return NULL;
+  }
+  header* hdr = (header*)((uint8_t*)ptr - sizeof(header));
+  if (in_heap(hdr) == 0 || !isAllocated(hdr)) {
+    return NULL;
+  }
+  return hdr;
+}
+
+void* acquireLease(void* ptr, size_t* size, uint8_t mode) {
+  MM_LOCKED();
+  MM_STAT_INC(g_arena->stats.ops[TRACE_ACQUIRE]);
+  slab* s = ptr != NULL ? slabFind(ptr) : NULL;
+  header* hdr = s != NULL ? (header*)((uint8_t*)ptr - sizeof(header))
+                          : leaseTarget(ptr);
+  if (hdr == NULL) {
+    MM_TRACE_ERROR(TRACE_ACQUIRE, ptr, 0, TRACE_INVALID_PTR);
+    return NULL;
+  }
+  lease* l = leaseFind(hdr);
+  if (l != NULL && (l->mode == LEASE_RW || mode == LEASE_RW)) {
+    MM_TRACE_ERROR(TRACE_ACQUIRE, ptr, 0, TRACE_LEASED);
+    return NULL;  // Writers are exclusive
+  }
+  if (l == NULL) {
+    // Verify once, the holder then works on the payload directly
+    if (s != NULL ? slabCheckSlot(s, ptr) != 0 : checkBlock(hdr) != 0) {
+      statsCorruption(TRACE_ACQUIRE, ptr, 0);
+      return NULL;
+    }
+    for (size_t i = 0; i < MAX_LEASES && l == NULL; i++) {
+      if (g_arena->leases[i].hdr == NULL) {
+        l = &g_arena->leases[i];  // Free slot
+      }
+    }
+    if (l == NULL) {
+      MM_TRACE_ERROR(TRACE_ACQUIRE, ptr, 0, TRACE_LIMIT);
+      return NULL;
+    }
+    l->hdr = hdr;
+    l->mode = mode;
+    l->refs = 0;
+    g_arena->lease_count++;
+  }
+  l->refs++;
+  if (size != NULL) {
+    *size = s != NULL ? slabSize(s, ptr) : hdr->size;
+  }
+  return ptr;
+}
+
+// Verify a block once and hand out a direct pointer to its payload. Returns
+// NULL if the block is corrupted, invalid or leased for writing
+const void* mm_acquire_ro(void* ptr, size_t* size) {
+  return mm_arena_acquire_ro(arenaOf(ptr), ptr, size);
+}
+
+// Same as mm_acquire_ro but writable and exclusive. The checksums are only
+// brought up to date by mm_release, until then the block can't be read,
+// written, resized or freed through the other functions
+void* mm_acquire_rw(void* ptr, size_t* size) {
+  return mm_arena_acquire_rw(arenaOf(ptr), ptr, size);
+}
+
+// Give a lease back. Returns 0 on success, -1 if ptr isn't leased or (with
+// lease debugging on) the block changed through a read-only lease
+int arenaRelease(const void* ptr) {
+  MM_LOCKED();
+  MM_STAT_INC(g_arena->stats.ops[TRACE_RELEASE]);
+  if (ptr == NULL || in_heap((void*)ptr) == 0) {
+    MM_TRACE_ERROR(TRACE_RELEASE, ptr, 0, TRACE_INVALID_PTR);
+    return -1;
+  }
+  header* hdr = (header*)((uint8_t*)ptr - sizeof(header));
+  lease* l = leaseFind(hdr);
+  if (l == NULL) {
+    MM_TRACE_ERROR(TRACE_RELEASE, ptr, 0, TRACE_NOT_LEASED);
+    return -1;
+  }
+  uint8_t mode = l->mode;
+  if (--l->refs == 0) {
+    l->hdr = NULL;
+    g_arena->lease_count--;
+  }
+  slab* s = slabFind(ptr);
+  if (s != NULL) {  // Small object: only its own slot is (re)checked
+    if (slabCheck(s) != 0) {
+      statsCorruption(TRACE_RELEASE, ptr, 0);
+      return -1;
+    }
+    if (mode == LEASE_RW) {
+      slabResealSlot(s, ptr);
+    } else if (g_lease_debug && slabCheckSlot(s, ptr) != 0) {
+      MM_TRACE_ERROR(TRACE_RELEASE, ptr, 0, TRACE_LEASE_VIOLATED);
+      return -1;  // The slab was quarantined
+    }
+    return 0;
+  }
+  if (hdr->status != 1) {  // Quarantined while leased (e.g. by mm_read)
+    MM_TRACE_ERROR(TRACE_RELEASE, ptr, 0, TRACE_NOT_ALLOCATED);
+    return -1;
+  }
+  if (mode == LEASE_RW) {
+    sealBlock(hdr);  // Payload may have changed anywhere
+  } else if (g_lease_debug && checkBlock(hdr) != 0) {
+    MM_TRACE_ERROR(TRACE_RELEASE, ptr, 0, TRACE_LEASE_VIOLATED);
+    return -1;  // checkBlock quarantined it
+  }
+  return 0;
+}
+
+void mm_lease_debug(int enabled) { g_lease_debug = enabled; }
+
+// Bytes usable at ptr (the slot size for small objects), 0 if invalid
+size_t arenaUsableSize(void* ptr) {
+  MM_LOCKED();
+  if (ptr == NULL || in_heap(ptr) == 0) {
+    return 0;
+  }
+  slab* s = slabFind(ptr);
+  if (s != NULL) {
+    return slabSize(s, ptr);
+  }
+  header* hdr = leaseTarget(ptr);
+  return hdr != NULL ? hdr->size : 0;
+}
+
+// Turn the slab layer for small objects on or off (before mm_init)
+void mm_slab_enable(int enabled) { g_slab_enabled = enabled; }
+
+// Give the calling thread's cached small objects back to the slabs. Happens
+// on thread exit anyway, a no-op unless built with MM_THREADS
+void mm_thread_flush(void) {
+#ifdef MM_THREADS
+  tcacheFlush();
+#endif
+}
+
 // Optional (bonus) functions:
 // Resize a previously allocated block to new_size bytes,
 // preserving data. [See additional credit]
 // On error, return NULL pointer
-void* mm_realloc(void* ptr, size_t new_size) {
+void* arenaRealloc(void* ptr, size_t new_size) {
+  MM_LOCKED();
   // Check pointer
-  printf("\nREALLOC | Got request for realloc at %p to new size %zu\n",
-         (void*)ptr, new_size);
   if (ptr == NULL) {             // Check the pointer is real
-    return mm_malloc(new_size);  // Just malloc new block
+    return arenaMalloc(new_size);  // Just malloc new block
   }
   if (new_size == 0) {
-    mm_free(ptr);  // Same size anyways
+    arenaFree(ptr);  // Same size anyways
     return NULL;
   }
-  if ((uint8_t*)ptr < g_heap ||
-      (uint8_t*)ptr >= g_heap + g_heap_size) {  // Check pointer is in heap
-    printf("Realloc | Invalid pointer (not in heap).\n");
+  slab* s = slabFind(ptr);
+  if (s != NULL) {  // Small object: stay in the slot if it still fits
+    if (slabCheckSlot(s, ptr) != 0) {
+      statsCorruption(TRACE_REALLOC, ptr, new_size);
+      return NULL;
+    }
+    if (leaseFind((header*)((uint8_t*)ptr - sizeof(header))) != NULL) {
+      MM_TRACE_ERROR(TRACE_REALLOC, ptr, new_size, TRACE_LEASED);
+      return NULL;
+    }
+    if (new_size <= s->slot_size) {
+      slabSetSize(s, (size_t)slabSlotIndex(s, ptr), new_size);
+      return ptr;
+    }
+    void* new_ptr = arenaMalloc(new_size);
+    if (new_ptr != NULL) {
+      arenaWrite(new_ptr, 0, ptr, slabSize(s, ptr));  // Keeps digests valid
+      arenaFree(ptr);
+    }
+    return new_ptr;
+  }
+  if (in_heap(ptr) == 0) {  // Check pointer is in heap
+    MM_TRACE_ERROR(TRACE_REALLOC, ptr, new_size, TRACE_INVALID_PTR);
     return NULL;  // Ignore NULL
   }
   // Get header from payload pointer
   header* hdr = (header*)((uint8_t*)ptr - sizeof(header));
-  if ((uint8_t*)hdr < g_heap ||
-      (uint8_t*)hdr >= g_heap + g_heap_size) {  // Check the supposed header
-                                                // from payload is in the heap
-    printf("Realloc | Invalid header from calc.\n");
+  if (in_heap(hdr) == 0) {  // Check the supposed header
+                            // from payload is in the heap
+    MM_TRACE_ERROR(TRACE_REALLOC, ptr, new_size, TRACE_INVALID_PTR);
     return NULL;  // Ignore NULL
   }
-  printf("REALLOC | Found header at %p | Current Size: %zu\n", (void*)hdr,
-         hdr->size);
   // Validate block
   if (checkBlock(hdr) != 0) {  // Check for corruption
-    printf("Realloc | I think it's corrupted...\n");
+    statsCorruption(TRACE_REALLOC, ptr, new_size);
     return NULL;  // Corrupted block
   }
   if (hdr->status != 1) {  // Check if allocated
-    printf("Write | I think it's already free\n");
+    MM_TRACE_ERROR(TRACE_REALLOC, ptr, new_size, TRACE_NOT_ALLOCATED);
     return NULL;  // Double free or invalid/broken block
   }
+  if (leaseFind(hdr) != NULL) {  // Moving it would break the lease pointer
+    MM_TRACE_ERROR(TRACE_REALLOC, ptr, new_size, TRACE_LEASED);
+    return NULL;
+  }
   if (new_size == hdr->size) {
     return ptr;  // Same size anyways
   }
 
   // Pre-calc
-  // Check if there's a space after the block to expand into
+  // Check if there's a free block on either side to expand/reduce into
   uint8_t* blockStart = ((uint8_t*)ptr - hdr->padding - sizeof(header));
-  header* next_block_addr = (header*)((uint8_t*)ptr + hdr->size);
-  header* next = NULL;
-  header* prev = NULL;
-  // Traverse the free list
-  freeBlock* curr = freeListHead;
-  while (curr != NULL) {
-    printf("----\n");
-    header* currHdr = curr->hdr;
-    uint8_t* currEnd = (uint8_t*)currHdr + currHdr->size;
-    printf("Block %p ends at %p\n", (void*)currHdr, (void*)currEnd);
-    if (currEnd == blockStart) {
-      printf("Found prev block to merge with at: %p\n", (void*)currHdr);
-      prev = currHdr;
-    }
-    if (currHdr == next_block_addr) {
-      printf("Found next block to merge with at: %p\n", (void*)currHdr);
-      next = currHdr;
-    }
-    printf(
-        "Looking at Block | Addr: %p | Header Addr: %p | Size: %zu | status: "
-        "%u | Checksum: %u\n",
-        (void*)curr, (void*)currHdr, currHdr->size, currHdr->status,
-        currHdr->checksum);
-    curr = curr->next;
-  }
-  printf("----\n");
+  uint8_t* blockEnd = blockEndFinder(hdr);
+  header* next = nextFreeNeighbour(blockEnd);
+  header* prev = prevFreeNeighbour(blockStart);
+  uint8_t* nextEnd = next != NULL ? (uint8_t*)next + next->size : blockEnd;
+  // Bytes needed after the header: payload and its digest table
+  size_t needed = new_size + digestBytes(new_size);
   // Logic to resize
   if (new_size > hdr->size) {  // Make the block bigger
-    printf("Realloc | Trying to expand block from %zu to %zu\n", hdr->size,
-           new_size);
-    if (next != NULL) {
+    if (next != NULL &&
+        needed <= (size_t)(nextEnd - (uint8_t*)ptr)) {  // Enough Space
       // Try to merge with next block and see if we can fit
-      printf("Realloc | Found space to expand into adjacent next block\n");
-      if (next_block_addr->size > (new_size - hdr->size)) {  // Enough Space
-        // Remove next block from free list
-        freeBlock* next_fb = (freeBlock*)payloadFinder(next_block_addr);
-        size_t oldFreeSize = next_block_addr->size;
-        remove_free(&freeListHead, next_fb);
-
-        // If there's enough space left over, create a new free block
-        if (oldFreeSize - (new_size - hdr->size) >
-            sizeof(header) + sizeof(freeBlock)) {
-          header* newFreeHeader =
-              (header*)((uint8_t*)next_block_addr + new_size - hdr->size);
-          newFreeHeader->size = oldFreeSize - (new_size - hdr->size);
-          newFreeHeader->status = 0;  // Free
-          newFreeHeader->padding = 0;
-          // Create new free block struct and insert into free list
-          freeBlock* new_free_block = (freeBlock*)payloadFinder(newFreeHeader);
-          new_free_block->hdr = newFreeHeader;
-          insert_free(&freeListHead, new_free_block);
-          newFreeHeader->checksum = checkSumCalc(newFreeHeader);
-          newFreeHeader->checksumNOT = ~newFreeHeader->checksum;
-          newFreeHeader->checksumXOR =
-              newFreeHeader->checksum ^ newFreeHeader->checksumNOT;
-
-          // Update current block size
-          hdr->size = new_size;
-          hdr->checksum = checkSumCalc(hdr);  // Update checksum
-          hdr->checksumNOT = ~hdr->checksum;
-          hdr->checksumXOR = hdr->checksum ^ hdr->checksumNOT;
-          return ptr;
-        }
-        printf(
-            "Realloc | Not enough space left over to create new free block\n");
-        next = NULL;
+      MM_TRACE_STEP(TRACE_EXPAND, ptr, new_size);
+      claimFreeBlock(next);  // Remove next block from free list
+      uint8_t* newEnd = (uint8_t*)ptr + needed;
+      size_t slack = 0;
+      if (newEnd < blockStart + MIN_FREE_BLOCK) {  // Must fit a free block
+        slack = blockStart + MIN_FREE_BLOCK - newEnd;
+        newEnd = blockStart + MIN_FREE_BLOCK;
+      }
+      size_t remaining_size = nextEnd - newEnd;
+      wipeDrop(blockEnd, remaining_size >= MIN_FREE_BLOCK ? newEnd : nextEnd);
+
+      // If there's enough space left over, create a new free block
+      if (remaining_size >= MIN_FREE_BLOCK) {
+        wipeFreeBody(newEnd, remaining_size, newEnd,
+                     blockEnd + sizeof(header) + sizeof(freeBlock));
+        createFreeBlock(newEnd, remaining_size);
       } else {
-        printf("Realloc | Not enough space in next block to expand into\n");
-        next = NULL;  // Can't use next block
+        slack += remaining_size;  // Absorb the whole next block
       }
+      g_arena->stats.payload_bytes += new_size - hdr->size;
+      slabHeapTally(hdr->size, new_size);
+      hdr->size = new_size;
+      hdr->slack = (uint8_t)slack;
+      sealBlock(hdr);  // Update digests and checksum
+      return ptr;
     }
     if (prev != NULL) {
-      size_t expansion = new_size - hdr->size;
-      printf("Realloc | Found space to expand into adjacent previous block\n");
-
-      // Attempt to find enough space in the previous block to place the header
-      // into
-      uint8_t* new_start_payload = (uint8_t*)ptr - (expansion);
-      uint8_t* new_start_head = (uint8_t*)new_start_payload - sizeof(header);
-      printf("Expansion: %zu | New Start Payload: %p\n", expansion,
-             (void*)new_start_payload);
-      // Calculate offset assuming we place the header + payload with padding=0
-      size_t padding = paddingCalc((header*)new_start_head);
-      printf("Realloc | Padding calculated for %p header as %zu\n",
-             (void*)(new_start_payload - sizeof(header)), padding);
-      // Check if there's enough space in the previous block
-      if (sizeof(header) + sizeof(freeBlock) <=
-          prev->size - padding - (expansion)) {
-        // Resize previous block and recalc its checksum
-        size_t oldSizeAllocated = hdr->size;
-        prev->size = prev->size - (expansion) + hdr->padding - padding;
-        prev->checksum = checkSumCalc(prev);  // Update checksum
-        prev->checksumNOT = ~prev->checksum;
-        prev->checksumXOR = prev->checksum ^ prev->checksumNOT;
-        // Move header to new location
-        header* new_hdr = (header*)(new_start_payload - sizeof(header));
+      // Slide the block down into the previous free block (and the next one
+      // too if it is free)
+      uint8_t* regionStart = (uint8_t*)prev;
+      size_t padding = paddingCalc(prev);
+      size_t slack = 0;
+      size_t total_block_size = padding + sizeof(header) + needed;
+      if (total_block_size < MIN_FREE_BLOCK) {
+        slack = MIN_FREE_BLOCK - total_block_size;
+        total_block_size = MIN_FREE_BLOCK;
+      }
+      if (total_block_size <= (size_t)(nextEnd - regionStart)) {
+        MM_TRACE_STEP(TRACE_EXPAND, prev, new_size);
+        claimFreeBlock(prev);
+        if (next != NULL) {
+          claimFreeBlock(next);
+        }
+        header* new_hdr = (header*)(regionStart + padding);
+        uint8_t* new_ptr = payloadFinder(new_hdr);
+        size_t old_size = hdr->size;  // The move can overwrite hdr
+        // Move payload data (new payload is never after the old one)
+        memmove(new_ptr, ptr, old_size);
+
+        uint8_t* newEnd = regionStart + total_block_size;
+        size_t remaining_size = nextEnd - newEnd;
+        wipeDrop(regionStart,
+                 remaining_size >= MIN_FREE_BLOCK ? newEnd : nextEnd);
+        if (remaining_size >= MIN_FREE_BLOCK) {
+          // Old data (and next's old header) may be left in the new free block
+          wipeFreeBody(newEnd, remaining_size, newEnd,
+                       blockEnd + sizeof(header) + sizeof(freeBlock));
+          createFreeBlock(newEnd, remaining_size);
+        } else {
+          slack += remaining_size;  // Absorb the rest of the region
+        }
+        for (size_t i = 0; i < padding; i++) {
+          regionStart[i] = 0x33;  // Padding marker
+        }
+        g_arena->stats.payload_bytes += new_size - old_size;
+        slabHeapTally(old_size, new_size);
         new_hdr->size = new_size;
         new_hdr->status = 1;  // Allocated
         new_hdr->padding = (uint8_t)padding;
-        // Move payload data
-        memmove((uint8_t*)new_hdr + sizeof(header) + padding, ptr, hdr->size);
-        // Wipe data after the old data location
-        uint8_t* wipe_start =
-            (uint8_t*)new_hdr + oldSizeAllocated + sizeof(header);
-        size_t wipe_area_size = expansion;
-        printf("Free | Wiping from %p for %zu bytes\n", (void*)wipe_start,
-               wipe_area_size);
-        if (wipe_area_size > 0) {
-          for (size_t i = 0; i < wipe_area_size; ++i) {
-            size_t absolute_offset = (uint8_t*)wipe_start - g_heap;
-            wipe_start[i] = UNUSED_PATTERN[(absolute_offset + i) % 5];
-          }
-        }
-        new_hdr->checksum = checkSumCalc(new_hdr);  // Update checksum
-        new_hdr->checksumNOT = ~new_hdr->checksum;
-        new_hdr->checksumXOR = new_hdr->checksum ^ new_hdr->checksumNOT;
-        // Return new pointer
-        return (void*)((uint8_t*)new_hdr + sizeof(header));
-      } else {
-        printf("Realloc | Not enough space in previous block to expand into\n");
-        return NULL;
+        new_hdr->slack = (uint8_t)slack;
+        sealBlock(new_hdr);  // Update digests and checksum
+        return (void*)new_ptr;
       }
     }
     // If not, try to malloc a new block, copy data, free old block
-    void* new_ptr = mm_malloc(new_size);
+    void* new_ptr = heapMalloc(new_size);  // Bigger than the old block
     if (new_ptr != NULL) {
       size_t to_copy = (hdr->size < new_size) ? hdr->size : new_size;
       memcpy(new_ptr, ptr, to_copy);
-      mm_free(ptr);
+      header* new_hdr = (header*)((uint8_t*)new_ptr - sizeof(header));
+      sealBlock(new_hdr);  // Copied data changes the digests
+      arenaFree(ptr);
       return new_ptr;
     }
-    printf("Realloc | Couldn't find enough space to expand block\n");
+    MM_TRACE_ERROR(TRACE_REALLOC, ptr, new_size, TRACE_NO_SPACE);
     return NULL;
   } else {  // Make the block smaller
-    printf("Realloc | Trying to reduce block from %zu to %zu\n", hdr->size,
-           new_size);
-    size_t reduction = hdr->size - new_size;
-    // Check if we can do it coalesce manually (since free requires 24+16 bytes
-    // to auto-coalesce)
+    MM_TRACE_STEP(TRACE_SHRINK, ptr, new_size);
+    uint8_t* newEnd = (uint8_t*)ptr + needed;
+    // The block must still be able to hold a free block once freed
+    uint8_t* keepEnd = newEnd;
+    if (keepEnd < blockStart + MIN_FREE_BLOCK) {
+      keepEnd = blockStart + MIN_FREE_BLOCK;
+    }
     if (next != NULL) {  // Coalesce with the next free block
-      printf("Realloc | Found adjacent next free block to reduce into\n");
-      printFreeList();
-      // Delete the old free block
-      freeBlock* next_fb = (freeBlock*)payloadFinder(next);
-      size_t oldFreeSize = next->size;
-      remove_free(&freeListHead, next_fb);
-
-      // Create a new free block where the new end of the block is
-      header* newFreeBlock = (header*)(ptr + new_size);
-      newFreeBlock->padding = 0;
-      newFreeBlock->status = 0;
-      newFreeBlock->size = reduction + oldFreeSize;
-      // Create new free block struct and insert into free list
-      freeBlock* new_free_block = (freeBlock*)payloadFinder(newFreeBlock);
-      new_free_block->hdr = newFreeBlock;
-      insert_free(&freeListHead, new_free_block);
-      printFreeList();
-      // Checksum
-      newFreeBlock->checksum = checkSumCalc(newFreeBlock);
-      newFreeBlock->checksumNOT = ~newFreeBlock->checksum;
-      newFreeBlock->checksumXOR =
-          newFreeBlock->checksum ^ newFreeBlock->checksumNOT;
-
-      // Update the header
-      hdr->size = new_size;
-      hdr->checksum = checkSumCalc(hdr);  // Update checksum
-      hdr->checksumNOT = ~hdr->checksum;
-      hdr->checksumXOR = hdr->checksum ^ hdr->checksumNOT;
-      // Return old pointer
-      return ptr;
+      // Delete the old free block and create one where the block now ends
+      // (only the given back bytes and next's old header need the pattern)
+      claimFreeBlock(next);
+      wipeFreeBody(keepEnd, nextEnd - keepEnd, keepEnd,
+                   blockEnd + sizeof(header) + sizeof(freeBlock));
+      createFreeBlock(keepEnd, nextEnd - keepEnd);
+    } else if (keepEnd + MIN_FREE_BLOCK <= blockEnd) {
+      // If not, check to see if we can just create a new block afterwards
+      wipeFreeBody(keepEnd, blockEnd - keepEnd, keepEnd, blockEnd);
+      createFreeBlock(keepEnd, blockEnd - keepEnd);
+    } else {
+      // If not, keep the (too small to split) space as slack
+      keepEnd = blockEnd;
     }
-    // If not, check to see if we can just create a new block afterwards
-    if (reduction >= 40) {
-      header* newFreeBlock = (header*)(ptr + new_size);
-      newFreeBlock->padding = 0;
-      newFreeBlock->status = 0;
-      newFreeBlock->size = reduction;
-      // Create new free block struct and insert into free list
-      freeBlock* new_free_block = (freeBlock*)payloadFinder(newFreeBlock);
-      new_free_block->hdr = newFreeBlock;
-      insert_free(&freeListHead, new_free_block);
-      // Checksum
-      newFreeBlock->checksum = checkSumCalc(newFreeBlock);
-      newFreeBlock->checksumNOT = ~newFreeBlock->checksum;
-      newFreeBlock->checksumXOR =
-          newFreeBlock->checksum ^ newFreeBlock->checksumNOT;
-
-      // Update the header
-      hdr->size = new_size;
-      hdr->checksum = checkSumCalc(hdr);  // Update checksum
-      hdr->checksumNOT = ~hdr->checksum;
-      hdr->checksumXOR = hdr->checksum ^ hdr->checksumNOT;
-      return ptr;
+    // Update the header
+    g_arena->stats.payload_bytes -= hdr->size - new_size;
+    slabHeapTally(hdr->size, new_size);
+    hdr->size = new_size;
+    hdr->slack = (uint8_t)(keepEnd - newEnd);
+    sealBlock(hdr);  // Update digests and checksum
+    return ptr;
+  }
+}
+
+typedef struct verifyTally {  // What arenaVerifyFree found
+  int quarantined;
+  arenaStats free;  // Recount of the free_* counters
+} verifyTally;
+
+// Deferred integrity check of one free block, quarantines it if corrupted
+void verifyFreeBlock(header* hdr, void* ctx) {
+  verifyTally* tally = (verifyTally*)ctx;
+  freeBlock* fb = (freeBlock*)payloadFinder(hdr);
+  if (in_heap(hdr) == 0 || fb->hdr != hdr || checkBlock(hdr) != 0 ||
+      hdr->size < MIN_FREE_BLOCK ||
+      hdr->size >
+          (size_t)(g_arena->heap + g_arena->heap_size - (uint8_t*)hdr) ||
+      !freeTagsMatch(hdr, footerFinder(hdr)) || checkFreePattern(hdr) != 0) {
+    statsCorruption(TRACE_VERIFY, hdr, hdr->size);
+    quaranFreeBlock(hdr);
+    tally->quarantined++;
+    return;
+  }
+  statsFreeCount(&tally->free, hdr->size);
+}
+
+// Deferred integrity check of the free space: verifies every free block's
+// metadata and that its unused space still holds the pattern. Corrupted
+// blocks are quarantined. Returns the number of blocks quarantined.
+// Also recounts the free space statistics (see stats.h).
+int arenaVerifyFree(void) {
+  MM_LOCKED();
+#ifdef MM_THREADS
+  remoteDrain();  // Queued frees count as free
+#endif
+  MM_STAT_INC(g_arena->stats.ops[TRACE_VERIFY]);
+  verifyTally tally;
+  memset(&tally, 0, sizeof(tally));
+  policyActive()->forEach(verifyFreeBlock, &tally);
+  g_arena->stats.free_bytes = tally.free.free_bytes;
+  g_arena->stats.free_blocks = tally.free.free_blocks;
+  g_arena->stats.free_squares = tally.free.free_squares;
+  memcpy(g_arena->stats.free_hist, tally.free.free_hist,
+         sizeof(tally.free.free_hist));
+  return tally.quarantined;
+}
+
+// Public API: pick the arena, then run the arena function in it
+
+// Initialize the default arena over a provided memory block (and stop
+// spreading over several arenas). Returns 0 on success, non-zero on failure.
+int mm_init(uint8_t* heap, size_t heap_size) {
+  g_arena_count = 1;
+  mm_arena_t* prev = arenaEnter(&g_arenas[0]);
+  int result = arenaInit(heap, heap_size);
+  arenaEnter(prev);
+  return result;
+}
+
+// Split the heap into count arenas (max MM_MAX_ARENAS). mm_malloc then uses
+// the arena of the calling CPU (MM_SPREAD_CPU) or thread (MM_SPREAD_THREAD),
+// and another one only if that arena is full. Parts are multiples of
+// ALIGN * 5 bytes so they keep the heap's alignment and pattern phase.
+int mm_init_arenas(uint8_t* heap, size_t heap_size, size_t count, int mode) {
+  if (count == 0 || count > MM_MAX_ARENAS || heap == NULL) {
+    MM_TRACE_ERROR(TRACE_INIT, heap, count, TRACE_INVALID_ARG);
+    return -1;  // Failure
+  }
+  size_t part = heap_size / count / (ALIGN * 5) * (ALIGN * 5);
+  for (size_t i = 0; i < count; i++) {
+    size_t size = i + 1 < count ? part : heap_size - part * i;
+    mm_arena_t* prev = arenaEnter(&g_arenas[i]);
+    int result = arenaInit(heap + part * i, size);
+    arenaEnter(prev);
+    if (result != 0) {
+      g_arena_count = 1;
+      return -1;  // Failure
     }
-    // If not, try to malloc and find a new space
-    void* new_ptr = mm_malloc(new_size);
-    if (new_ptr != NULL) {
-      size_t to_copy = (hdr->size < new_size) ? hdr->size : new_size;
-      memcpy(new_ptr, ptr, to_copy);
-      mm_free(ptr);
-      return new_ptr;
+  }
+  g_arena_mode = mode;
+  g_arena_count = count;
+  return 0;  // Success
+}
+
+void* mm_malloc(size_t size) {
+  MM_RECORDING();
+  mm_arena_t* home = arenaPick();
+  void* ptr = mm_arena_malloc(home, size);
+  for (size_t i = 0; ptr == NULL && size != 0 && i < g_arena_count; i++) {
+    if (&g_arenas[i] != home) {  // Home arena is full, borrow from another
+      ptr = mm_arena_malloc(&g_arenas[i], size);
     }
-    // If not, just leave it as is (too small to split)
-    return NULL;
   }
+  MM_RECORD(RECORD_MALLOC, NULL, ptr, size, 0, ptr == NULL);
+  return ptr;
+}
+
+void mm_free(void* ptr) {
+  MM_RECORDING();
+  mm_arena_free(arenaOf(ptr), ptr);
+  MM_RECORD(RECORD_FREE, ptr, NULL, 0, 0, 0);
+}
+
+int mm_read(void* ptr, size_t offset, void* buf, size_t len) {
+  MM_RECORDING();
+  int count = mm_arena_read(arenaOf(ptr), ptr, offset, buf, len);
+  MM_RECORD(RECORD_READ, ptr, NULL, len, offset, count < 0);
+  return count;
+}
+
+int mm_write(void* ptr, size_t offset, const void* src, size_t len) {
+  MM_RECORDING();
+  int count = mm_arena_write(arenaOf(ptr), ptr, offset, src, len);
+  MM_RECORD(RECORD_WRITE, ptr, NULL, len, offset, count < 0);
+  return count;
+}
+
+void* mm_realloc(void* ptr, size_t new_size) {
+  MM_RECORDING();
+  void* new_ptr = mm_arena_realloc(ptr != NULL ? arenaOf(ptr) : arenaPick(),
+                                   ptr, new_size);
+  MM_RECORD(RECORD_REALLOC, ptr, new_ptr, new_size, 0,
+            new_ptr == NULL && new_size != 0);
+  return new_ptr;
+}
+
+int mm_release(const void* ptr) {
+  return mm_arena_release(arenaOf(ptr), ptr);
+}
+
+size_t mm_usable_size(void* ptr) {
+  return mm_arena_usable_size(arenaOf(ptr), ptr);
+}
+
+// Checks the free space of every arena mm_malloc uses
+int mm_verify_free(void) {
+  int quarantined = 0;
+  for (size_t i = 0; i < g_arena_count; i++) {
+    mm_arena_t* prev = arenaEnter(&g_arenas[i]);
+    quarantined += arenaVerifyFree();
+    arenaEnter(prev);
+  }
+  return quarantined;
+}
+
+// A separate heap with its own handle, independent of mm_init and of every
+// other arena. NULL if the heap is invalid or all handles are taken.
+mm_arena_t* mm_arena_init(uint8_t* heap, size_t heap_size) {
+  for (size_t i = 0; i < MM_MAX_ARENAS; i++) {
+    mm_arena_t* arena = &g_user_arenas[i];
+    if (__atomic_exchange_n(&arena->in_use, 1, __ATOMIC_ACQ_REL)) {
+      continue;  // Taken
+    }
+    mm_arena_t* prev = arenaEnter(arena);
+    int result = arenaInit(heap, heap_size);
+    arenaEnter(prev);
+    if (result != 0) {
+      __atomic_store_n(&arena->in_use, 0, __ATOMIC_RELEASE);
+      return NULL;
+    }
+    return arena;
+  }
+  MM_TRACE_ERROR(TRACE_INIT, heap, heap_size, TRACE_LIMIT);
+  return NULL;
+}
+
+void* mm_arena_malloc(mm_arena_t* arena, size_t size) {
+  MM_TRACE_BEGIN();
+  MM_STAT_INC(arena->stats.ops[TRACE_MALLOC]);
+  mm_arena_t* prev = arenaEnter(arena);
+  void* ptr = arenaMalloc(size);
+  MM_PROFILE_MALLOC(ptr, size);
+  arenaEnter(prev);
+  MM_TRACE_END(TRACE_MALLOC, ptr, size);
+  MM_TELEMETRY_TICK();
+  MM_STORM_TICK(arena);
   return ptr;
 }
 
-// Output current heap usage and integrity statistics
-// for debugging (No Credit, helper function).
-void mm_heap_stats(void);
+void mm_arena_free(mm_arena_t* arena, void* ptr) {
+  MM_TRACE_BEGIN();
+  MM_STAT_INC(arena->stats.ops[TRACE_FREE]);
+  MM_PROFILE_FREE(ptr);  // Before another thread can get the block
+  mm_arena_t* prev = arenaEnter(arena);
+  arenaFree(ptr);
+  arenaEnter(prev);
+  MM_TRACE_END(TRACE_FREE, ptr, 0);
+  MM_TELEMETRY_TICK();
+  MM_STORM_TICK(arena);
+}
+
+int mm_arena_read(mm_arena_t* arena, void* ptr, size_t offset, void* buf,
+                  size_t len) {
+  MM_TRACE_BEGIN();
+  MM_STAT_INC(arena->stats.ops[TRACE_READ]);
+  mm_arena_t* prev = arenaEnter(arena);
+  int count = arenaRead(ptr, offset, buf, len);
+  arenaEnter(prev);
+  MM_TRACE_END(TRACE_READ, ptr, len);
+  MM_TELEMETRY_TICK();
+  MM_STORM_TICK(arena);
+  return count;
+}
+
+int mm_arena_write(mm_arena_t* arena, void* ptr, size_t offset,
+                   const void* src, size_t len) {
+  MM_TRACE_BEGIN();
+  MM_STAT_INC(arena->stats.ops[TRACE_WRITE]);
+  mm_arena_t* prev = arenaEnter(arena);
+  int count = arenaWrite(ptr, offset, src, len);
+  arenaEnter(prev);
+  MM_TRACE_END(TRACE_WRITE, ptr, len);
+  MM_TELEMETRY_TICK();
+  MM_STORM_TICK(arena);
+  return count;
+}
+
+void* mm_arena_realloc(mm_arena_t* arena, void* ptr, size_t new_size) {
+  MM_TRACE_BEGIN();
+  MM_STAT_INC(arena->stats.ops[TRACE_REALLOC]);
+  MM_PROFILE_FREE(ptr);  // A failed realloc loses its sample
+  mm_arena_t* prev = arenaEnter(arena);
+  void* new_ptr = arenaRealloc(ptr, new_size);
+  MM_PROFILE_MALLOC(new_ptr, new_size);
+  arenaEnter(prev);
+  MM_TRACE_END(TRACE_REALLOC, new_ptr, new_size);
+  MM_TELEMETRY_TICK();
+  MM_STORM_TICK(arena);
+  return new_ptr;
+}
+
+// Leases and usable size of a handle's blocks (mm_acquire_ro etc. only look
+// in the arenas mm_malloc uses)
+const void* mm_arena_acquire_ro(mm_arena_t* arena, void* ptr, size_t* size) {
+  mm_arena_t* prev = arenaEnter(arena);
+  const void* payload = acquireLease(ptr, size, LEASE_RO);
+  arenaEnter(prev);
+  return payload;
+}
+
+void* mm_arena_acquire_rw(mm_arena_t* arena, void* ptr, size_t* size) {
+  mm_arena_t* prev = arenaEnter(arena);
+  void* payload = acquireLease(ptr, size, LEASE_RW);
+  arenaEnter(prev);
+  return payload;
+}
+
+int mm_arena_release(mm_arena_t* arena, const void* ptr) {
+  mm_arena_t* prev = arenaEnter(arena);
+  int result = arenaRelease(ptr);
+  arenaEnter(prev);
+  return result;
+}
+
+size_t mm_arena_usable_size(mm_arena_t* arena, void* ptr) {
+  mm_arena_t* prev = arenaEnter(arena);
+  size_t size = arenaUsableSize(ptr);
+  arenaEnter(prev);
+  return size;
+}
+
+// Heap usage and integrity statistics: mm_heap_stats/mm_arena_stats (stats.c)
+// Debug dumps (No Credit, helper functions):
 // -> print* functions, printBlock(), printHeap(), printWholeHeap(),
 // printFreeList()
@@ -4,20 +4,21 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "trace.h"
+
 // TO DO:
 // CHECK REALLOC
 // FIX MALLOC/FREE (SOMEHOW BROKEN IN AUTOGRADER)
 
 // Structs
-typedef struct header {  // Should be 16 bytes allocated for this, but it's
-                         // really 13 bytes padded to 16
+typedef struct header {  // 16 bytes
   size_t size;           // Size of the payload | 8 bytes
   uint8_t status;  // Free status, 0=Free, 1=Allocated, Else=Quarantined(Assume
                    // corrupted) | 1 byte
-  uint8_t checksum;     // Corruption detection | 1 byte
-  uint8_t checksumNOT;  // Corruption detection | 1 byte
-  uint8_t checksumXOR;  // Corruption detection | 1 byte
-  uint8_t padding;      // Padding to align payload to 40 bytes | 1 byte
+  uint8_t padding;       // Padding to align payload to 40 bytes | 1 byte
+  uint8_t slack;         // Unused bytes after the digest table | 1 byte
+  uint8_t ecc;  // SECDED code of the other 15 bytes (ecc.h) | 1 byte
+  uint32_t checksum;     // CRC32C corruption detection (checksum.c) | 4 bytes
 } header;
 
 typedef struct freeBlock {  // Should be 24 bytes allocated for this on 64-bit
@@ -28,18 +29,105 @@ typedef struct freeBlock {  // Should be 24 bytes allocated for this on 64-bit
 
 typedef freeBlock freeBlockHeader;
 
-extern uint8_t UNUSED_PATTERN[5];
-extern freeBlockHeader* freeListHead;
-extern uint8_t* g_heap;
-extern size_t g_heap_size;
+typedef struct footer {  // Boundary tag at the end of each free block, 16 bytes
+  size_t size;           // Size of the entire free block (same as its header)
+  uint8_t status;        // Mirrors the header status (0=Free)
+  uint32_t checksum;     // CRC32C of size and status | 4 bytes
+} footer;
+
+#define ALIGN 40  // Payload alignment (relative to the start of the heap)
+
+// Smallest region that can hold a free block: [Header][FreeBlockStruct][Footer]
+#define MIN_FREE_BLOCK (sizeof(header) + sizeof(freeBlock) + sizeof(footer))
+
+// Payloads bigger than one chunk get a digest table after the payload:
+// [Table Digest][Chunk 0 Digest]...[Chunk N-1 Digest], 4 bytes each
+#define PAYLOAD_CHUNK 256
+
+// Zero-copy leases: a verified, direct pointer into a payload. Read/write
+// leases are exclusive and reseal the block on release, read-only leases can
+// be shared and are re-verified on release when lease debugging is on
+#define MAX_LEASES 32
+#define LEASE_RO 1
+#define LEASE_RW 2
+
+typedef struct lease {
+  header* hdr;    // Leased block, NULL = free slot
+  uint8_t mode;   // LEASE_RO or LEASE_RW
+  uint32_t refs;  // Number of holders (always 1 for LEASE_RW)
+} lease;
+
+// Arenas (arena.h): independent heaps, each with its own state. The mm_*
+// functions use the default arena, or with mm_init_arenas a set of arenas
+// picked per CPU (or per thread) for new blocks and by address otherwise.
+typedef struct mm_arena mm_arena_t;
+#define MM_SPREAD_CPU 0     // mm_init_arenas: arena = sched_getcpu() % count
+#define MM_SPREAD_THREAD 1  // mm_init_arenas: arena = thread number % count
+
 
 // Helper Functions
 size_t paddingCalc(header* first_byte);
 size_t blockSize(header* hdr);
+uint8_t* blockEndFinder(header* hdr);
 uint8_t* payloadFinder(header* hdr);
+header* blockAt(uint8_t* start, uint8_t** end, int* is_free);
 header* searchBestFree(size_t size);
-uint8_t checkSumCalc(header* h);
+size_t fitSize(header* freeHdr, size_t size);
+int in_heap(void* ptr);
+uint32_t checkSumCalc(header* h);
+void sealHeader(header* h);
+uint8_t headerCode(header* h);
+int headerRepair(header* h);
+int isAllocated(header* h);
 int checkBlock(header* h);
+int checkHeader(header* h);
+int checkChunks(header* h, size_t offset, size_t len);
+void sealBlock(header* h);
+void patchBlock(header* h, size_t offset, const void* src, size_t len);
+void resealChunks(header* h, size_t offset, size_t len);
+void quaranBlock(header* head);
+
+// Payload Digest Functions:
+size_t chunkCount(size_t size);
+size_t digestBytes(size_t size);
+uint32_t digestGet(header* h, size_t index);
+void digestSet(header* h, size_t index, uint32_t value);
+uint32_t chunkSumCalc(header* h, size_t chunk);
+uint32_t tableSumCalc(header* h);
+int checkFreePattern(header* h);
+int checkPattern(uint8_t* start, size_t len);
+void quaranFreeBlock(header* h);
+
+// Boundary Tag Functions:
+footer* footerFinder(header* freeHdr);
+uint32_t footerSumCalc(footer* f);
+void writeFooter(header* freeHdr);
+int freeTagsMatch(header* h, footer* f);
+header* prevFreeNeighbour(uint8_t* blockStart);
+header* nextFreeNeighbour(uint8_t* blockEnd);
+void patternWrite(uint8_t* dst, size_t absolute_offset, size_t len);
+void patternFill(uint8_t* start, size_t len);
+void wipeFreeBody(uint8_t* start, size_t size, uint8_t* dirtyStart,
+                  uint8_t* dirtyEnd);
+header* createFreeBlock(uint8_t* start, size_t size);
+void claimFreeBlock(header* freeHdr);
+
+// Arena internals (the mm_* functions without the arena selection)
+int arenaInit(uint8_t* heap, size_t heap_size);
+void* arenaMalloc(size_t size);
+void arenaFree(void* ptr);
+void arenaFreeLocked(void* ptr);
+int arenaRead(void* ptr, size_t offset, void* buf, size_t len);
+int arenaWrite(void* ptr, size_t offset, const void* src, size_t len);
+void* arenaRealloc(void* ptr, size_t new_size);
+int arenaRelease(const void* ptr);
+size_t arenaUsableSize(void* ptr);
+int arenaVerifyFree(void);
+
+// Lease Functions:
+lease* leaseFind(header* h);
+header* leaseTarget(const void* ptr);
+void* acquireLease(void* ptr, size_t* size, uint8_t mode);
 
 // Free List Functions:
 void insert_free(freeBlock** head, freeBlock* block);
@@ -49,17 +137,74 @@ void remove_free(freeBlock** head, freeBlock* block);
 void printWholeHeap();
 void printBlock(header* hdr);
 void printFreeList();
+void printFreeBlock(header* hdr, void* ctx);
 void printHeap();
 
 // API Functions:
 int mm_init(uint8_t* heap, size_t heap_size);
 void* mm_malloc(size_t size);
+void* heapMalloc(size_t size);
 int mm_read(void* ptr, size_t offset, void* buf, size_t len);
 int mm_write(void* ptr, size_t offset, const void* src, size_t len);
 void mm_free(void* ptr);
+void heapFree(void* ptr);
+int mm_verify_free(void);
+void verifyFreeBlock(header* hdr, void* ctx);
+int mm_init_policy(uint8_t* heap, size_t heap_size, const char* policy);
+const void* mm_acquire_ro(void* ptr, size_t* size);
+void* mm_acquire_rw(void* ptr, size_t* size);
+int mm_release(const void* ptr);
+void mm_lease_debug(int enabled);  // 1 = re-verify read-only leases
+size_t mm_usable_size(void* ptr);
+void mm_slab_enable(int enabled);  // 0 = small objects use the heap too
+void mm_thread_flush(void);  // Return this thread's cached slots (MM_THREADS)
+int mm_init_arenas(uint8_t* heap, size_t heap_size, size_t count, int mode);
+
+// Arena handle API (up to MM_MAX_ARENAS handles, NULL if none is left)
+mm_arena_t* mm_arena_init(uint8_t* heap, size_t heap_size);
+void* mm_arena_malloc(mm_arena_t* arena, size_t size);
+void mm_arena_free(mm_arena_t* arena, void* ptr);
+int mm_arena_read(mm_arena_t* arena, void* ptr, size_t offset, void* buf,
+                  size_t len);
+int mm_arena_write(mm_arena_t* arena, void* ptr, size_t offset,
+                   const void* src, size_t len);
+void* mm_arena_realloc(mm_arena_t* arena, void* ptr, size_t new_size);
+const void* mm_arena_acquire_ro(mm_arena_t* arena, void* ptr, size_t* size);
+void* mm_arena_acquire_rw(mm_arena_t* arena, void* ptr, size_t* size);
+int mm_arena_release(mm_arena_t* arena, const void* ptr);
+size_t mm_arena_usable_size(mm_arena_t* arena, void* ptr);
+
+// Heap statistics (stats.c), from counters the allocator keeps up to date
+#define STATS_BUCKETS 16  // Free size histogram: < 64, < 128, ..., >= 1 MB
+typedef struct heapStats {
+  size_t heap_bytes;
+  size_t in_use_bytes;    // Allocated blocks (slabs included), all of them
+  size_t payload_bytes;   // Their requested sizes, a slab counts as one block
+  size_t overhead_bytes;  // Headers, alignment padding, digest tables, slack
+  size_t free_bytes;
+  size_t free_blocks;
+  size_t largest_free;
+  size_t quarantined_blocks;
+  size_t quarantined_bytes;
+  size_t corrected_headers;  // Flipped header bits corrected instead
+  size_t recovered_blocks;   // Quarantined blocks mm_reclaim freed again
+  size_t recovered_bytes;    // The space it returned to the free pool
+  double fragmentation;  // 0 = one free block, towards 1 = many small ones
+  double avg_search;     // Free blocks looked at per placement search
+  size_t max_search;
+  size_t searches;
+  size_t scrub_passes;    // Full heap sweeps of the patrol scrubber (scrub.h)
+  size_t scrubbed_bytes;  // Bytes it verified, all passes
+  size_t pending_wipe_bytes;  // Freed bytes not re-patterned yet (wipe.h)
+  size_t checksum_failures[TRACE_PATHS];  // Indexed by TRACE_MALLOC etc.
+  size_t ops[TRACE_PATHS];                // Calls of each mm_* function
+  size_t free_hist[STATS_BUCKETS];  // Free blocks by size, powers of two
+} heapStats;
+
+heapStats mm_heap_stats(void);  // The arenas mm_malloc uses
+heapStats mm_arena_stats(mm_arena_t* arena);
 
 // Optional (bonus) functions:
 void* mm_realloc(void* ptr, size_t new_size);
-void mm_heap_stats(void);
 
 #endif
@@ -0,0 +1,64 @@
+#define _GNU_SOURCE  // sched_getcpu
+#include "arena.h"
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Zero-initialized (.bss): arenaInit sets the pattern before anything uses it
+mm_arena_t g_arenas[MM_MAX_ARENAS];
+mm_arena_t g_user_arenas[MM_MAX_ARENAS];
+size_t g_arena_count = 1;
+int g_arena_mode = MM_SPREAD_CPU;
+MM_TLS mm_arena_t* g_arena = &g_arenas[0];
+
+static size_t g_thread_count = 0;          // Threads seen by arenaPick
+static MM_TLS size_t g_thread_number = 0;  // 1-based, 0 = not numbered yet
+
+mm_arena_t* arenaEnter(mm_arena_t* arena) {
+  mm_arena_t* prev = g_arena;
+  g_arena = arena;
+  return prev;
+}
+
+// Same CPU (or thread) -> same arena, so independent cores don't share free
+// lists, slabs or a lock. Falls back to the thread number if the CPU isn't
+// known.
+mm_arena_t* arenaPick(void) {
+  if (g_arena_count <= 1) {
+    return &g_arenas[0];
+  }
+  int cpu = g_arena_mode == MM_SPREAD_CPU ? sched_getcpu() : -1;
+  if (cpu >= 0) {
+    return &g_arenas[(size_t)cpu % g_arena_count];
+  }
+  if (g_thread_number == 0) {
+    g_thread_number = __atomic_add_fetch(&g_thread_count, 1, __ATOMIC_RELAXED);
+  }
+  return &g_arenas[(g_thread_number - 1) % g_arena_count];
+}
+
+mm_arena_t* arenaOf(const void* ptr) {
+  for (size_t i = 0; i < g_arena_count; i++) {
+    mm_arena_t* a = &g_arenas[i];
+    if ((const uint8_t*)ptr >= a->heap &&
+        (const uint8_t*)ptr < a->heap + a->heap_size) {
+      return a;
+    }
+  }
+  return &g_arenas[0];  // In none of them, the default arena rejects it
+}
+
+#ifdef MM_THREADS
+void arenaLocksInit(void) {
+  // Recursive: mm_realloc calls the other internal functions, which lock too
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  for (size_t i = 0; i < MM_MAX_ARENAS; i++) {
+    pthread_mutex_init(&g_arenas[i].lock, &attr);
+    pthread_mutex_init(&g_user_arenas[i].lock, &attr);
+  }
+  pthread_mutexattr_destroy(&attr);
+}
+#endif
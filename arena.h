@@ -0,0 +1,71 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
+
+#include "allocator.h"
+#include "policy.h"
+#include "quarantine.h"
+#include "scrub.h"
+#include "slab.h"
+#include "stats.h"
+#include "tcache.h"
+#include "tlsf.h"
+#include "wipe.h"
+
+// Arenas: everything that describes one heap (the region and its pattern,
+// the free block index, the slabs and the leases) lives in an mm_arena.
+// Internal functions work on g_arena, the public functions point it at
+// their arena for the duration of the call. With MM_THREADS g_arena is per
+// thread and every arena has its own lock, so threads working in different
+// arenas never share free lists or locks.
+#define MM_MAX_ARENAS 8
+#define PATTERN_RUN 80  // Bytes patternFill copies at a time, 16 periods
+
+#ifdef MM_THREADS
+#define MM_TLS __thread
+#else
+#define MM_TLS
+#endif
+
+struct mm_arena {
+  uint8_t* heap;  // Start of the region, ALIGN is relative to it
+  size_t heap_size;
+  uint8_t pattern[5];                // Unused memory pattern (from mm_init)
+  uint8_t pattern_run[PATTERN_RUN + 4];  // It repeated, from any phase
+  const placementPolicy* policy;     // Selected when the arena was set up
+  tlsfIndex tlsf;                    // "tlsf" policy
+  freeBlockHeader* policy_list;      // Head of the list policies' list
+  freeBlockHeader* policy_rover;     // Where next-fit resumes
+  freeBlockHeader* policy_root;      // Root of the best-fit treap
+  slabRegistry slabs;                // Small objects
+  lease leases[MAX_LEASES];          // Outstanding zero-copy leases
+  size_t lease_count;  // Used slots, lets the common case skip the scan
+  int in_use;          // mm_arena_init handle taken
+  arenaStats stats;    // mm_heap_stats counters
+  scrubCursor scrub;   // Where the patrol scrubber is
+  quarantineRegistry quarantine;  // Regions mm_reclaim can free again
+  wipeQueue wipe;                 // Freed spans not patterned yet
+#ifdef MM_THREADS
+  pthread_mutex_t lock;  // Recursive, see heapLock
+  remoteFree* remote;    // Frees pushed by other threads (tcache.h)
+#endif
+};
+
+extern mm_arena_t g_arenas[MM_MAX_ARENAS];       // [0] = default arena
+extern mm_arena_t g_user_arenas[MM_MAX_ARENAS];  // mm_arena_init handles
+extern size_t g_arena_count;  // g_arenas that mm_malloc spreads over
+extern int g_arena_mode;      // MM_SPREAD_CPU or MM_SPREAD_THREAD
+extern MM_TLS mm_arena_t* g_arena;  // Arena of the current call
+
+mm_arena_t* arenaEnter(mm_arena_t* arena);  // Returns the previous g_arena
+mm_arena_t* arenaPick(void);                // Where mm_malloc allocates
+mm_arena_t* arenaOf(const void* ptr);       // Spread arena holding ptr
+void arenaLocksInit(void);                  // MM_THREADS, once
+
+#endif
@@ -0,0 +1,335 @@
+#include "checksum.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#define CHECKSUM_X86 1
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define CHECKSUM_ARM 1
+#endif
+
+#define CRC32C_POLY 0x82F63B78u  // Castagnoli polynomial, bit reflected
+
+// Lazily built tables: ready is 0 = Not built, 1 = Being built, 2 = Ready.
+// The first thread to need them builds them, threads in other arenas that
+// need them meanwhile wait for it
+static void buildOnce(int* ready, void (*build)(void)) {
+  if (__atomic_load_n(ready, __ATOMIC_ACQUIRE) == 2) {
+    return;
+  }
+  int expected = 0;
+  if (!__atomic_compare_exchange_n(ready, &expected, 1, 0, __ATOMIC_ACQUIRE,
+                                   __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(ready, __ATOMIC_ACQUIRE) != 2) {
+    }
+    return;
+  }
+  build();
+  __atomic_store_n(ready, 2, __ATOMIC_RELEASE);
+}
+
+// Scalar kernel: slicing-by-8 tables, built on first use
+static uint32_t crcTable[8][256];
+static int crcTableReady = 0;
+
+static void buildTables(void) {
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for (int k = 0; k < 8; k++) {
+      c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+    }
+    crcTable[0][n] = c;
+  }
+  for (uint32_t n = 0; n < 256; n++) {
+    uint32_t c = crcTable[0][n];
+    for (int k = 1; k < 8; k++) {
+      c = crcTable[0][c & 0xFF] ^ (c >> 8);
+      crcTable[k][n] = c;
+    }
+  }
+}
+
+static uint32_t crcScalar(uint32_t crc, const uint8_t* data, size_t len) {
+  buildOnce(&crcTableReady, buildTables);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (len >= 8) {  // 8 bytes per step, one table per byte
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    word ^= crc;
+    crc = crcTable[7][word & 0xFF] ^ crcTable[6][(word >> 8) & 0xFF] ^
+          crcTable[5][(word >> 16) & 0xFF] ^ crcTable[4][(word >> 24) & 0xFF] ^
+          crcTable[3][(word >> 32) & 0xFF] ^ crcTable[2][(word >> 40) & 0xFF] ^
+          crcTable[1][(word >> 48) & 0xFF] ^ crcTable[0][word >> 56];
+    data += 8;
+    len -= 8;
+  }
+#endif
+  while (len > 0) {  // Tail (or everything on big endian)
+    crc = crcTable[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    len--;
+  }
+  return crc;
+}
+
+static int alwaysSupported(void) { return 1; }
+
+// GF(2) helpers in the reflected domain (bit 31 = x^0), used to build the
+// constants that shift a CRC over a run of zero bytes
+static uint32_t multModP(uint32_t a, uint32_t b) {
+  uint32_t m = (uint32_t)1 << 31;
+  uint32_t p = 0;
+  for (;;) {
+    if (a & m) {
+      p ^= b;
+      if ((a & (m - 1)) == 0) {
+        break;
+      }
+    }
+    m >>= 1;
+    b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+  }
+  return p;
+}
+
+// x^(2^k) mod P for every bit of a 64-bit exponent, built on first use
+static uint32_t xPow2k[64];
+static int xPow2kReady = 0;
+
+static void buildXPow2k(void) {
+  xPow2k[0] = (uint32_t)1 << 30;  // x^1
+  for (int k = 1; k < 64; k++) {
+    xPow2k[k] = multModP(xPow2k[k - 1], xPow2k[k - 1]);
+  }
+}
+
+static uint32_t xPowModP(uint64_t n) {  // x^n mod P
+  buildOnce(&xPow2kReady, buildXPow2k);
+  uint32_t p = (uint32_t)1 << 31;  // x^0
+  for (int k = 0; n > 0; k++, n >>= 1) {
+    if (n & 1) {
+      p = multModP(p, xPow2k[k]);
+    }
+  }
+  return p;
+}
+
+#if CHECKSUM_X86
+static int cpuHas(unsigned int ecxBit) {
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+  return (ecx & ecxBit) != 0;
+}
+
+static int sse42Supported(void) { return cpuHas(bit_SSE4_2); }
+static int pclmulSupported(void) {
+  return cpuHas(bit_SSE4_2) && cpuHas(bit_PCLMUL);
+}
+
+// SSE4.2 kernel: one crc32 instruction per 8 bytes
+__attribute__((target("sse4.2"))) static uint32_t crcSse42(uint32_t crc,
+                                                           const uint8_t* data,
+                                                           size_t len) {
+  uint64_t c = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    c = _mm_crc32_u64(c, word);
+    data += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)c;
+  while (len > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    len--;
+  }
+  return crc;
+}
+
+// PCLMUL kernel: the crc32 instruction has a 3 cycle latency but can start
+// every cycle, so three independent streams are run side by side and then
+// folded together with a carry-less multiply by x^(8 * stream bytes).
+#define CRC_LONG 8192  // Bytes per stream for big buffers
+#define CRC_SHORT 256  // Bytes per stream for the remainder
+
+static uint32_t crcLongK[2];  // Shift by CRC_LONG and 2 * CRC_LONG bytes
+static uint32_t crcShortK[2];
+static int crcShiftReady = 0;
+
+// clmul(c, K) then crc32(0, .) multiplies by K * x^33, so K = x^(8n - 33)
+static void buildShiftConstants(void) {
+  crcLongK[0] = xPowModP(8ull * CRC_LONG - 33);
+  crcLongK[1] = xPowModP(16ull * CRC_LONG - 33);
+  crcShortK[0] = xPowModP(8ull * CRC_SHORT - 33);
+  crcShortK[1] = xPowModP(16ull * CRC_SHORT - 33);
+}
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crcFold3(
+    uint32_t crc0, uint32_t crc1, uint32_t crc2, const uint32_t* k) {
+  __m128i a = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc0),
+                                   _mm_cvtsi32_si128((int)k[1]), 0x00);
+  __m128i b = _mm_clmulepi64_si128(_mm_cvtsi32_si128((int)crc1),
+                                   _mm_cvtsi32_si128((int)k[0]), 0x00);
+  uint64_t folded = (uint64_t)_mm_cvtsi128_si64(_mm_xor_si128(a, b));
+  return (uint32_t)_mm_crc32_u64(0, folded) ^ crc2;
+}
+
+__attribute__((target("sse4.2,pclmul"))) static uint32_t crcPclmul(
+    uint32_t crc, const uint8_t* data, size_t len) {
+  buildOnce(&crcShiftReady, buildShiftConstants);
+  while (len >= 3 * CRC_LONG) {
+    uint64_t c0 = crc, c1 = 0, c2 = 0;
+    for (size_t i = 0; i < CRC_LONG; i += 8) {
+      uint64_t w0, w1, w2;
+      memcpy(&w0, data + i, 8);
+      memcpy(&w1, data + CRC_LONG + i, 8);
+      memcpy(&w2, data + 2 * CRC_LONG + i, 8);
+      c0 = _mm_crc32_u64(c0, w0);
+      c1 = _mm_crc32_u64(c1, w1);
+      c2 = _mm_crc32_u64(c2, w2);
+    }
+    crc = crcFold3((uint32_t)c0, (uint32_t)c1, (uint32_t)c2, crcLongK);
+    data += 3 * CRC_LONG;
+    len -= 3 * CRC_LONG;
+  }
+  while (len >= 3 * CRC_SHORT) {
+    uint64_t c0 = crc, c1 = 0, c2 = 0;
+    for (size_t i = 0; i < CRC_SHORT; i += 8) {
+      uint64_t w0, w1, w2;
+      memcpy(&w0, data + i, 8);
+      memcpy(&w1, data + CRC_SHORT + i, 8);
+      memcpy(&w2, data + 2 * CRC_SHORT + i, 8);
+      c0 = _mm_crc32_u64(c0, w0);
+      c1 = _mm_crc32_u64(c1, w1);
+      c2 = _mm_crc32_u64(c2, w2);
+    }
+    crc = crcFold3((uint32_t)c0, (uint32_t)c1, (uint32_t)c2, crcShortK);
+    data += 3 * CRC_SHORT;
+    len -= 3 * CRC_SHORT;
+  }
+  return crcSse42(crc, data, len);  // Less than 3 short streams left
+}
+#endif
+
+#if CHECKSUM_ARM
+// ARMv8 CRC extension kernel (always present when the compiler targets it)
+static uint32_t crcArm(uint32_t crc, const uint8_t* data, size_t len) {
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+    data += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = __crc32cb(crc, *data++);
+    len--;
+  }
+  return crc;
+}
+#endif
+
+// Slowest first, checksumAutoSelect picks the last supported one
+static const checksumEngine engines[] = {
+    {"scalar", crcScalar, alwaysSupported},
+#if CHECKSUM_X86
+    {"sse42", crcSse42, sse42Supported},
+    {"pclmul", crcPclmul, pclmulSupported},
+#endif
+#if CHECKSUM_ARM
+    {"armv8", crcArm, alwaysSupported},
+#endif
+};
+
+static const checksumEngine* active = NULL;  // Any thread may select it
+
+size_t checksumEngineCount(void) {
+  return sizeof(engines) / sizeof(engines[0]);
+}
+
+const checksumEngine* checksumEngineAt(size_t index) {
+  if (index >= checksumEngineCount()) {
+    return NULL;
+  }
+  return &engines[index];
+}
+
+void checksumAutoSelect(void) {
+  const checksumEngine* best = &engines[0];
+  for (size_t i = 1; i < checksumEngineCount(); i++) {
+    if (engines[i].supported()) {
+      best = &engines[i];
+    }
+  }
+  __atomic_store_n(&active, best, __ATOMIC_RELEASE);
+}
+
+const checksumEngine* checksumActive(void) {
+  if (__atomic_load_n(&active, __ATOMIC_ACQUIRE) == NULL) {
+    checksumAutoSelect();
+  }
+  return __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+}
+
+int checksumSelect(const char* name) {
+  for (size_t i = 0; i < checksumEngineCount(); i++) {
+    if (strcmp(engines[i].name, name) == 0) {
+      if (!engines[i].supported()) {
+        return -1;  // This CPU can't run it
+      }
+      __atomic_store_n(&active, &engines[i], __ATOMIC_RELEASE);
+      return 0;
+    }
+  }
+  return -1;  // Unknown engine
+}
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t len) {
+  return ~checksumActive()->update(~crc, (const uint8_t*)data, len);
+}
+
+// x^(8 * len) for len < 65536 as two table lookups: len = hi * 256 + lo
+static uint32_t shiftLo[256];  // x^(8 * lo)
+static uint32_t shiftHi[256];  // x^(8 * 256 * hi)
+static int shiftReady = 0;
+
+static void buildShiftTables(void) {
+  uint32_t oneByte = xPowModP(8);
+  uint32_t oneRow = xPowModP(8 * 256);
+  shiftLo[0] = shiftHi[0] = (uint32_t)1 << 31;  // x^0
+  for (int i = 1; i < 256; i++) {
+    shiftLo[i] = multModP(shiftLo[i - 1], oneByte);
+    shiftHi[i] = multModP(shiftHi[i - 1], oneRow);
+  }
+}
+
+uint32_t crc32c_shift(uint32_t crc, size_t len) {
+  if (len == 0) {
+    return crc;
+  }
+  if (len >= 65536) {
+    return multModP(xPowModP(8ull * len), crc);
+  }
+  buildOnce(&shiftReady, buildShiftTables);
+  crc = multModP(shiftLo[len & 0xFF], crc);
+  return len >> 8 ? multModP(shiftHi[len >> 8], crc) : crc;
+}
+
+// The raw CRC is linear, so for two messages of the same length
+// crc(A) ^ crc(B) = raw(A ^ B). A ^ B is zero outside the patched range, so
+// only the range is read and the difference is moved past the tail.
+uint32_t crc32c_patch(uint32_t crc, const void* oldData, const void* newData,
+                      size_t len, size_t tail) {
+  const checksumEngine* engine = checksumActive();
+  uint32_t diff = engine->update(0, (const uint8_t*)oldData, len) ^
+                  engine->update(0, (const uint8_t*)newData, len);
+  return crc ^ crc32c_shift(diff, tail);
+}
@@ -0,0 +1,37 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CRC32C (Castagnoli) checksum engine used for block integrity.
+// Several kernels compute the same CRC, the fastest one the CPU supports is
+// picked at runtime (CPUID on x86, compile-time on ARM).
+
+// Raw CRC register update (no pre/post inversion) over len bytes
+typedef uint32_t (*checksumFn)(uint32_t crc, const uint8_t* data, size_t len);
+
+typedef struct checksumEngine {
+  const char* name;        // Short name used by checksumSelect
+  checksumFn update;       // Kernel
+  int (*supported)(void);  // 1 if this CPU can run the kernel
+} checksumEngine;
+
+// Standard CRC32C of data, chainable: crc32c(crc32c(0, a), b) == crc32c(0, ab)
+uint32_t crc32c(uint32_t crc, const void* data, size_t len);
+
+// Raw CRC register after len more zero bytes (multiply by x^(8 * len))
+uint32_t crc32c_shift(uint32_t crc, size_t len);
+// CRC32C of a message after len bytes followed by tail more bytes are replaced
+// with newData, given its old CRC and the old bytes. Costs O(len), not O(size)
+uint32_t crc32c_patch(uint32_t crc, const void* oldData, const void* newData,
+                      size_t len, size_t tail);
+
+// Engine selection
+size_t checksumEngineCount(void);
+const checksumEngine* checksumEngineAt(size_t index);
+const checksumEngine* checksumActive(void);
+int checksumSelect(const char* name);  // 0 = Success, -1 = Unknown/unsupported
+void checksumAutoSelect(void);         // Fastest supported kernel
+
+#endif
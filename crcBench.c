@@ -0,0 +1,61 @@
+// crcBench.c
+// Throughput (GB/s) of every CRC32C kernel across payload sizes
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "checksum.h"
+
+#define MAX_SIZE (1024 * 1024)
+#define BYTES_PER_RUN (256ull * 1024 * 1024)  // Work per (kernel, size) pair
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main() {
+  static const size_t sizes[] = {16,   64,    256,   1024,  4096,
+                                 16384, 65536, 262144, MAX_SIZE};
+  size_t nsizes = sizeof(sizes) / sizeof(sizes[0]);
+  unsigned char* buf = malloc(MAX_SIZE);
+  if (!buf) return 1;
+  srand(123);
+  for (size_t i = 0; i < MAX_SIZE; i++) buf[i] = (unsigned char)rand();
+
+  // Every kernel must agree with the scalar one before it gets timed
+  checksumSelect("scalar");
+  uint32_t expected = crc32c(0, buf, MAX_SIZE - 3);
+
+  printf("%-8s", "kernel");
+  for (size_t s = 0; s < nsizes; s++) printf(" %9zu", sizes[s]);
+  printf("   (GB/s by payload bytes)\n");
+
+  for (size_t e = 0; e < checksumEngineCount(); e++) {
+    const checksumEngine* engine = checksumEngineAt(e);
+    if (!engine->supported()) {
+      printf("%-8s unsupported on this CPU\n", engine->name);
+      continue;
+    }
+    checksumSelect(engine->name);
+    if (crc32c(0, buf, MAX_SIZE - 3) != expected) {
+      printf("%-8s WRONG RESULT\n", engine->name);
+      continue;
+    }
+    printf("%-8s", engine->name);
+    for (size_t s = 0; s < nsizes; s++) {
+      size_t iters = BYTES_PER_RUN / sizes[s];
+      volatile uint32_t sink = 0;
+      long long t0 = ns_time();
+      for (size_t i = 0; i < iters; i++) {
+        sink ^= crc32c(sink, buf, sizes[s]);
+      }
+      long long t1 = ns_time();
+      printf(" %9.2f", (double)(iters * sizes[s]) / (double)(t1 - t0));
+    }
+    printf("\n");
+  }
+  free(buf);
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "ecc.h"
+
+// Per data byte, per value: XOR of the Hamming positions of its set bits in
+// the low 7 bits, their parity in bit 7. Built on first use
+static uint8_t eccTable[ECC_WORD - 1][256];
+static uint8_t eccBit[128];  // Hamming position -> data bit
+static int eccTableReady = 0;  // 0 = Not built, 1 = Being built, 2 = Ready
+
+// Threads in other arenas that need the tables meanwhile wait for the builder
+static void buildTables(void) {
+  int expected = 0;
+  if (!__atomic_compare_exchange_n(&eccTableReady, &expected, 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&eccTableReady, __ATOMIC_ACQUIRE) != 2) {
+    }
+    return;
+  }
+  uint8_t pos[8 * (ECC_WORD - 1)];
+  unsigned p = 3;
+  for (size_t k = 0; k < sizeof(pos); k++, p++) {
+    if ((p & (p - 1)) == 0) {  // Powers of two are the check bits
+      p++;
+    }
+    pos[k] = (uint8_t)p;
+    eccBit[p] = (uint8_t)k;
+  }
+  for (size_t i = 0; i < ECC_WORD - 1; i++) {
+    for (unsigned v = 0; v < 256; v++) {
+      uint8_t e = 0;
+      for (unsigned b = 0; b < 8; b++) {
+        if (v & (1u << b)) {
+          e ^= pos[i * 8 + b] | 0x80;
+        }
+      }
+      eccTable[i][v] = e;
+    }
+  }
+  __atomic_store_n(&eccTableReady, 2, __ATOMIC_RELEASE);
+}
+
+// XOR of the table entries of the data bytes: check bits and data parity
+static uint8_t eccSum(const uint8_t* word, size_t code_at) {
+  if (__atomic_load_n(&eccTableReady, __ATOMIC_ACQUIRE) != 2) {
+    buildTables();
+  }
+  uint8_t e = 0;
+  for (size_t i = 0; i < code_at; i++) {
+    e ^= eccTable[i][word[i]];
+  }
+  for (size_t i = code_at + 1; i < ECC_WORD; i++) {
+    e ^= eccTable[i - 1][word[i]];
+  }
+  return e;
+}
+
+uint8_t eccEncode(const uint8_t* word, size_t code_at) {
+  uint8_t e = eccSum(word, code_at);
+  uint8_t check = e & 0x7F;
+  uint8_t parity = (uint8_t)((e >> 7) ^ __builtin_parity(check));
+  return (uint8_t)(check | parity << 7);
+}
+
+int eccLocate(const uint8_t* word, size_t code_at) {
+  uint8_t code = word[code_at];
+  uint8_t e = eccSum(word, code_at) ^ code;
+  unsigned syndrome = e & 0x7F;
+  int odd = (e >> 7) ^ __builtin_parity(code & 0x7F);  // Overall parity
+  if (!odd) {
+    return syndrome == 0 ? ECC_CLEAN : ECC_DOUBLE;
+  }
+  if (syndrome == 0) {
+    return (int)(code_at * 8 + 7);  // The parity bit itself
+  }
+  if ((syndrome & (syndrome - 1)) == 0) {  // A check bit
+    return (int)(code_at * 8 + (size_t)__builtin_ctz(syndrome));
+  }
+  size_t k = eccBit[syndrome];
+  size_t byte = k / 8 < code_at ? k / 8 : k / 8 + 1;
+  return (int)(byte * 8 + k % 8);
+}
@@ -0,0 +1,24 @@
+#ifndef ECC_H
+#define ECC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SECDED (single error correcting, double error detecting) code for 16 byte
+// words such as the block header: an extended Hamming code over the 120 bits
+// of the other 15 bytes, stored in one byte of the word (code_at). Data bit k
+// sits at the k-th Hamming position that isn't a power of two, 7 check bits
+// hold the XOR of the positions of the set data bits and the eighth makes the
+// parity even. Encoding and locating are one table lookup per byte, so
+// keeping a header's code current costs about as much as 15 loads.
+#define ECC_WORD 16    // Bytes per codeword, the code included
+#define ECC_CLEAN -1   // eccLocate: no error
+#define ECC_DOUBLE -2  // eccLocate: two bits (or more) flipped, uncorrectable
+
+uint8_t eccEncode(const uint8_t* word, size_t code_at);
+// Bit of word (byte * 8 + bit, the code's own bits included) a single bit
+// error flipped, or ECC_CLEAN / ECC_DOUBLE. Three or more flipped bits can
+// look like one, callers confirm a correction with a checksum.
+int eccLocate(const uint8_t* word, size_t code_at);
+
+#endif
@@ -0,0 +1,291 @@
+// latencyBench.c
+// Latency of single mm_malloc/mm_free/mm_realloc/mm_read/mm_write calls over a
+// size sweep, next to the same scenario on the system malloc (reads and writes
+// are memcpy there). Every round allocates BATCH blocks of one size, writes and
+// reads each of them whole, grows each to twice its size and frees them in a
+// shuffled order, timing every call (TSC on x86, else clock_gettime).
+// Reports p50/p90/p99/p99.9/max in ns (timer overhead subtracted) and ops/s.
+// Usage: ./latency_bench [--rounds n] [--csv file] [--json file]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "allocator.h"
+
+#define HEAP_SIZE (32 * 1024 * 1024)
+#define BATCH 64     // Blocks live at once
+#define ROUNDS 200   // Default, samples per op and size = ROUNDS * BATCH
+#define MAX_SIZE 65536
+
+enum benchOp { OP_MALLOC, OP_FREE, OP_REALLOC, OP_READ, OP_WRITE, OPS };
+static const char* const opNames[OPS] = {"malloc", "free", "realloc", "read",
+                                         "write"};
+static const size_t sizes[] = {16, 64, 256, 1024, 4096, 16384, MAX_SIZE};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct benchAllocator {
+  const char* name;
+  void* (*malloc)(size_t size);
+  void (*free)(void* ptr);
+  void* (*realloc)(void* ptr, size_t size);
+  int (*read)(void* ptr, size_t offset, void* buf, size_t len);
+  int (*write)(void* ptr, size_t offset, const void* src, size_t len);
+} benchAllocator;
+
+typedef struct benchResult {
+  double p50, p90, p99, p999, max;  // ns
+  double ops_per_s;
+} benchResult;
+
+static int sysRead(void* ptr, size_t offset, void* buf, size_t len) {
+  memcpy(buf, (char*)ptr + offset, len);
+  return (int)len;
+}
+
+static int sysWrite(void* ptr, size_t offset, const void* src, size_t len) {
+  memcpy((char*)ptr + offset, src, len);
+  return (int)len;
+}
+
+static const benchAllocator allocators[] = {
+    {"mm", mm_malloc, mm_free, mm_realloc, mm_read, mm_write},
+    {"system", malloc, free, realloc, sysRead, sysWrite},
+};
+#define NALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return (uint64_t)ns_time();
+#endif
+}
+
+static double g_ns_per_tick = 1.0;
+static double g_overhead;  // Ticks of an empty timed region
+
+static void calibrate(void) {
+  long long t0 = ns_time();
+  uint64_t c0 = ticks();
+  while (ns_time() - t0 < 50000000) {  // 50 ms
+  }
+  g_ns_per_tick = (double)(ns_time() - t0) / (double)(ticks() - c0);
+  uint64_t best = UINT64_MAX;
+  for (int i = 0; i < 100000; i++) {
+    uint64_t start = ticks();
+    uint64_t elapsed = ticks() - start;
+    best = elapsed < best ? elapsed : best;
+  }
+  g_overhead = (double)best;
+}
+
+static int compareTicks(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t* sorted, size_t n, double q) {
+  double t = (double)sorted[(size_t)(q * (double)(n - 1))] - g_overhead;
+  return (t > 0 ? t : 0) * g_ns_per_tick;
+}
+
+static benchResult summarize(uint64_t* samples, size_t n) {
+  qsort(samples, n, sizeof(uint64_t), compareTicks);
+  double total = 0;
+  for (size_t i = 0; i < n; i++) {
+    total += (double)samples[i];
+  }
+  benchResult r;
+  r.p50 = percentile(samples, n, 0.50);
+  r.p90 = percentile(samples, n, 0.90);
+  r.p99 = percentile(samples, n, 0.99);
+  r.p999 = percentile(samples, n, 0.999);
+  r.max = percentile(samples, n, 1.0);
+  double ns = (total - g_overhead * (double)n) * g_ns_per_tick;
+  r.ops_per_s = ns > 0 ? (double)n / ns * 1e9 : 0;
+  return r;
+}
+
+// One size on one allocator, samples[op] gets rounds * BATCH entries
+static int runScenario(const benchAllocator* a, size_t size, size_t rounds,
+                       uint64_t* samples[OPS], const uint8_t* src,
+                       uint8_t* dst) {
+  void* blocks[BATCH];
+  size_t order[BATCH];
+  size_t n = 0;
+  for (size_t round = 0; round < rounds; round++, n += BATCH) {
+    for (size_t i = 0; i < BATCH; i++) {
+      uint64_t start = ticks();
+      blocks[i] = a->malloc(size);
+      samples[OP_MALLOC][n + i] = ticks() - start;
+      if (blocks[i] == NULL) {
+        return -1;
+      }
+    }
+    for (size_t i = 0; i < BATCH; i++) {
+      uint64_t start = ticks();
+      int written = a->write(blocks[i], 0, src, size);
+      samples[OP_WRITE][n + i] = ticks() - start;
+      if (written != (int)size) {
+        return -1;
+      }
+    }
+    for (size_t i = 0; i < BATCH; i++) {
+      uint64_t start = ticks();
+      int count = a->read(blocks[i], 0, dst, size);
+      samples[OP_READ][n + i] = ticks() - start;
+      if (count != (int)size) {
+        return -1;
+      }
+    }
+    for (size_t i = 0; i < BATCH; i++) {
+      uint64_t start = ticks();
+      void* grown = a->realloc(blocks[i], size * 2);
+      samples[OP_REALLOC][n + i] = ticks() - start;
+      if (grown == NULL) {
+        return -1;
+      }
+      blocks[i] = grown;
+    }
+    for (size_t i = 0; i < BATCH; i++) {
+      order[i] = i;
+    }
+    for (size_t i = BATCH - 1; i > 0; i--) {  // Shuffled frees
+      size_t j = (size_t)rand() % (i + 1);
+      size_t tmp = order[i];
+      order[i] = order[j];
+      order[j] = tmp;
+    }
+    for (size_t i = 0; i < BATCH; i++) {
+      uint64_t start = ticks();
+      a->free(blocks[order[i]]);
+      samples[OP_FREE][n + i] = ticks() - start;
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  size_t rounds = ROUNDS;
+  const char* csv_path = NULL;
+  const char* json_path = NULL;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--rounds") == 0) {
+      rounds = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      csv_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json_path = argv[i + 1];
+    }
+  }
+  if (rounds == 0) {
+    printf("Usage: %s [--rounds n] [--csv file] [--json file]\n", argv[0]);
+    return 1;
+  }
+  uint8_t* heap = malloc(HEAP_SIZE);
+  uint8_t* src = malloc(MAX_SIZE);
+  uint8_t* dst = malloc(MAX_SIZE);
+  uint64_t* samples[OPS];
+  for (int op = 0; op < OPS; op++) {
+    samples[op] = malloc(rounds * BATCH * sizeof(uint64_t));
+    if (samples[op] == NULL) return 1;
+  }
+  if (!heap || !src || !dst) return 1;
+  uint8_t pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+  for (size_t i = 0; i < HEAP_SIZE; i++) heap[i] = pattern[i % 5];
+  for (size_t i = 0; i < MAX_SIZE; i++) src[i] = (uint8_t)i;
+  calibrate();
+
+  static benchResult results[NALLOCATORS][NSIZES][OPS];
+  srand(123);
+  for (size_t a = 0; a < NALLOCATORS; a++) {
+    for (size_t s = 0; s < NSIZES; s++) {
+      if (a == 0) {
+        mm_init(heap, HEAP_SIZE);  // Same starting point for every size
+      }
+      if (runScenario(&allocators[a], sizes[s], rounds, samples, src, dst)) {
+        printf("%s failed at size %zu\n", allocators[a].name, sizes[s]);
+        return 1;
+      }
+      for (int op = 0; op < OPS; op++) {
+        results[a][s][op] = summarize(samples[op], rounds * BATCH);
+      }
+    }
+  }
+
+  printf("\n%zu samples per line, timer overhead %.1f ns subtracted\n",
+         rounds * BATCH, g_overhead * g_ns_per_tick);
+  printf("%-7s %-8s %6s %9s %9s %9s %9s %10s %12s\n", "alloc", "op", "size",
+         "p50", "p90", "p99", "p99.9", "max", "ops/s");
+  for (size_t a = 0; a < NALLOCATORS; a++) {
+    for (int op = 0; op < OPS; op++) {
+      for (size_t s = 0; s < NSIZES; s++) {
+        benchResult* r = &results[a][s][op];
+        printf("%-7s %-8s %6zu %9.0f %9.0f %9.0f %9.0f %10.0f %12.0f\n",
+               allocators[a].name, opNames[op], sizes[s], r->p50, r->p90,
+               r->p99, r->p999, r->max, r->ops_per_s);
+      }
+    }
+  }
+
+  FILE* csv = csv_path != NULL ? fopen(csv_path, "w") : NULL;
+  if (csv != NULL) {
+    fprintf(csv, "allocator,op,size,samples,p50_ns,p90_ns,p99_ns,p999_ns,"
+                 "max_ns,ops_per_s\n");
+  }
+  FILE* json = json_path != NULL ? fopen(json_path, "w") : NULL;
+  if (json != NULL) {
+    fprintf(json, "{\"timestamp\": %lld, \"samples\": %zu, \"results\": [",
+            (long long)time(NULL), rounds * BATCH);
+  }
+  int first = 1;
+  for (size_t a = 0; a < NALLOCATORS; a++) {
+    for (int op = 0; op < OPS; op++) {
+      for (size_t s = 0; s < NSIZES; s++) {
+        benchResult* r = &results[a][s][op];
+        if (csv != NULL) {
+          fprintf(csv, "%s,%s,%zu,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.0f\n",
+                  allocators[a].name, opNames[op], sizes[s], rounds * BATCH,
+                  r->p50, r->p90, r->p99, r->p999, r->max, r->ops_per_s);
+        }
+        if (json != NULL) {
+          fprintf(json,
+                  "%s\n  {\"allocator\": \"%s\", \"op\": \"%s\", "
+                  "\"size\": %zu, \"p50_ns\": %.1f, \"p90_ns\": %.1f, "
+                  "\"p99_ns\": %.1f, \"p999_ns\": %.1f, \"max_ns\": %.1f, "
+                  "\"ops_per_s\": %.0f}",
+                  first ? "" : ",", allocators[a].name, opNames[op],
+                  sizes[s], r->p50, r->p90, r->p99, r->p999, r->max,
+                  r->ops_per_s);
+          first = 0;
+        }
+      }
+    }
+  }
+  if (csv != NULL) {
+    fclose(csv);
+  }
+  if (json != NULL) {
+    fprintf(json, "\n]}\n");
+    fclose(json);
+  }
+  if ((csv_path != NULL && csv == NULL) ||
+      (json_path != NULL && json == NULL)) {
+    printf("Could not write the results\n");
+    return 1;
+  }
+  for (int op = 0; op < OPS; op++) {
+    free(samples[op]);
+  }
+  free(dst);
+  free(src);
+  free(heap);
+  return 0;
+}
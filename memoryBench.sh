@@ -1,7 +1,7 @@
 #!/bin/bash
 
 echo "[BUILDING]"
-gcc -O2 mm_bench.c allocator.c -o mm_bench
+gcc -O2 mm_bench.c allocator.c arena.c checksum.c ecc.c tlsf.c policy.c slab.c tcache.c trace.c stats.c telemetry.c profile.c record.c storm.c scrub.c quarantine.c wipe.c -o mm_bench -lm
 
 if [ ! -f mm_bench ]; then
     echo "Build failed."
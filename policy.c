@@ -0,0 +1,285 @@
+#include "policy.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+#include "tlsf.h"
+
+header* freeHeaderOf(freeBlock* fb) {
+  return (header*)((uint8_t*)fb - sizeof(header));  // Free blocks: padding 0
+}
+
+int blockFits(header* freeHdr, size_t request) {
+  g_arena->stats.search_visits++;
+  return freeHdr->size >= fitSize(freeHdr, request);
+}
+
+// List policies
+void listReset(void) {
+  g_arena->policy_list = NULL;
+  g_arena->policy_rover = NULL;
+}
+
+void listInsert(header* freeHdr) {  // LIFO, O(1)
+  insert_free(&g_arena->policy_list, (freeBlock*)payloadFinder(freeHdr));
+}
+
+void listInsertByAddress(header* freeHdr) {  // Keeps the list sorted, O(n)
+  freeBlock* fb = (freeBlock*)payloadFinder(freeHdr);
+  freeBlock* before = NULL;
+  freeBlock* curr = g_arena->policy_list;
+  while (curr != NULL && curr < fb && in_heap(curr)) {
+    before = curr;
+    curr = curr->next;
+  }
+  if (before == NULL) {
+    insert_free(&g_arena->policy_list, fb);
+    return;
+  }
+  insert_free(&before->next, fb);  // Insert as the head of before's tail
+  fb->prev = before;
+}
+
+void listRemove(header* freeHdr) {
+  freeBlock* fb = (freeBlock*)payloadFinder(freeHdr);
+  if (g_arena->policy_rover == fb) {
+    g_arena->policy_rover = fb->next;  // Keep roving from the block after it
+  }
+  freeBlock* orphan = NULL;  // Stand-in head for a block that isn't the head
+  remove_free(fb->prev == NULL && g_arena->policy_list != fb ? &orphan
+                                                      : &g_arena->policy_list,
+              fb);
+}
+
+header* listFirstFit(size_t request) {
+  for (freeBlock* curr = g_arena->policy_list; curr != NULL && in_heap(curr);
+       curr = curr->next) {
+    if (blockFits(freeHeaderOf(curr), request)) {
+      return freeHeaderOf(curr);
+    }
+  }
+  return NULL;
+}
+
+header* listNextFit(size_t request) {  // First fit, starting at the rover
+  freeBlock* start = g_arena->policy_rover != NULL ? g_arena->policy_rover
+                                                   : g_arena->policy_list;
+  for (int pass = 0; pass < 2; pass++) {
+    freeBlock* curr = pass == 0 ? start : g_arena->policy_list;
+    freeBlock* stop = pass == 0 ? NULL : start;
+    for (; curr != stop && curr != NULL && in_heap(curr); curr = curr->next) {
+      if (blockFits(freeHeaderOf(curr), request)) {
+        g_arena->policy_rover = curr->next;  // Resume after this block
+        return freeHeaderOf(curr);
+      }
+    }
+  }
+  return NULL;
+}
+
+void listForEach(freeVisitFn visit, void* ctx) {
+  freeBlock* curr = g_arena->policy_list;
+  while (curr != NULL && in_heap(curr)) {
+    freeBlock* next = curr->next;  // visit may unlink curr
+    visit(freeHeaderOf(curr), ctx);
+    curr = next;
+  }
+}
+
+size_t listLargest(void) {
+  size_t largest = 0;
+  for (freeBlock* curr = g_arena->policy_list; curr != NULL && in_heap(curr);
+       curr = curr->next) {
+    if (freeHeaderOf(curr)->size > largest) {
+      largest = freeHeaderOf(curr)->size;
+    }
+  }
+  return largest;
+}
+
+// Best-fit treap. Left (next) holds smaller keys, right (prev) bigger ones
+static uint32_t treePriority(freeBlock* fb) {  // Heap order, from the address
+  uint64_t x = (uint64_t)(uintptr_t)fb * 0x9E3779B97F4A7C15ull;
+  return (uint32_t)(x >> 32);
+}
+
+static int treeLess(size_t size, freeBlock* fb, freeBlock* node) {
+  size_t node_size = freeHeaderOf(node)->size;
+  return size < node_size || (size == node_size && fb < node);
+}
+
+void treeReset(void) { g_arena->policy_root = NULL; }
+
+static freeBlock* treeInsertAt(freeBlock* node, freeBlock* fb, size_t size) {
+  if (node == NULL) {
+    return fb;
+  }
+  if (treeLess(size, fb, node)) {
+    node->next = treeInsertAt(node->next, fb, size);
+    if (treePriority(node->next) > treePriority(node)) {  // Rotate right
+      freeBlock* left = node->next;
+      node->next = left->prev;
+      left->prev = node;
+      return left;
+    }
+  } else {
+    node->prev = treeInsertAt(node->prev, fb, size);
+    if (treePriority(node->prev) > treePriority(node)) {  // Rotate left
+      freeBlock* right = node->prev;
+      node->prev = right->next;
+      right->next = node;
+      return right;
+    }
+  }
+  return node;
+}
+
+void treeInsert(header* freeHdr) {
+  freeBlock* fb = (freeBlock*)payloadFinder(freeHdr);
+  fb->next = fb->prev = NULL;
+  g_arena->policy_root = treeInsertAt(g_arena->policy_root, fb, freeHdr->size);
+}
+
+// Link pointing at fb: found by key, or by a full search if fb's size (the
+// key) was corrupted after it was inserted. NULL if fb isn't in the tree.
+static freeBlock** treeLinkByPointer(freeBlock** link, freeBlock* fb) {
+  if (*link == NULL || in_heap(*link) == 0) {
+    return NULL;
+  }
+  if (*link == fb) {
+    return link;
+  }
+  freeBlock** found = treeLinkByPointer(&(*link)->next, fb);
+  return found != NULL ? found : treeLinkByPointer(&(*link)->prev, fb);
+}
+
+static freeBlock** treeLink(freeBlock* fb) {
+  size_t size = freeHeaderOf(fb)->size;
+  freeBlock** link = &g_arena->policy_root;
+  while (*link != NULL && *link != fb && in_heap(*link)) {
+    link = treeLess(size, fb, *link) ? &(*link)->next : &(*link)->prev;
+  }
+  return *link == fb ? link : treeLinkByPointer(&g_arena->policy_root, fb);
+}
+
+void treeRemove(header* freeHdr) {
+  freeBlock* fb = (freeBlock*)payloadFinder(freeHdr);
+  freeBlock** link = treeLink(fb);
+  if (link == NULL) {
+    return;  // Not in the tree
+  }
+  // Rotate fb down until it has at most one child, then splice it out
+  while (fb->next != NULL && fb->prev != NULL) {
+    if (treePriority(fb->next) > treePriority(fb->prev)) {
+      freeBlock* left = fb->next;
+      fb->next = left->prev;
+      left->prev = fb;
+      *link = left;
+      link = &left->prev;
+    } else {
+      freeBlock* right = fb->prev;
+      fb->prev = right->next;
+      right->next = fb;
+      *link = right;
+      link = &right->next;
+    }
+  }
+  *link = fb->next != NULL ? fb->next : fb->prev;
+  fb->next = fb->prev = NULL;
+}
+
+// Smallest node whose key is >= (size, after)
+static freeBlock* treeLowerBound(size_t size, freeBlock* after) {
+  freeBlock* best = NULL;
+  freeBlock* node = g_arena->policy_root;
+  while (node != NULL && in_heap(node)) {
+    if (treeLess(size, after, node) || node == after) {
+      best = node;
+      node = node->next;
+    } else {
+      node = node->prev;
+    }
+  }
+  return best;
+}
+
+header* treeBestFit(size_t request) {
+  // Blocks are visited from the smallest up, the first one that fits (with
+  // its own padding) is the best fit
+  size_t exact = sizeof(header) + request + digestBytes(request);
+  freeBlock* node = treeLowerBound(exact, NULL);
+  while (node != NULL) {
+    header* h = freeHeaderOf(node);
+    if (blockFits(h, request)) {
+      return h;
+    }
+    node = treeLowerBound(h->size, node + 1);  // In-order successor
+  }
+  return NULL;
+}
+
+void treeForEach(freeVisitFn visit, void* ctx) {
+  freeBlock* node = treeLowerBound(0, NULL);
+  while (node != NULL) {
+    size_t size = freeHeaderOf(node)->size;  // visit may remove node
+    visit(freeHeaderOf(node), ctx);
+    node = treeLowerBound(size, node + 1);
+  }
+}
+
+size_t treeLargest(void) {  // Rightmost node
+  freeBlock* node = g_arena->policy_root;
+  while (node != NULL && in_heap(node) && node->prev != NULL) {
+    node = node->prev;
+  }
+  return node != NULL && in_heap(node) ? freeHeaderOf(node)->size : 0;
+}
+
+// Default first
+static const placementPolicy policies[] = {
+    {"tlsf", tlsfReset, tlsfInsert, tlsfRemove, tlsfSearch, tlsfForEach,
+     tlsfLargest},
+    {"first-fit", listReset, listInsert, listRemove, listFirstFit,
+     listForEach, listLargest},
+    {"next-fit", listReset, listInsert, listRemove, listNextFit, listForEach,
+     listLargest},
+    {"address-first-fit", listReset, listInsertByAddress, listRemove,
+     listFirstFit, listForEach, listLargest},
+    {"best-fit-tree", treeReset, treeInsert, treeRemove, treeBestFit,
+     treeForEach, treeLargest},
+};
+
+static const placementPolicy* selected = NULL;  // For arenas set up next
+
+size_t policyCount(void) { return sizeof(policies) / sizeof(policies[0]); }
+
+const placementPolicy* policyAt(size_t index) {
+  if (index >= policyCount()) {
+    return NULL;
+  }
+  return &policies[index];
+}
+
+const placementPolicy* policySelected(void) {
+  if (selected == NULL && policySelect(MM_POLICY) != 0) {
+    selected = &policies[0];  // Unknown compile-time name, use the default
+  }
+  return selected;
+}
+
+// The current arena's policy, fixed when the arena was initialised
+const placementPolicy* policyActive(void) {
+  return g_arena->policy != NULL ? g_arena->policy : policySelected();
+}
+
+int policySelect(const char* name) {
+  for (size_t i = 0; i < policyCount(); i++) {
+    if (strcmp(policies[i].name, name) == 0) {
+      selected = &policies[i];
+      return 0;
+    }
+  }
+  return -1;  // Unknown policy
+}
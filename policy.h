@@ -0,0 +1,62 @@
+#ifndef POLICY_H
+#define POLICY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+
+// Placement policies: how free blocks are indexed and which one mm_malloc
+// gets. Every policy owns the freeBlock links (next/prev) of the blocks it
+// indexes. Pick one with policySelect (or -DMM_POLICY='"name"') before mm_init,
+// every arena keeps the policy that was selected when it was initialised.
+
+typedef void (*freeVisitFn)(header* freeHdr, void* ctx);
+
+typedef struct placementPolicy {
+  const char* name;                   // Short name used by policySelect
+  void (*reset)(void);                // Forget every block (mm_init)
+  void (*insert)(header* freeHdr);    // Index a new free block
+  void (*remove)(header* freeHdr);    // Unindex (also with a corrupted size)
+  header* (*find)(size_t request);    // Free block that fits a payload
+  void (*forEach)(freeVisitFn visit, void* ctx);  // visit may remove freeHdr
+  size_t (*largest)(void);            // Size of the biggest free block
+} placementPolicy;
+
+#ifndef MM_POLICY
+#define MM_POLICY "tlsf"  // Compile-time default
+#endif
+
+// Policy selection
+size_t policyCount(void);
+const placementPolicy* policyAt(size_t index);
+const placementPolicy* policySelected(void);  // Used by the next arena init
+const placementPolicy* policyActive(void);    // The current arena's
+int policySelect(const char* name);  // 0 = Success, -1 = Unknown
+
+// Helpers shared by the policies
+header* freeHeaderOf(freeBlock* fb);  // Header right before a free block's fb
+int blockFits(header* freeHdr, size_t request);
+
+// List policies (one insert_free/remove_free list, the arena's policy_list;
+// next-fit roves with policy_rover)
+void listReset(void);
+void listInsert(header* freeHdr);
+void listInsertByAddress(header* freeHdr);
+void listRemove(header* freeHdr);
+header* listFirstFit(size_t request);
+header* listNextFit(size_t request);
+void listForEach(freeVisitFn visit, void* ctx);
+size_t listLargest(void);
+
+// Best-fit tree: treap keyed on (size, address). The freeBlock's next/prev
+// links are the left/right children, priorities are hashed from the address.
+// The root is the arena's policy_root
+void treeReset(void);
+void treeInsert(header* freeHdr);
+void treeRemove(header* freeHdr);
+header* treeBestFit(size_t request);
+void treeForEach(freeVisitFn visit, void* ctx);
+size_t treeLargest(void);
+
+#endif
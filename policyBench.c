@@ -0,0 +1,133 @@
+// policyBench.c
+// Replays an allocation trace under every placement policy and reports speed
+// and fragmentation. Trace file lines: "a <id> <size>", "f <id>",
+// "r <id> <size>" (ids < MAX_IDS). Without a file a synthetic trace is used.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "allocator.h"
+#include "policy.h"
+
+#define HEAP_SIZE (8 * 1024 * 1024)
+#define MAX_OPS (1 << 20)
+#define MAX_IDS 65536
+#define SYNTH_OPS 200000
+#define MAX_POLICIES 16
+
+typedef struct replayOp {
+  char kind;  // 'a', 'f' or 'r'
+  uint32_t id;
+  size_t size;
+} replayOp;
+
+static replayOp ops[MAX_OPS];
+static void* live[MAX_IDS];
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static size_t loadTrace(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) return 0;
+  size_t n = 0;
+  char kind;
+  unsigned id;
+  while (n < MAX_OPS && fscanf(f, " %c %u", &kind, &id) == 2) {
+    size_t size = 0;
+    if ((kind == 'a' || kind == 'r') && fscanf(f, " %zu", &size) != 1) break;
+    if (id >= MAX_IDS) continue;
+    ops[n].kind = kind;
+    ops[n].id = id;
+    ops[n].size = size;
+    n++;
+  }
+  fclose(f);
+  return n;
+}
+
+// Mostly small objects with some big ones, random lifetimes
+static size_t synthTrace(void) {
+  srand(123);
+  static int used[4096];
+  for (size_t n = 0; n < SYNTH_OPS; n++) {
+    uint32_t id = (uint32_t)(rand() % 4096);
+    size_t size = rand() % 8 == 0 ? 256 + rand() % 4096 : 8 + rand() % 200;
+    ops[n].id = id;
+    ops[n].size = size;
+    if (!used[id]) {
+      ops[n].kind = 'a';
+    } else {
+      ops[n].kind = rand() % 4 == 0 ? 'r' : 'f';
+    }
+    used[id] = ops[n].kind != 'f';
+  }
+  return SYNTH_OPS;
+}
+
+typedef struct freeStats {
+  size_t bytes, largest, count;
+} freeStats;
+
+static void countFree(header* h, void* ctx) {
+  freeStats* s = (freeStats*)ctx;
+  s->bytes += h->size;
+  s->count++;
+  if (h->size > s->largest) s->largest = h->size;
+}
+
+int main(int argc, char** argv) {
+  size_t n = argc > 1 ? loadTrace(argv[1]) : synthTrace();
+  if (n == 0) {
+    printf("Could not read trace %s\n", argv[1]);
+    return 1;
+  }
+  uint8_t* heap = malloc(HEAP_SIZE);
+  if (!heap) return 1;
+  uint8_t pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+
+  size_t npolicies = policyCount();
+  if (npolicies > MAX_POLICIES) npolicies = MAX_POLICIES;
+  double nsPerOp[MAX_POLICIES], frag[MAX_POLICIES];
+  size_t failed[MAX_POLICIES], holes[MAX_POLICIES];
+  for (size_t p = 0; p < npolicies; p++) {
+    for (size_t i = 0; i < HEAP_SIZE; i++) heap[i] = pattern[i % 5];
+    for (size_t i = 0; i < MAX_IDS; i++) live[i] = NULL;
+    mm_init_policy(heap, HEAP_SIZE, policyAt(p)->name);
+    failed[p] = 0;
+    long long t0 = ns_time();
+    for (size_t i = 0; i < n; i++) {
+      void** slot = &live[ops[i].id];
+      if (ops[i].kind == 'a' && *slot == NULL) {
+        *slot = mm_malloc(ops[i].size);
+        failed[p] += *slot == NULL;
+      } else if (ops[i].kind == 'f' && *slot != NULL) {
+        mm_free(*slot);
+        *slot = NULL;
+      } else if (ops[i].kind == 'r') {
+        void* q = mm_realloc(*slot, ops[i].size);
+        failed[p] += q == NULL;
+        if (q != NULL) *slot = q;
+      }
+    }
+    long long t1 = ns_time();
+    nsPerOp[p] = (double)(t1 - t0) / (double)n;
+    // External fragmentation: share of free space not in the largest block
+    freeStats s = {0, 0, 0};
+    policyActive()->forEach(countFree, &s);
+    frag[p] = s.bytes ? 1.0 - (double)s.largest / (double)s.bytes : 0.0;
+    holes[p] = s.count;
+  }
+
+  printf("\n%-18s %10s %9s %8s %8s   (%zu ops)\n", "policy", "ns/op",
+         "frag %", "holes", "failed", n);
+  for (size_t p = 0; p < npolicies; p++) {
+    printf("%-18s %10.1f %9.2f %8zu %8zu\n", policyAt(p)->name, nsPerOp[p],
+           100.0 * frag[p], holes[p], failed[p]);
+  }
+  free(heap);
+  return 0;
+}
@@ -0,0 +1,346 @@
+#include "profile.h"
+
+#include <execinfo.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROFILE_FILTER 65536  // Counting filter over the sampled addresses
+#define PROFILE_TOMBSTONE ((const void*)1)  // Freed live entry, keeps probing
+
+typedef struct profileSite {  // One call stack
+  uint64_t hash;              // 0 = Unused slot
+  uint32_t depth;
+  void* frames[PROFILE_DEPTH];  // Innermost first
+  size_t alloc_count;           // Sampled allocations
+  size_t alloc_bytes;
+  size_t live_count;            // ... of which not freed yet
+  size_t live_bytes;
+} profileSite;
+
+typedef struct profileLive {  // Sampled block, until it's freed
+  const void* ptr;            // NULL = Unused, PROFILE_TOMBSTONE = Freed
+  mm_arena_t* arena;
+  size_t size;
+  uint32_t site;
+} profileLive;
+
+MM_TLS int64_t g_profile_countdown;
+size_t g_profile_live;
+
+static int g_profile_on;
+static size_t g_profile_rate;     // Mean bytes between samples
+static unsigned g_profile_epoch;  // Bumped by every start
+static int g_profile_busy;        // Lock of everything below
+static size_t g_profile_tombstones;
+static profileSite g_profile_sites[PROFILE_SITES];
+static profileLive g_profile_blocks[PROFILE_LIVE];
+static uint8_t g_profile_filter[PROFILE_FILTER];
+static MM_TLS unsigned g_profile_thread_epoch;
+static MM_TLS uint64_t g_profile_rng;
+
+static char g_profile_exit_path[256];
+static int g_profile_exit_format;
+
+static void profileLock(void) {
+  while (__atomic_exchange_n(&g_profile_busy, 1, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static void profileUnlock(void) {
+  __atomic_store_n(&g_profile_busy, 0, __ATOMIC_RELEASE);
+}
+
+static inline size_t profileSlot(const void* ptr, size_t slots) {
+  return ((uintptr_t)ptr * 0x9E3779B97F4A7C15ull >> 32) % slots;
+}
+
+// Bytes to the next sample: exponential with mean g_profile_rate
+static int64_t profileInterval(size_t rate) {
+  if (g_profile_rng == 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    g_profile_rng = ((uint64_t)(uintptr_t)&g_profile_rng ^
+                     (uint64_t)ts.tv_nsec * 0x9E3779B97F4A7C15ull) | 1;
+  }
+  g_profile_rng ^= g_profile_rng >> 12;  // xorshift64*
+  g_profile_rng ^= g_profile_rng << 25;
+  g_profile_rng ^= g_profile_rng >> 27;
+  uint64_t r = g_profile_rng * 0x2545F4914F6CDD1Dull;
+  double u = ((r >> 11) + 1) * (1.0 / 9007199254740992.0);  // (0, 1]
+  return (int64_t)(-log(u) * rate) + 1;
+}
+
+static uint32_t profileSiteFind(void* const* frames, int depth) {
+  uint64_t hash = 14695981039346656037ull;  // FNV-1a over the addresses
+  for (int i = 0; i < depth; i++) {
+    hash = (hash ^ (uintptr_t)frames[i]) * 1099511628211ull;
+  }
+  hash |= 1;
+  size_t slot = hash % PROFILE_SITES;
+  for (size_t i = 0; i < PROFILE_SITES; i++) {
+    profileSite* site = &g_profile_sites[slot];
+    if (site->hash == hash && site->depth == (uint32_t)depth &&
+        memcmp(site->frames, frames, depth * sizeof(void*)) == 0) {
+      return (uint32_t)slot;
+    }
+    if (site->hash == 0) {
+      site->hash = hash;
+      site->depth = (uint32_t)depth;
+      memcpy(site->frames, frames, depth * sizeof(void*));
+      return (uint32_t)slot;
+    }
+    slot = (slot + 1) % PROFILE_SITES;
+  }
+  return PROFILE_SITES;  // Full
+}
+
+static void profileLiveAdd(void* ptr, size_t size, uint32_t site) {
+  if (g_profile_live + g_profile_tombstones >= PROFILE_LIVE * 3 / 4) {
+    if (g_profile_live >= PROFILE_LIVE / 2) {
+      return;  // Too many, the sample only counts as an allocation
+    }
+    static profileLive old[PROFILE_LIVE];  // Rehash without the tombstones
+    memcpy(old, g_profile_blocks, sizeof(old));
+    memset(g_profile_blocks, 0, sizeof(g_profile_blocks));
+    for (size_t i = 0; i < PROFILE_LIVE; i++) {
+      if (old[i].ptr != NULL && old[i].ptr != PROFILE_TOMBSTONE) {
+        size_t slot = profileSlot(old[i].ptr, PROFILE_LIVE);
+        while (g_profile_blocks[slot].ptr != NULL) {
+          slot = (slot + 1) % PROFILE_LIVE;
+        }
+        g_profile_blocks[slot] = old[i];
+      }
+    }
+    g_profile_tombstones = 0;
+  }
+  size_t slot = profileSlot(ptr, PROFILE_LIVE);
+  while (g_profile_blocks[slot].ptr != NULL &&
+         g_profile_blocks[slot].ptr != PROFILE_TOMBSTONE) {
+    slot = (slot + 1) % PROFILE_LIVE;
+  }
+  g_profile_tombstones -= g_profile_blocks[slot].ptr == PROFILE_TOMBSTONE;
+  g_profile_blocks[slot] = (profileLive){ptr, g_arena, size, site};
+  g_profile_sites[site].live_count++;
+  g_profile_sites[site].live_bytes += size;
+  uint8_t* filter = &g_profile_filter[profileSlot(ptr, PROFILE_FILTER)];
+  if (*filter < UINT8_MAX) {
+    __atomic_store_n(filter, *filter + 1, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&g_profile_live, g_profile_live + 1, __ATOMIC_RELAXED);
+}
+
+static void profileLiveRemove(profileLive* block) {
+  profileSite* site = &g_profile_sites[block->site];
+  site->live_count--;
+  site->live_bytes -= block->size;
+  uint8_t* filter =
+      &g_profile_filter[profileSlot(block->ptr, PROFILE_FILTER)];
+  if (*filter < UINT8_MAX) {  // Saturated ones stay, false positives only
+    __atomic_store_n(filter, *filter - 1, __ATOMIC_RELAXED);
+  }
+  block->ptr = PROFILE_TOMBSTONE;
+  g_profile_tombstones++;
+  __atomic_store_n(&g_profile_live, g_profile_live - 1, __ATOMIC_RELAXED);
+}
+
+void profileSample(void* ptr, size_t size) {
+  if (!__atomic_load_n(&g_profile_on, __ATOMIC_RELAXED)) {
+    g_profile_countdown = PROFILE_RECHECK;
+    return;
+  }
+  size_t rate = __atomic_load_n(&g_profile_rate, __ATOMIC_RELAXED);
+  unsigned epoch = __atomic_load_n(&g_profile_epoch, __ATOMIC_ACQUIRE);
+  if (g_profile_thread_epoch != epoch) {  // Just started, not a real sample
+    g_profile_thread_epoch = epoch;
+    g_profile_countdown = profileInterval(rate);
+    return;
+  }
+  if (ptr == NULL) {
+    return;  // Failed, the next allocation takes the sample
+  }
+  g_profile_countdown = profileInterval(rate);
+  void* frames[PROFILE_DEPTH + 2];
+  int depth = backtrace(frames, PROFILE_DEPTH + 2) - 2;  // Minus ours
+  profileLock();
+  uint32_t site = profileSiteFind(frames + 2, depth > 0 ? depth : 0);
+  if (site != PROFILE_SITES) {  // Else the table is full, dropped
+    g_profile_sites[site].alloc_count++;
+    g_profile_sites[site].alloc_bytes += size;
+    profileLiveAdd(ptr, size, site);
+  }
+  profileUnlock();
+}
+
+void profileFree(const void* ptr) {
+  size_t slot = profileSlot(ptr, PROFILE_FILTER);
+  if (__atomic_load_n(&g_profile_filter[slot], __ATOMIC_RELAXED) == 0) {
+    return;  // Not sampled
+  }
+  profileLock();
+  slot = profileSlot(ptr, PROFILE_LIVE);
+  for (size_t i = 0; i < PROFILE_LIVE && g_profile_blocks[slot].ptr != NULL;
+       i++) {
+    if (g_profile_blocks[slot].ptr == ptr) {
+      profileLiveRemove(&g_profile_blocks[slot]);
+      break;
+    }
+    slot = (slot + 1) % PROFILE_LIVE;
+  }
+  profileUnlock();
+}
+
+void profileForget(mm_arena_t* arena) {
+  if (MM_PROFILE_LIVE() == 0) {
+    return;
+  }
+  profileLock();
+  for (size_t i = 0; i < PROFILE_LIVE; i++) {
+    const void* ptr = g_profile_blocks[i].ptr;
+    if (g_profile_blocks[i].arena == arena && ptr != NULL &&
+        ptr != PROFILE_TOMBSTONE) {
+      profileLiveRemove(&g_profile_blocks[i]);
+    }
+  }
+  profileUnlock();
+}
+
+int mm_profile_start(size_t sample_bytes) {
+  profileLock();
+  memset(g_profile_sites, 0, sizeof(g_profile_sites));
+  memset(g_profile_blocks, 0, sizeof(g_profile_blocks));
+  memset(g_profile_filter, 0, sizeof(g_profile_filter));
+  __atomic_store_n(&g_profile_live, 0, __ATOMIC_RELAXED);
+  g_profile_tombstones = 0;
+  __atomic_store_n(&g_profile_rate,
+                   sample_bytes != 0 ? sample_bytes : PROFILE_DEFAULT_RATE,
+                   __ATOMIC_RELAXED);
+  __atomic_fetch_add(&g_profile_epoch, 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&g_profile_on, 1, __ATOMIC_RELAXED);
+  profileUnlock();
+  g_profile_countdown = 0;  // This thread starts with its next malloc
+  return 0;  // Success
+}
+
+void mm_profile_stop(void) {
+  __atomic_store_n(&g_profile_on, 0, __ATOMIC_RELAXED);
+}
+
+// Scale from the sampled blocks of a site to all of them: a block of the
+// average size was sampled with probability 1 - exp(-size / rate)
+static double profileScale(size_t count, size_t bytes, size_t rate) {
+  if (count == 0 || rate == 0) {
+    return 1.0;
+  }
+  return 1.0 / (1.0 - exp(-((double)bytes / count) / rate));
+}
+
+// Function name out of a backtrace_symbols line, "file(name+0x1f) [0x...]"
+static void profileFrameName(const char* symbol, void* frame, char* out,
+                             size_t max) {
+  const char* start = strchr(symbol, '(');
+  size_t len = 0;
+  if (start != NULL) {
+    start++;
+    len = strcspn(start, "+)");
+  }
+  if (len == 0) {
+    snprintf(out, max, "%p", frame);
+  } else {
+    snprintf(out, max, "%.*s", (int)(len < max ? len : max - 1), start);
+  }
+}
+
+static void profileWriteFolded(FILE* f, size_t rate) {
+  for (size_t i = 0; i < PROFILE_SITES; i++) {
+    profileSite* site = &g_profile_sites[i];
+    if (site->hash == 0 || site->live_count == 0) {
+      continue;
+    }
+    char** symbols = backtrace_symbols(site->frames, (int)site->depth);
+    for (int j = (int)site->depth - 1; j >= 0; j--) {  // Outermost first
+      char name[128];
+      profileFrameName(symbols != NULL ? symbols[j] : "", site->frames[j],
+                       name, sizeof(name));
+      fprintf(f, "%s%s", name, j > 0 ? ";" : "");
+    }
+    fprintf(f, " %.0f\n",
+            site->live_bytes *
+                profileScale(site->live_count, site->live_bytes, rate));
+    free(symbols);
+  }
+}
+
+static void profileWritePprof(FILE* f, size_t rate) {
+  size_t totals[4] = {0, 0, 0, 0};
+  for (size_t i = 0; i < PROFILE_SITES; i++) {
+    profileSite* site = &g_profile_sites[i];
+    totals[0] += site->live_count;
+    totals[1] += site->live_bytes;
+    totals[2] += site->alloc_count;
+    totals[3] += site->alloc_bytes;
+  }
+  // Sampled counts, pprof scales them with the rate itself
+  fprintf(f, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", totals[0],
+          totals[1], totals[2], totals[3], rate);
+  for (size_t i = 0; i < PROFILE_SITES; i++) {
+    profileSite* site = &g_profile_sites[i];
+    if (site->hash == 0) {
+      continue;
+    }
+    fprintf(f, "%zu: %zu [%zu: %zu] @", site->live_count, site->live_bytes,
+            site->alloc_count, site->alloc_bytes);
+    for (uint32_t j = 0; j < site->depth; j++) {
+      fprintf(f, " 0x%llx", (unsigned long long)(uintptr_t)site->frames[j]);
+    }
+    fprintf(f, "\n");
+  }
+  fprintf(f, "\nMAPPED_LIBRARIES:\n");  // For pprof to symbolize
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps != NULL) {
+    char line[512];
+    while (fgets(line, sizeof(line), maps) != NULL) {
+      fputs(line, f);
+    }
+    fclose(maps);
+  }
+}
+
+int mm_profile_dump(const char* path, int format) {
+  if (format != MM_PROFILE_PPROF && format != MM_PROFILE_FOLDED) {
+    return -1;  // Failure
+  }
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {
+    return -1;  // Failure
+  }
+  profileLock();
+  size_t rate = g_profile_rate;
+  if (format == MM_PROFILE_PPROF) {
+    profileWritePprof(f, rate);
+  } else {
+    profileWriteFolded(f, rate);
+  }
+  profileUnlock();
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+static void profileExitDump(void) {
+  if (g_profile_exit_path[0] != '\0') {
+    mm_profile_dump(g_profile_exit_path, g_profile_exit_format);
+  }
+}
+
+int mm_profile_dump_at_exit(const char* path, int format) {
+  static int registered;
+  if (path == NULL || strlen(path) >= sizeof(g_profile_exit_path) ||
+      (!registered && atexit(profileExitDump) != 0)) {
+    return -1;  // Failure
+  }
+  registered = 1;
+  snprintf(g_profile_exit_path, sizeof(g_profile_exit_path), "%s", path);
+  g_profile_exit_format = format;
+  return 0;  // Success
+}
@@ -0,0 +1,66 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Sampling heap profiler, opt-in at run time (mm_profile_start). About one in
+// every sample_bytes bytes mm_malloc hands out takes a backtrace of its call
+// site: the gaps between samples are exponentially distributed with that mean,
+// as in tcmalloc, so a block of size s is sampled with probability
+// 1 - exp(-s / sample_bytes) and dumps can scale the samples back up. Per site
+// the profiler keeps the sampled allocations and the sampled blocks still
+// live; mm_profile_dump writes them as a pprof heap profile or as folded
+// stacks (flamegraph.pl). Each thread counts down the bytes to its next
+// sample, so malloc pays a decrement, and free a load of the live sample
+// count (then a filter byte while any sampled block is live). While profiling
+// is off a thread rechecks every PROFILE_RECHECK bytes, so a start reaches
+// threads that are already running within that many bytes.
+// Symbol names in folded stacks need the executable linked with -rdynamic.
+#define PROFILE_DEFAULT_RATE (512 * 1024)  // sample_bytes of 0
+#define PROFILE_RECHECK (16 * 1024 * 1024)
+#define PROFILE_DEPTH 24    // Frames kept per sample
+#define PROFILE_SITES 1024  // Distinct call stacks, later ones are dropped
+#define PROFILE_LIVE 8192   // Sampled blocks tracked until they're freed
+
+enum profileFormat {
+  MM_PROFILE_PPROF,   // Legacy heap profile, heap_v2: pprof <binary> <file>
+  MM_PROFILE_FOLDED,  // "main;work;mm_malloc <live bytes>", estimated
+};
+
+extern MM_TLS int64_t g_profile_countdown;  // Bytes to the next sample
+extern size_t g_profile_live;               // Sampled blocks not yet freed
+
+void profileSample(void* ptr, size_t size);  // Countdown ran out
+void profileFree(const void* ptr);
+void profileForget(mm_arena_t* arena);  // Its blocks are gone (arenaInit)
+
+#ifdef MM_THREADS
+#define MM_PROFILE_LIVE() __atomic_load_n(&g_profile_live, __ATOMIC_RELAXED)
+#else
+#define MM_PROFILE_LIVE() g_profile_live
+#endif
+#define MM_PROFILE_MALLOC(ptr, size)                    \
+  do {                                                  \
+    if ((g_profile_countdown -= (int64_t)(size)) < 0) { \
+      profileSample(ptr, size);                         \
+    }                                                   \
+  } while (0)
+#define MM_PROFILE_FREE(ptr) \
+  do {                       \
+    if (MM_PROFILE_LIVE()) { \
+      profileFree(ptr);      \
+    }                        \
+  } while (0)
+
+// Starts sampling about every sample_bytes (0 = PROFILE_DEFAULT_RATE) and
+// forgets the previous profile. 0 = Success
+int mm_profile_start(size_t sample_bytes);
+void mm_profile_stop(void);  // Stops sampling, the profile can still be dumped
+int mm_profile_dump(const char* path, int format);  // 0 = Success
+// Dumps once more when the process exits (last call wins). 0 = Success
+int mm_profile_dump_at_exit(const char* path, int format);
+
+#endif
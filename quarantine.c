@@ -0,0 +1,195 @@
+#include "quarantine.h"
+
+#include <string.h>
+
+#include "arena.h"
+#include "policy.h"
+#include "stats.h"
+#include "tcache.h"
+
+void quarantineReset(void) {
+  memset(&g_arena->quarantine, 0, sizeof(g_arena->quarantine));
+}
+
+void quarantineAdd(header* h, size_t counted) {
+  quarantineRegistry* q = &g_arena->quarantine;
+  if (q->count == QUARANTINE_MAX) {
+    q->untracked++;
+    return;
+  }
+  uint8_t* heap_end = g_arena->heap + g_arena->heap_size;
+  quarantineRegion* r = &q->regions[q->count++];
+  r->hdr = (size_t)((uint8_t*)h - g_arena->heap);
+  r->counted = counted;
+  r->start = r->hdr;  // Unknown bounds: only the header must be in the run
+  r->end = 0;
+  int plausible =
+      h->status == 0
+          ? h->size >= MIN_FREE_BLOCK &&
+                h->size <= (size_t)(heap_end - (uint8_t*)h)
+          : h->status == 1 && h->padding < ALIGN && h->padding <= r->hdr &&
+                h->size <= g_arena->heap_size && blockEndFinder(h) <= heap_end;
+  if (plausible && checkSumCalc(h) == h->checksum) {  // Header is intact
+    r->start = r->hdr - h->padding;
+    r->end = h->status == 0 ? r->hdr + h->size
+                            : (size_t)(blockEndFinder(h) - g_arena->heap);
+  }
+  uint8_t* payload = payloadFinder(h);
+  r->slab = h->status == 1 && slabFind(payload) == (slab*)payload;
+}
+
+// The block at p if it verifies: plausible bounds (blockAt), not
+// quarantined, and a header that passes its checksum (a flipped bit is
+// corrected first) with a matching footer for free blocks
+static header* healthyAt(uint8_t* p, uint8_t** end) {
+  int is_free;
+  header* h = blockAt(p, end, &is_free);
+  if (h == NULL && (headerRepair((header*)p) == 0 ||
+                    headerRepair((header*)(p + paddingCalc((header*)p))) ==
+                        0)) {
+    h = blockAt(p, end, &is_free);
+  }
+  if (h == NULL || h->status == 2) {
+    return NULL;
+  }
+  if (is_free) {
+    return freeTagsMatch(h, footerFinder(h)) ? h : NULL;
+  }
+  return checkSumCalc(h) == h->checksum || headerRepair(h) == 0 ? h : NULL;
+}
+
+typedef struct indexProbe {  // Whether an indexed free block is in a run
+  uint8_t* start;
+  uint8_t* end;
+  int found;
+} indexProbe;
+
+static void probeIndex(header* freeHdr, void* ctx) {
+  indexProbe* probe = (indexProbe*)ctx;
+  probe->found |=
+      (uint8_t*)freeHdr >= probe->start && (uint8_t*)freeHdr < probe->end;
+}
+
+// Whether the damaged run [a, b) can go back to the free pool
+static int reclaimable(uint8_t* a, uint8_t* b) {
+  quarantineRegistry* q = &g_arena->quarantine;
+  size_t from = (size_t)(a - g_arena->heap);
+  size_t to = (size_t)(b - g_arena->heap);
+  int registered = 0;
+  for (size_t i = 0; i < q->count; i++) {
+    quarantineRegion* r = &q->regions[i];
+    if (r->hdr < from || r->hdr >= to) {
+      continue;
+    }
+    if (r->start < from || r->end > to) {
+      return 0;  // A block the run should hold verifies, bounds disagree
+    }
+#ifdef MM_THREADS
+    if (r->slab) {
+      return 0;
+    }
+#endif
+    registered = 1;
+  }
+  if (!registered) {
+    return 0;  // Damage nobody quarantined yet
+  }
+  for (size_t i = 0; g_arena->lease_count > 0 && i < MAX_LEASES; i++) {
+    uint8_t* leased = (uint8_t*)g_arena->leases[i].hdr;
+    if (leased >= a && leased < b) {
+      return 0;
+    }
+  }
+  indexProbe probe = {a, b, 0};  // A quarantined free block left linked
+  policyActive()->forEach(probeIndex, &probe);
+  return !probe.found;
+}
+
+// Turns the damaged run [a, b) into a free block, merged with free
+// neighbours, and drops its regions from the registry. Returns b - a, the
+// end of the new free block in *resume
+static size_t reclaimRun(uint8_t* a, uint8_t* b, uint8_t** resume) {
+  header* prev = prevFreeNeighbour(a);
+  header* next = nextFreeNeighbour(b);
+  size_t size = (size_t)(b - a) + (prev != NULL ? prev->size : 0) +
+                (next != NULL ? next->size : 0);
+  if (size < MIN_FREE_BLOCK) {
+    return 0;  // Too small on its own, stays quarantined
+  }
+  if (next != NULL) {
+    claimFreeBlock(next);
+  }
+  if (prev != NULL) {
+    claimFreeBlock(prev);
+  }
+  uint8_t* start = prev != NULL ? (uint8_t*)prev : a;
+  // Everything in the run is suspect, wipe all of it (as in arenaFree, the
+  // neighbours' tags that end up inside the new block too)
+  wipeFreeBody(start, size, a - (prev != NULL ? sizeof(footer) : 0),
+               b + (next != NULL ? sizeof(header) + sizeof(freeBlock) : 0));
+  createFreeBlock(start, size);
+  *resume = start + size;
+
+  quarantineRegistry* q = &g_arena->quarantine;
+  arenaStats* st = &g_arena->stats;
+  size_t from = (size_t)(a - g_arena->heap);
+  size_t to = (size_t)(b - g_arena->heap);
+  size_t keep = 0;
+  for (size_t i = 0; i < q->count; i++) {
+    quarantineRegion* r = &q->regions[i];
+    if (r->hdr >= from && r->hdr < to) {
+      st->quarantined_blocks -= st->quarantined_blocks > 0;
+      st->quarantined_bytes -= r->counted < st->quarantined_bytes
+                                   ? r->counted
+                                   : st->quarantined_bytes;
+      st->recovered_blocks++;
+    } else {
+      q->regions[keep++] = *r;
+    }
+  }
+  q->count = keep;
+  st->recovered_bytes += (size_t)(b - a);
+  return (size_t)(b - a);
+}
+
+// Walks g_arena's heap and reclaims every damaged run the registry accounts
+// for. Returns the bytes recovered
+static size_t arenaReclaim(void) {
+  MM_LOCKED();
+  if (g_arena->heap == NULL || g_arena->quarantine.count == 0) {
+    return 0;
+  }
+#ifdef MM_THREADS
+  remoteDrain();  // Queued frees land before the walk
+#endif
+  uint8_t* heap_end = g_arena->heap + g_arena->heap_size;
+  uint8_t* p = g_arena->heap;  // Always a block boundary
+  size_t recovered = 0;
+  while (p < heap_end) {
+    uint8_t* end;
+    if (healthyAt(p, &end) != NULL) {
+      p = end;
+      continue;
+    }
+    uint8_t* b = p + 1;  // Next block that verifies, or the heap end
+    while (b < heap_end && healthyAt(b, &end) == NULL) {
+      b++;
+    }
+    uint8_t* resume = b;
+    if (reclaimable(p, b)) {
+      recovered += reclaimRun(p, b, &resume);
+    }
+    p = resume;
+  }
+  return recovered;
+}
+
+size_t mm_reclaim(void) {
+  size_t recovered = 0;
+  for (size_t i = 0; i < g_arena_count; i++) {
+    mm_arena_t* prev = arenaEnter(&g_arenas[i]);
+    recovered += arenaReclaim();
+    arenaEnter(prev);
+  }
+  return recovered;
+}
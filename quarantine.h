@@ -0,0 +1,47 @@
+#ifndef QUARANTINE_H
+#define QUARANTINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+
+// Quarantine registry: quaranBlock records every block it takes out of
+// circulation with where its header is and the bounds the header gave
+// before the status changed, so getting the space back doesn't depend on
+// that header anymore. mm_reclaim re-derives the bounds from the healthy
+// blocks around it: walking the heap, a damaged run goes from the end of
+// the last block that verifies to the start of the next one (found byte by
+// byte, like the patrol's resync). A run is re-patterned and returned to
+// the free pool, merged with its free neighbours, if a registered header
+// lies in it, the recorded bounds fit inside it, no lease is held in it and
+// no free block index entry still points into it. Pointers into a
+// reclaimed block stay invalid (every call on them already failed), the
+// space may be handed out again. With MM_THREADS slab regions are kept:
+// thread caches and remote frees can still hold their slots.
+#define QUARANTINE_MAX 128  // Regions per arena, more stay quarantined
+
+typedef struct quarantineRegion {
+  size_t hdr;      // Heap offset of the header
+  size_t start;    // Bounds when it was quarantined (heap offsets),
+  size_t end;      // end = 0 if the header's size was already implausible
+  size_t counted;  // What statsQuarantine added to quarantined_bytes
+  int slab;        // Held a slab
+} quarantineRegion;
+
+typedef struct quarantineRegistry {  // Per arena (arena.h)
+  quarantineRegion regions[QUARANTINE_MAX];
+  size_t count;
+  size_t untracked;  // Quarantined while the registry was full
+} quarantineRegistry;
+
+void quarantineReset(void);  // arenaInit
+// quaranBlock, before the status becomes 2. counted = bytes statsQuarantine
+// added for it
+void quarantineAdd(header* h, size_t counted);
+
+// Returns quarantined space to the free pool in the arenas mm_malloc uses.
+// Returns the bytes recovered
+size_t mm_reclaim(void);
+
+#endif
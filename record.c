@@ -0,0 +1,213 @@
+#include "record.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arena.h"
+
+#ifdef MM_THREADS
+#include <pthread.h>
+static pthread_mutex_t g_record_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+#define RECORD_TOMBSTONE UINT32_MAX  // Freed object, keeps probing
+#define RECORD_MIN_SLOTS 4096
+
+typedef struct recordSlot {  // Address -> object id
+  const void* ptr;
+  uint32_t id;               // 0 = Unused
+} recordSlot;
+
+int g_record;
+static FILE* g_record_file;
+static recordSlot* g_record_slots;  // System malloc, not the heap's
+static size_t g_record_capacity;
+static size_t g_record_used;        // Live objects and tombstones
+static size_t g_record_live;
+static uint32_t g_record_next_id;
+static uint64_t g_record_last_ns;
+static uint16_t g_record_threads;
+static MM_TLS uint16_t g_record_thread;
+
+static uint64_t recordNow(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static inline size_t recordSlotOf(const void* ptr) {
+  return ((uintptr_t)ptr * 0x9E3779B97F4A7C15ull >> 32) % g_record_capacity;
+}
+
+static recordSlot* recordFind(const void* ptr) {
+  size_t slot = recordSlotOf(ptr);
+  while (g_record_slots[slot].id != 0) {
+    if (g_record_slots[slot].ptr == ptr &&
+        g_record_slots[slot].id != RECORD_TOMBSTONE) {
+      return &g_record_slots[slot];
+    }
+    slot = (slot + 1) % g_record_capacity;
+  }
+  return NULL;
+}
+
+// Rehash into capacity slots (drops the tombstones). 0 = Success
+static int recordResize(size_t capacity) {
+  recordSlot* old = g_record_slots;
+  size_t old_capacity = g_record_capacity;
+  g_record_slots = (recordSlot*)calloc(capacity, sizeof(recordSlot));
+  if (g_record_slots == NULL) {
+    g_record_slots = old;
+    return -1;  // Failure
+  }
+  g_record_capacity = capacity;
+  g_record_used = 0;
+  for (size_t i = 0; i < old_capacity; i++) {
+    if (old[i].id != 0 && old[i].id != RECORD_TOMBSTONE) {
+      size_t slot = recordSlotOf(old[i].ptr);
+      while (g_record_slots[slot].id != 0) {
+        slot = (slot + 1) % g_record_capacity;
+      }
+      g_record_slots[slot] = old[i];
+      g_record_used++;
+    }
+  }
+  free(old);
+  return 0;  // Success
+}
+
+static uint32_t recordAdd(const void* ptr, uint32_t id) {
+  if (g_record_used + 1 > g_record_capacity * 3 / 4 &&
+      recordResize(g_record_live * 2 > g_record_capacity / 2
+                       ? g_record_capacity * 2
+                       : g_record_capacity) != 0) {
+    return 0;  // Out of memory, the object stays anonymous
+  }
+  size_t slot = recordSlotOf(ptr);
+  while (g_record_slots[slot].id != 0 &&
+         g_record_slots[slot].id != RECORD_TOMBSTONE) {
+    slot = (slot + 1) % g_record_capacity;
+  }
+  g_record_used += g_record_slots[slot].id == 0;
+  g_record_live++;
+  g_record_slots[slot] = (recordSlot){ptr, id};
+  return id;
+}
+
+static uint32_t recordRemove(const void* ptr) {
+  recordSlot* slot = ptr != NULL ? recordFind(ptr) : NULL;
+  if (slot == NULL) {
+    return 0;
+  }
+  uint32_t id = slot->id;
+  slot->id = RECORD_TOMBSTONE;
+  g_record_live--;
+  return id;
+}
+
+// Called with the record lock held, after the call: ptr is the argument,
+// result what malloc/realloc returned
+void recordCall(int op, const void* ptr, const void* result, size_t size,
+                size_t offset, int failed) {
+  replayRecord r;
+  r.id = 0;
+  if (op == RECORD_MALLOC) {
+    r.id = result != NULL ? recordAdd(result, ++g_record_next_id) : 0;
+  } else if (op == RECORD_FREE) {
+    r.id = recordRemove(ptr);
+  } else if (op == RECORD_REALLOC) {
+    if (ptr == NULL) {
+      r.id = result != NULL ? recordAdd(result, ++g_record_next_id) : 0;
+    } else if (result != NULL || size == 0) {  // Moved, resized or freed
+      r.id = recordRemove(ptr);
+      if (result != NULL && r.id != 0) {
+        recordAdd(result, r.id);
+      }
+    } else {
+      recordSlot* slot = recordFind(ptr);
+      r.id = slot != NULL ? slot->id : 0;
+    }
+  } else if (ptr != NULL) {
+    recordSlot* slot = recordFind(ptr);
+    r.id = slot != NULL ? slot->id : 0;
+  }
+  if (g_record_thread == 0) {
+    g_record_thread = ++g_record_threads;
+  }
+  uint64_t now = recordNow(CLOCK_MONOTONIC);
+  uint64_t delta = now - g_record_last_ns;
+  g_record_last_ns = now;
+  r.delta_ns = delta > UINT32_MAX ? UINT32_MAX : (uint32_t)delta;
+  r.size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+  r.offset = offset > UINT32_MAX ? UINT32_MAX : (uint32_t)offset;
+  r.op = (uint8_t)op;
+  r.failed = (uint8_t)(failed != 0);
+  r.thread = g_record_thread;
+  fwrite(&r, sizeof(r), 1, g_record_file);
+}
+
+int recordLock(void) {
+  if (!MM_RECORD_ON()) {
+    return 0;
+  }
+#ifdef MM_THREADS
+  pthread_mutex_lock(&g_record_lock);
+  if (!g_record) {  // Stopped meanwhile
+    pthread_mutex_unlock(&g_record_lock);
+    return 0;
+  }
+#endif
+  return 1;
+}
+
+void recordUnlockAt(int* locked) {
+#ifdef MM_THREADS
+  if (*locked) {
+    pthread_mutex_unlock(&g_record_lock);
+  }
+#else
+  (void)locked;
+#endif
+}
+
+int mm_record_start(const char* path) {
+  if (MM_RECORD_ON() || path == NULL) {
+    return -1;  // Failure
+  }
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) {
+    return -1;  // Failure
+  }
+  setvbuf(f, NULL, _IOFBF, 1 << 20);
+  uint32_t header[4] = {RECORD_MAGIC, RECORD_VERSION, sizeof(replayRecord), 0};
+  uint64_t start = recordNow(CLOCK_REALTIME);
+  g_record_capacity = 0;
+  g_record_slots = NULL;
+  g_record_live = 0;
+  if (fwrite(header, sizeof(header), 1, f) != 1 ||
+      fwrite(&start, sizeof(start), 1, f) != 1 ||
+      recordResize(RECORD_MIN_SLOTS) != 0) {
+    fclose(f);
+    return -1;  // Failure
+  }
+  g_record_file = f;
+  g_record_next_id = 0;
+  g_record_last_ns = recordNow(CLOCK_MONOTONIC);
+  __atomic_store_n(&g_record, 1, __ATOMIC_RELEASE);
+  return 0;  // Success
+}
+
+int mm_record_stop(void) {
+  int locked = recordLock();
+  if (!locked) {
+    return -1;  // Failure, not recording
+  }
+  __atomic_store_n(&g_record, 0, __ATOMIC_RELAXED);
+  int result = fclose(g_record_file) == 0 ? 0 : -1;
+  g_record_file = NULL;
+  free(g_record_slots);
+  g_record_slots = NULL;
+  recordUnlockAt(&locked);
+  return result;
+}
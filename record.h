@@ -0,0 +1,64 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Allocation trace recorder, opt-in at run time (mm_record_start). Every
+// mm_malloc/mm_free/mm_realloc/mm_read/mm_write call is appended to a binary
+// trace that mm_replay (replayTrace.c) runs against a fresh heap. Blocks are
+// named by object ids instead of addresses, numbered in allocation order, so
+// a replay doesn't depend on where the recorded heap was. Calls from all
+// threads go through one lock and are replayed in that order. The mm_arena_*
+// calls on handles aren't recorded.
+// File: header {magic, version, record size, 0, start time in ns since the
+// epoch}, then one replayRecord per call.
+#define RECORD_MAGIC 0x50524D4Du  // "MMRP"
+#define RECORD_VERSION 1
+
+enum recordOp {
+  RECORD_MALLOC,   // id = the new object (0 if it failed)
+  RECORD_FREE,
+  RECORD_REALLOC,  // id = the object, a new one if ptr was NULL
+  RECORD_READ,
+  RECORD_WRITE,
+};
+
+typedef struct replayRecord {  // 20 bytes
+  uint32_t delta_ns;  // Since the previous record, saturated
+  uint32_t id;        // Object, 0 = none (NULL or a block from before)
+  uint32_t size;      // malloc/realloc size, read/write length
+  uint32_t offset;    // read/write offset
+  uint8_t op;         // recordOp
+  uint8_t failed;     // The call failed (NULL, -1)
+  uint16_t thread;    // Order of the thread's first recorded call
+} replayRecord;
+
+extern int g_record;  // 1 while recording
+
+void recordCall(int op, const void* ptr, const void* result, size_t size,
+                size_t offset, int failed);
+int recordLock(void);  // 1 = Recording, the lock is held
+void recordUnlockAt(int* locked);  // Cleanup handler for MM_RECORDING
+
+#ifdef MM_THREADS
+#define MM_RECORD_ON() __atomic_load_n(&g_record, __ATOMIC_RELAXED)
+#else
+#define MM_RECORD_ON() g_record
+#endif
+// Holds the record lock (if recording) until the end of the enclosing block,
+// so the call and its record aren't interleaved with other threads' calls
+#define MM_RECORDING() \
+  int mm_recording __attribute__((cleanup(recordUnlockAt))) = recordLock()
+#define MM_RECORD(op, ptr, result, size, offset, failed) \
+  do {                                                   \
+    if (mm_recording) {                                  \
+      recordCall(op, ptr, result, size, offset, failed); \
+    }                                                    \
+  } while (0)
+
+// Starts appending every mm_* call to a new trace at path. 0 = Success
+int mm_record_start(const char* path);
+int mm_record_stop(void);  // Flushes and closes the trace. 0 = Success
+
+#endif
@@ -0,0 +1,185 @@
+// replayTrace.c
+// Replays an allocation trace (record.h, mm_record_start) on a fresh heap:
+// every recorded mm_malloc/mm_free/mm_realloc/mm_read/mm_write in order, on
+// one thread. Reports throughput, peak footprint, failed allocations and a
+// fragmentation timeline (mm_heap_stats every --every calls).
+// Usage: ./mm_replay <trace> [--heap bytes] [--policy name] [--every calls]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "allocator.h"
+#include "record.h"
+
+#define HEAP_SIZE (64 * 1024 * 1024)
+#define TIMELINE_ROWS 20  // Default --every: the trace in this many steps
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static replayRecord* loadTrace(const char* path, size_t* count) {
+  FILE* f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  uint32_t header[4];
+  uint64_t start;
+  replayRecord* records = NULL;
+  if (fread(header, sizeof(header), 1, f) == 1 &&
+      fread(&start, sizeof(start), 1, f) == 1 && header[0] == RECORD_MAGIC &&
+      header[1] == RECORD_VERSION && header[2] == sizeof(replayRecord)) {
+    long begin = ftell(f);
+    fseek(f, 0, SEEK_END);
+    *count = (size_t)(ftell(f) - begin) / sizeof(replayRecord);
+    fseek(f, begin, SEEK_SET);
+    records = malloc(*count * sizeof(replayRecord) + 1);
+    if (records != NULL &&
+        fread(records, sizeof(replayRecord), *count, f) != *count) {
+      free(records);
+      records = NULL;
+    }
+  }
+  fclose(f);
+  return records;
+}
+
+static size_t timelineRow(size_t calls, size_t live_bytes) {
+  heapStats st = mm_heap_stats();
+  printf("%10zu %12zu %12zu %12zu %8zu %12zu %7.3f\n", calls, live_bytes,
+         st.in_use_bytes, st.free_bytes, st.free_blocks, st.largest_free,
+         st.fragmentation);
+  return st.in_use_bytes;
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s <trace> [--heap bytes] [--policy name] "
+           "[--every calls]\n", argv[0]);
+    return 1;
+  }
+  size_t heap_size = HEAP_SIZE;
+  const char* policy = NULL;
+  size_t every = 0;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--heap") == 0) {
+      heap_size = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--policy") == 0) {
+      policy = argv[i + 1];
+    } else if (strcmp(argv[i], "--every") == 0) {
+      every = (size_t)atol(argv[i + 1]);
+    }
+  }
+  size_t n = 0;
+  replayRecord* records = loadTrace(argv[1], &n);
+  if (records == NULL) {
+    printf("Not a version %d allocation trace: %s\n", RECORD_VERSION, argv[1]);
+    return 1;
+  }
+  uint32_t max_id = 0;
+  size_t max_len = 1;
+  uint64_t recorded_ns = 0;
+  size_t recorded_failed = 0;
+  for (size_t i = 0; i < n; i++) {
+    max_id = records[i].id > max_id ? records[i].id : max_id;
+    if (records[i].op == RECORD_READ || records[i].op == RECORD_WRITE) {
+      max_len = records[i].size > max_len ? records[i].size : max_len;
+    }
+    recorded_ns += records[i].delta_ns;
+    recorded_failed += records[i].failed && (records[i].op == RECORD_MALLOC ||
+                                             records[i].op == RECORD_REALLOC);
+  }
+  void** objects = calloc((size_t)max_id + 1, sizeof(void*));
+  size_t* sizes = calloc((size_t)max_id + 1, sizeof(size_t));
+  uint8_t* buf = calloc(max_len, 1);
+  uint8_t* heap = malloc(heap_size);
+  if (objects == NULL || sizes == NULL || buf == NULL || heap == NULL) {
+    printf("Out of memory\n");
+    return 1;
+  }
+  uint8_t pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+  for (size_t i = 0; i < heap_size; i++) heap[i] = pattern[i % 5];
+  if ((policy != NULL ? mm_init_policy(heap, heap_size, policy)
+                      : mm_init(heap, heap_size)) != 0) {
+    printf("mm_init failed (heap %zu bytes, policy %s)\n", heap_size,
+           policy != NULL ? policy : "default");
+    return 1;
+  }
+  if (every == 0) {
+    every = n / TIMELINE_ROWS > 0 ? n / TIMELINE_ROWS : 1;
+  }
+
+  printf("%10s %12s %12s %12s %8s %12s %7s\n", "calls", "live bytes",
+         "in use", "free", "holes", "largest", "frag");
+  size_t failed = 0, unmapped = 0, live_bytes = 0;
+  size_t peak_live = 0, peak_in_use = 0;
+  size_t next_check = 0;  // Live bytes at which in_use is sampled again
+  long long busy_ns = 0;
+  long long t0 = ns_time();
+  for (size_t i = 0; i < n; i++) {
+    replayRecord* r = &records[i];
+    void** obj = &objects[r->id];
+    if (r->id == 0 && r->op != RECORD_MALLOC) {
+      unmapped++;  // Block from before the recording started
+    } else if (r->op == RECORD_MALLOC) {
+      void* ptr = mm_malloc(r->size);
+      failed += ptr == NULL;
+      if (r->id == 0) {
+        mm_free(ptr);  // Failed when recorded, nothing refers to it
+      } else if (ptr != NULL) {
+        *obj = ptr;
+        sizes[r->id] = r->size;
+        live_bytes += r->size;
+      }
+    } else if (r->op == RECORD_FREE) {
+      mm_free(*obj);
+      live_bytes -= *obj != NULL ? sizes[r->id] : 0;
+      *obj = NULL;
+    } else if (r->op == RECORD_REALLOC) {
+      void* ptr = mm_realloc(*obj, r->size);
+      if (ptr != NULL || r->size == 0) {
+        live_bytes -= *obj != NULL ? sizes[r->id] : 0;
+        live_bytes += ptr != NULL ? r->size : 0;
+        *obj = ptr;
+        sizes[r->id] = r->size;
+      } else {
+        failed++;
+      }
+    } else if (r->op == RECORD_READ && *obj != NULL) {
+      failed += mm_read(*obj, r->offset, buf, r->size) < 0 && !r->failed;
+    } else if (r->op == RECORD_WRITE && *obj != NULL) {
+      failed += mm_write(*obj, r->offset, buf, r->size) < 0 && !r->failed;
+    }
+    peak_live = live_bytes > peak_live ? live_bytes : peak_live;
+    // In use is sampled on the timeline and whenever the live bytes grow past
+    // the last sample by 1/64: mm_heap_stats isn't free under list policies
+    if (live_bytes >= next_check || (i + 1) % every == 0) {
+      busy_ns += ns_time() - t0;  // Statistics aren't part of the replay time
+      size_t in_use = (i + 1) % every == 0 ? timelineRow(i + 1, live_bytes)
+                                           : mm_heap_stats().in_use_bytes;
+      peak_in_use = in_use > peak_in_use ? in_use : peak_in_use;
+      if (live_bytes >= next_check) {
+        next_check = live_bytes + live_bytes / 64 + 1;
+      }
+      t0 = ns_time();
+    }
+  }
+  busy_ns += ns_time() - t0;
+
+  printf("\n%zu calls replayed in %.1f ms: %.0f calls/s (recorded over "
+         "%.1f ms)\n", n, busy_ns / 1e6, busy_ns > 0 ? n / (busy_ns / 1e9) : 0,
+         recorded_ns / 1e6);
+  printf("peak live %zu bytes, peak in use %zu bytes (heap %zu)\n", peak_live,
+         peak_in_use, heap_size);
+  printf("failed %zu (recorded %zu), calls on unknown blocks %zu\n", failed,
+         recorded_failed, unmapped);
+  free(heap);
+  free(buf);
+  free(sizes);
+  free(objects);
+  free(records);
+  return 0;
+}
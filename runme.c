@@ -1,9 +1,97 @@
 #include <assert.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "allocator.h"
+#include "arena.h"
+#include "policy.h"
+#include "profile.h"
+#include "quarantine.h"
+#include "record.h"
+#include "scrub.h"
+#include "slab.h"
+#include "storm.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "wipe.h"
+
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
+
+void patternHeap(uint8_t* heap, size_t size, const uint8_t* pattern) {
+  for (size_t i = 0; i < size; ++i) {
+    heap[i] = pattern[i % 5];
+  }
+}
+
+void countBlock(header* hdr, void* ctx) {  // Free block visitor for Test 17
+  (void)hdr;
+  (*(int*)ctx)++;
+}
+
+#ifdef MM_THREADS
+void* threadWorker(void* arg) {  // Test 19: small objects stay intact
+  uint8_t tag = (uint8_t)(size_t)arg;
+  void* live[16] = {0};
+  for (int i = 0; i < 5000; i++) {
+    int k = i % 16;
+    uint8_t buf[300];
+    if (live[k] != NULL) {
+      assert(mm_read(live[k], 0, buf, 200) == 200);
+      assert(buf[0] == tag && buf[199] == tag);
+      mm_free(live[k]);
+    }
+    live[k] = mm_malloc(200);
+    assert(live[k] != NULL);
+    memset(buf, tag, sizeof(buf));
+    assert(mm_write(live[k], 0, buf, 200) == 200);
+  }
+  for (int k = 0; k < 16; k++) {
+    mm_free(live[k]);
+  }
+  return NULL;
+}
+
+static void* cached_slot;  // Test 19: freed by cacheHolder, then by main
+static int cached_step;
+
+void* cacheHolder(void* arg) {  // Test 19: keeps cached_slot in its cache
+  (void)arg;
+  mm_free(cached_slot);
+  __atomic_store_n(&cached_step, 1, __ATOMIC_RELEASE);
+  while (__atomic_load_n(&cached_step, __ATOMIC_ACQUIRE) != 2) {
+  }
+  return NULL;  // Exiting gives the slot back to its slab
+}
+
+static void* remote_blocks[64];  // Test 21: filled by one thread
+static size_t remote_count;
+
+void* remoteFiller(void* arg) {  // Test 21: fill this thread's arena
+  (void)arg;
+  remote_count = 0;
+  while (remote_count < 64 &&
+         (remote_blocks[remote_count] = mm_malloc(2000)) != NULL) {
+    remote_count++;
+  }
+  return NULL;
+}
+
+void* remoteFreer(void* arg) {  // Test 21: ... and free it from another one
+  (void)arg;
+  for (size_t i = 0; i < remote_count; i++) {
+    mm_free(remote_blocks[i]);
+  }
+  return NULL;
+}
+#endif
+
+void* profiledSite(void) { return mm_malloc(1000); }  // Test 25
 
 int main(int argc, char* argv[]) {
   unsigned int seed = 0;
@@ -132,6 +220,735 @@ int main(int argc, char* argv[]) {
   b = mm_realloc(a, 0);
   assert(b == NULL);
   printf("Test 11 passed.\n");
+
+  // --------- Test 12: Coalescing with both neighbours ---------
+  printf("Test 12: Coalescing with both neighbours...\n");
+  a = mm_malloc(64);
+  b = mm_malloc(64);
+  c = mm_malloc(64);
+  d = mm_malloc(64);  // Keeps c away from the rest of the free heap
+  mm_free(a);
+  mm_free(c);
+  mm_free(b);                // Should merge with a (before) and c (after)
+  void* e = mm_malloc(200);  // Only fits into the coalesced a+b+c
+  assert(e == a);
+  mm_free(e);
+  mm_free(d);
+  printf("Test 12 passed.\n");
+
+  // --------- Test 13: Corrupted free space ---------
+  printf("Test 13: Corrupted free space...\n");
+  uint8_t* small_heap = (uint8_t*)malloc(512);
+  for (size_t i = 0; i < 512; ++i) {
+    small_heap[i] = CUSTOM_PATTERN[i % 5];
+  }
+  mm_init(small_heap, 512);
+  a = mm_malloc(64);
+  assert(a != NULL && mm_verify_free() == 0);
+  small_heap[400] ^= 0x10;        // Bit flip inside the only free block
+  assert(mm_verify_free() == 1);  // Found by the deferred check
+  assert(mm_malloc(64) == NULL);  // and never handed out again
+  printf("Test 13 passed.\n");
+
+  // --------- Test 14: Chunked payload checks ---------
+  printf("Test 14: Chunked payload checks...\n");
+  uint8_t* chunk_heap = (uint8_t*)malloc(4096);
+  for (size_t i = 0; i < 4096; ++i) {
+    chunk_heap[i] = CUSTOM_PATTERN[i % 5];
+  }
+  mm_init(chunk_heap, 4096);
+  uint8_t big[1024], out[256];
+  memset(big, 0x5A, sizeof(big));
+  a = mm_malloc(sizeof(big));
+  assert(a != NULL && mm_write(a, 0, big, sizeof(big)) == sizeof(big));
+  ((uint8_t*)a)[900] ^= 0x01;               // Flip a bit in chunk 3
+  assert(mm_read(a, 0, out, 256) == 256);   // Chunk 0 is untouched
+  assert(mm_read(a, 768, out, 256) == -1);  // Chunk 3 is caught
+  assert(mm_read(a, 0, out, 256) == -1);    // and the block is quarantined
+  printf("Test 14 passed.\n");
+
+  // --------- Test 15: Partial writes ---------
+  printf("Test 15: Partial writes...\n");
+  patternHeap(chunk_heap, 4096, CUSTOM_PATTERN);
+  assert(mm_init(chunk_heap, 4096) == 0);
+  a = mm_malloc(sizeof(big));
+  assert(a != NULL && mm_write(a, 0, big, sizeof(big)) == sizeof(big));
+  memset(out, 0xC4, sizeof(out));
+  assert(mm_write(a, 200, out, 100) == 100);  // Spans chunks 0 and 1
+  assert(mm_write(a, 1000, out, 50) == 24);   // Clipped at the end
+  assert(checkBlock((header*)((uint8_t*)a - sizeof(header))) == 0);
+  assert(mm_read(a, 190, out, 120) == 120);
+  assert(out[9] == 0x5A && out[10] == 0xC4 && out[109] == 0xC4 &&
+         out[110] == 0x5A);
+  b = mm_malloc(100);  // Single chunk, covered by the header checksum
+  assert(b != NULL && mm_write(b, 0, big, 100) == 100);
+  assert(mm_write(b, 40, out, 10) == 10);
+  assert(checkBlock((header*)((uint8_t*)b - sizeof(header))) == 0);
+  printf("Test 15 passed.\n");
+
+  // --------- Test 16: Zero-copy leases ---------
+  printf("Test 16: Zero-copy leases...\n");
+  patternHeap(chunk_heap, 4096, CUSTOM_PATTERN);
+  assert(mm_init(chunk_heap, 4096) == 0);
+  a = mm_malloc(sizeof(big));
+  assert(a != NULL && mm_write(a, 0, big, sizeof(big)) == sizeof(big));
+  size_t leased = 0;
+  const uint8_t* ro = mm_acquire_ro(a, &leased);
+  assert(ro == a && leased == sizeof(big) && ro[500] == 0x5A);
+  assert(mm_acquire_ro(a, NULL) == ro);         // Readers can share
+  assert(mm_acquire_rw(a, NULL) == NULL);       // but exclude writers
+  assert(mm_write(a, 0, out, 1) == -1);         // and plain writes
+  assert(mm_release(ro) == 0 && mm_release(ro) == 0);
+  assert(mm_release(ro) == -1);                 // Not leased anymore
+  uint8_t* rw = mm_acquire_rw(a, NULL);
+  assert(rw != NULL && mm_acquire_ro(a, NULL) == NULL);
+  rw[700] = 0x11;                               // Checksums now stale
+  assert(mm_read(a, 0, out, 1) == -1);          // so nobody else may look
+  mm_free(a);                                   // or free it
+  assert(mm_release(rw) == 0);                  // Resealed
+  assert(mm_read(a, 700, out, 1) == 1 && out[0] == 0x11);
+  mm_lease_debug(1);
+  uint8_t* cheat = (uint8_t*)mm_acquire_ro(a, NULL);
+  cheat[10] ^= 0xFF;                            // Write through a read lease
+  assert(mm_release(cheat) == -1);              // is caught in debug mode
+  mm_lease_debug(0);
+  printf("Test 16 passed.\n");
+
+  // --------- Test 17: Placement policies ---------
+  printf("Test 17: Placement policies...\n");
+  assert(mm_init_policy(chunk_heap, 4096, "no-such-policy") == -1);
+  for (size_t i = 0; i < policyCount(); i++) {
+    patternHeap(chunk_heap, 4096, CUSTOM_PATTERN);
+    assert(mm_init_policy(chunk_heap, 4096, policyAt(i)->name) == 0);
+    a = mm_malloc(100);
+    b = mm_malloc(300);
+    void* c3 = mm_malloc(50);
+    assert(a != NULL && b != NULL && c3 != NULL);
+    mm_free(b);
+    b = mm_malloc(200);  // Reuses the hole
+    assert(b != NULL && (uint8_t*)b < (uint8_t*)c3);
+    mm_free(a);
+    mm_free(c3);
+    mm_free(b);
+    int free_blocks = 0;
+    policyActive()->forEach(countBlock, &free_blocks);
+    assert(free_blocks == 1);  // Everything merged back
+  }
+  assert(policySelect(MM_POLICY) == 0);
+  free(chunk_heap);
+  printf("Test 17 passed.\n");
+
+  // --------- Test 18: Slab objects ---------
+  printf("Test 18: Slab objects...\n");
+  uint8_t* slab_heap = (uint8_t*)malloc(65536);
+  patternHeap(slab_heap, 16384, CUSTOM_PATTERN);
+  assert(mm_init(slab_heap, 16384) == 0);  // Too small to give up a slab
+  void* warmup[2 * SLAB_WARMUP];
+  for (int i = 0; i < 2 * SLAB_WARMUP; i++) {
+    warmup[i] = mm_malloc(64);
+    assert(warmup[i] != NULL && mm_usable_size(warmup[i]) == 64);
+  }
+  for (int i = 0; i < 2 * SLAB_WARMUP; i++) {
+    mm_free(warmup[i]);
+  }
+  a = mm_malloc(16384 - 1024);  // Nothing kept back for slabs
+  assert(a != NULL);
+  mm_free(a);
+  patternHeap(slab_heap, 65536, CUSTOM_PATTERN);
+  assert(mm_init(slab_heap, 65536) == 0);
+  for (int i = 0; i < SLAB_WARMUP; i++) {
+    warmup[i] = mm_malloc(64);  // A few small blocks stay on the heap
+    assert(warmup[i] != NULL && mm_usable_size(warmup[i]) == 64);
+  }
+  a = mm_malloc(64);
+  b = mm_malloc(64);
+  assert(a != NULL && b != NULL);
+  assert((uint8_t*)b - (uint8_t*)a == 80);  // Neighbouring slots, no headers
+  assert(mm_usable_size(a) == 64);          // The requested size, not 80
+  assert(mm_write(a, 60, "slab", 5) == 4);  // Stops at 64
+  assert(mm_read(a, 64, out, 1) == 0);
+  assert(mm_realloc(a, 72) == a && mm_usable_size(a) == 72);  // Same slot
+  assert(mm_write(a, 0, "slab", 5) == 5);
+  assert(mm_read(a, 0, out, 5) == 5 && memcmp(out, "slab", 5) == 0);
+  mm_free(a);
+  assert(mm_malloc(64) == a);  // The freed slot is reused first
+  mm_free(b);
+  mm_free(b);                            // Double free is refused
+  assert(mm_read(b, 0, out, 1) == -1);  // And so is a freed slot
+  ((uint8_t*)a)[3] ^= 0x01;             // Bit flip in a slot
+  assert(mm_read(a, 0, out, 5) == -1);  // The whole slab is quarantined
+  assert(mm_malloc(64) != a);
+  free(slab_heap);
+  printf("Test 18 passed.\n");
+
+  // --------- Test 19: Threads ---------
+#ifdef MM_THREADS
+  printf("Test 19: Threads...\n");
+  uint8_t* thread_heap = (uint8_t*)malloc(1 << 20);
+  patternHeap(thread_heap, 1 << 20, CUSTOM_PATTERN);
+  assert(mm_init(thread_heap, 1 << 20) == 0);
+  pthread_t threads[4];
+  for (size_t t = 0; t < 4; t++) {
+    pthread_create(&threads[t], NULL, threadWorker, (void*)(t + 1));
+  }
+  for (size_t t = 0; t < 4; t++) {
+    pthread_join(threads[t], NULL);  // Exiting threads flush their caches
+  }
+  assert(mm_verify_free() == 0);
+  // A slot in another thread's cache can't be freed (and cached) again
+  cached_slot = mm_malloc(200);
+  assert(slabFind(cached_slot) != NULL);
+  pthread_t holder;
+  pthread_create(&holder, NULL, cacheHolder, NULL);
+  while (__atomic_load_n(&cached_step, __ATOMIC_ACQUIRE) != 1) {
+  }
+  uint8_t cached_buf[16];
+  assert(mm_read(cached_slot, 0, cached_buf, 16) == -1);
+  mm_free(cached_slot);  // Double free, not cached here
+  void* cached_more[64];
+  for (int i = 0; i < 64; i++) {
+    cached_more[i] = mm_malloc(200);
+    assert(cached_more[i] != NULL && cached_more[i] != cached_slot);
+  }
+  for (int i = 0; i < 64; i++) {
+    mm_free(cached_more[i]);
+  }
+  __atomic_store_n(&cached_step, 2, __ATOMIC_RELEASE);
+  pthread_join(holder, NULL);
+  assert(mm_verify_free() == 0);
+  free(thread_heap);
+  printf("Test 19 passed.\n");
+#else
+  printf("Test 19 skipped (build with THREADS=1).\n");
+#endif
+
+  // --------- Test 20: Arenas ---------
+  printf("Test 20: Arenas...\n");
+  uint8_t* heap_a = (uint8_t*)malloc(16384);
+  uint8_t* heap_b = (uint8_t*)malloc(16384);
+  patternHeap(heap_a, 16384, CUSTOM_PATTERN);
+  patternHeap(heap_b, 16384, CUSTOM_PATTERN);
+  mm_arena_t* arena_a = mm_arena_init(heap_a, 16384);
+  mm_arena_t* arena_b = mm_arena_init(heap_b, 16384);
+  assert(arena_a != NULL && arena_b != NULL && arena_a != arena_b);
+  a = mm_arena_malloc(arena_a, 1000);
+  b = mm_arena_malloc(arena_b, 1000);
+  assert((uint8_t*)a >= heap_a && (uint8_t*)a < heap_a + 16384);
+  assert((uint8_t*)b >= heap_b && (uint8_t*)b < heap_b + 16384);
+  assert(mm_arena_write(arena_a, a, 0, "arena a", 8) == 8);
+  assert(mm_arena_read(arena_a, a, 0, out, 8) == 8);
+  assert(memcmp(out, "arena a", 8) == 0);
+  assert(mm_arena_read(arena_b, a, 0, out, 8) == -1);  // Not its block
+  a = mm_arena_realloc(arena_a, a, 3000);
+  assert(a != NULL && mm_arena_read(arena_a, a, 0, out, 8) == 8);
+  assert(memcmp(out, "arena a", 8) == 0);  // Moved within arena a
+  // Leases on a handle's block go through the handle
+  size_t lease_size = 0;
+  const uint8_t* handle_ro = mm_arena_acquire_ro(arena_a, a, &lease_size);
+  assert(handle_ro == a && lease_size == mm_arena_usable_size(arena_a, a));
+  assert(lease_size >= 3000 && memcmp(handle_ro, "arena a", 8) == 0);
+  assert(mm_arena_acquire_rw(arena_a, a, NULL) == NULL);  // Leased for reading
+  assert(mm_arena_usable_size(arena_b, a) == 0);
+  assert(mm_arena_release(arena_b, a) == -1);
+  assert(mm_arena_release(arena_a, a) == 0);
+  uint8_t* handle_rw = mm_arena_acquire_rw(arena_a, a, NULL);
+  assert(handle_rw == a);
+  memcpy(handle_rw, "handle", 7);
+  assert(mm_arena_read(arena_a, a, 0, out, 7) == -1);  // Until it's released
+  assert(mm_arena_release(arena_a, a) == 0);
+  assert(mm_arena_read(arena_a, a, 0, out, 7) == 7);
+  assert(memcmp(out, "handle", 7) == 0);
+  mm_arena_free(arena_a, a);
+  mm_arena_free(arena_b, b);
+  // Spread mode: mm_malloc prefers the caller's arena, frees go by address.
+  // 4 arenas of 16200 bytes (multiples of ALIGN * 5)
+  uint8_t* spread_heap = (uint8_t*)malloc(65536);
+  patternHeap(spread_heap, 65536, CUSTOM_PATTERN);
+  assert(mm_init_arenas(spread_heap, 65536, 9, MM_SPREAD_THREAD) == -1);
+  assert(mm_init_arenas(spread_heap, 65536, 4, MM_SPREAD_THREAD) == 0);
+  void* spread[8];
+  for (int i = 0; i < 8; i++) {
+    spread[i] = mm_malloc(6000);  // Two fit per arena, then it borrows
+    assert(spread[i] != NULL);
+  }
+  assert(((uint8_t*)spread[0] - spread_heap) / 16200 ==
+         ((uint8_t*)spread[1] - spread_heap) / 16200);
+  assert(((uint8_t*)spread[2] - spread_heap) / 16200 !=
+         ((uint8_t*)spread[0] - spread_heap) / 16200);
+  for (int i = 0; i < 8; i++) {
+    assert(mm_write(spread[i], 0, "spread", 7) == 7);
+    mm_free(spread[i]);
+  }
+  assert(mm_verify_free() == 0);
+  free(spread_heap);
+  free(heap_a);
+  free(heap_b);
+  printf("Test 20 passed.\n");
+
+  // --------- Test 21: Remote Frees ---------
+#ifdef MM_THREADS
+  printf("Test 21: Remote frees...\n");
+  uint8_t* remote_heap = (uint8_t*)malloc(65000);
+  patternHeap(remote_heap, 65000, CUSTOM_PATTERN);
+  // Threads are numbered in creation order, so the freer's home is not the
+  // filler's arena and its frees there go through the remote stack
+  assert(mm_init_arenas(remote_heap, 65000, 2, MM_SPREAD_THREAD) == 0);
+  pthread_t remote_thread;
+  pthread_create(&remote_thread, NULL, remoteFiller, NULL);
+  pthread_join(remote_thread, NULL);
+  size_t filled = remote_count;
+  assert(filled > 0 && filled < 64);  // The arena ran full
+  pthread_create(&remote_thread, NULL, remoteFreer, NULL);
+  pthread_join(remote_thread, NULL);
+  pthread_create(&remote_thread, NULL, remoteFiller, NULL);
+  pthread_join(remote_thread, NULL);
+  assert(remote_count == filled);  // Every block came back
+  pthread_create(&remote_thread, NULL, remoteFreer, NULL);
+  pthread_join(remote_thread, NULL);
+  assert(mm_verify_free() == 0);
+  free(remote_heap);
+  printf("Test 21 passed.\n");
+#else
+  printf("Test 21 skipped (build with THREADS=1).\n");
+#endif
+
+  // --------- Test 22: Tracing ---------
+#if MM_TRACE >= 2
+  printf("Test 22: Tracing...\n");
+  uint8_t* trace_heap = (uint8_t*)malloc(16384);
+  patternHeap(trace_heap, 16384, CUSTOM_PATTERN);
+  assert(mm_init(trace_heap, 16384) == 0);
+  void* traced = mm_malloc(1000);
+  assert(traced != NULL);
+  mm_free(traced);
+  mm_free(traced);  // Double free
+  traceEvent events[64];
+  size_t event_count = mm_trace_events(events, 64);
+  assert(event_count >= 3);
+  // The op comes last and carries the error its free ran into (what the
+  // stale header looks like depends on where the heap is)
+  traceEvent* last = &events[event_count - 1];
+  assert(last->op == TRACE_FREE && last->ptr == (uintptr_t)traced);
+  assert(last->outcome != TRACE_OK);
+  assert(events[event_count - 2].outcome == last->outcome);
+  int found_malloc = 0;
+  for (size_t i = 0; i < event_count; i++) {
+    found_malloc |= events[i].op == TRACE_MALLOC &&
+                    events[i].ptr == (uintptr_t)traced &&
+                    events[i].size == 1000 && events[i].outcome == TRACE_OK;
+  }
+  assert(found_malloc);
+  assert(mm_trace_dump("runme_trace.bin") == 0);  // See trace_decode
+  remove("runme_trace.bin");
+  free(trace_heap);
+  printf("Test 22 passed.\n");
+#else
+  printf("Test 22 skipped (build with TRACE_LEVEL=2).\n");
+#endif
+
+  // --------- Test 23: Heap statistics ---------
+  printf("Test 23: Heap statistics...\n");
+  uint8_t* stats_heap = (uint8_t*)malloc(16384);
+  patternHeap(stats_heap, 16384, CUSTOM_PATTERN);
+  assert(mm_init(stats_heap, 16384) == 0);
+  heapStats stats = mm_heap_stats();
+  assert(stats.heap_bytes == 16384 && stats.free_blocks == 1);
+  assert(stats.fragmentation == 0.0 && stats.payload_bytes == 0);
+  assert(stats.largest_free == stats.free_bytes);
+  void* st_a = mm_malloc(1000);
+  void* st_b = mm_malloc(1000);
+  void* st_c = mm_malloc(1000);
+  assert(st_a != NULL && st_b != NULL && st_c != NULL);
+  mm_free(st_b);  // A hole between a and c
+  stats = mm_heap_stats();
+  assert(stats.free_blocks == 2 && stats.fragmentation > 0.0);
+  assert(stats.largest_free < stats.free_bytes);
+  assert(stats.payload_bytes >= 2000 && stats.payload_bytes < 2100);
+  assert(stats.in_use_bytes == stats.payload_bytes + stats.overhead_bytes);
+  assert(stats.in_use_bytes + stats.free_bytes == stats.heap_bytes);
+  assert(stats.ops[TRACE_MALLOC] == 3 && stats.ops[TRACE_FREE] == 1);
+  assert(stats.searches == 3 && stats.avg_search >= 1.0);
+  assert(stats.avg_search <= stats.max_search);
+  ((uint8_t*)st_a)[10] ^= 0x01;  // Bit flip, caught by the read
+  assert(mm_read(st_a, 0, out, 16) == -1);
+  mm_free(st_c);  // b, c and the rest merge
+  stats = mm_heap_stats();
+  assert(stats.checksum_failures[TRACE_READ] == 1);
+  assert(stats.quarantined_blocks == 1 && stats.payload_bytes == 0);
+  assert(stats.free_blocks == 1 && stats.fragmentation == 0.0);
+  assert(mm_verify_free() == 0);
+  assert(mm_heap_stats().free_bytes == stats.free_bytes);  // Recount agrees
+  // A realloc that slides down over the block's own old header
+  patternHeap(stats_heap, 16384, CUSTOM_PATTERN);
+  assert(mm_init(stats_heap, 16384) == 0);
+  st_a = mm_malloc(100);
+  st_b = mm_malloc(1000);
+  st_c = mm_malloc(100);
+  void* st_d = mm_malloc(100);
+  assert(st_a != NULL && st_b != NULL && st_c != NULL && st_d != NULL);
+  mm_free(st_a);
+  mm_free(st_c);
+  size_t st_words[125];  // Wherever the old header ends up, it reads 100
+  for (int i = 0; i < 125; i++) {
+    st_words[i] = 100;
+  }
+  assert(mm_write(st_b, 0, st_words, 1000) == 1000);
+  void* st_moved = mm_realloc(st_b, 1200);
+  assert(st_moved != NULL && (uint8_t*)st_moved < (uint8_t*)st_b);
+  size_t st_check[125];
+  assert(mm_read(st_moved, 0, st_check, 1000) == 1000);
+  assert(memcmp(st_check, st_words, 1000) == 0);
+  stats = mm_heap_stats();
+  assert(stats.payload_bytes == 1300);
+  assert(g_arenas[0].slabs.heap_live[slabClass(100)] == 1);  // Only st_d
+  assert(stats.in_use_bytes == stats.payload_bytes + stats.overhead_bytes);
+  assert(stats.in_use_bytes + stats.free_bytes == stats.heap_bytes);
+  mm_free(st_moved);
+  mm_free(st_d);
+  assert(mm_heap_stats().payload_bytes == 0);
+  free(stats_heap);
+  printf("Test 23 passed.\n");
+
+  // --------- Test 24: Shared memory telemetry ---------
+  printf("Test 24: Telemetry...\n");
+  uint8_t* telem_heap = (uint8_t*)malloc(16384);
+  patternHeap(telem_heap, 16384, CUSTOM_PATTERN);
+  assert(mm_init(telem_heap, 16384) == 0);
+  assert(mm_telemetry_open("/mm_runme_telemetry") == 0);
+  assert(mm_telemetry_open("/mm_runme_telemetry") == -1);  // Already open
+  int telem_fd = shm_open("/mm_runme_telemetry", O_RDONLY, 0);  // As mm_top
+  assert(telem_fd >= 0);
+  telemetrySegment* seg = (telemetrySegment*)mmap(
+      NULL, sizeof(telemetrySegment), PROT_READ, MAP_SHARED, telem_fd, 0);
+  close(telem_fd);
+  assert(seg != MAP_FAILED && seg->magic == TELEMETRY_MAGIC);
+  assert(seg->pid == (uint32_t)getpid() && seg->counters.heap_bytes == 16384);
+  uint64_t updates = seg->updates;
+  for (int i = 0; i < TELEMETRY_PERIOD; i++) {
+    mm_free(mm_malloc(1000));
+  }
+  assert(seg->updates > updates);  // Published along the way
+  mm_telemetry_publish();
+  assert(seg->counters.ops[TRACE_MALLOC] == TELEMETRY_PERIOD);
+  assert(seg->counters.free_blocks == 1 && seg->seq % 2 == 0);
+  munmap(seg, sizeof(telemetrySegment));
+  mm_telemetry_close();
+  assert(shm_open("/mm_runme_telemetry", O_RDONLY, 0) == -1);  // Unlinked
+  free(telem_heap);
+  printf("Test 24 passed.\n");
+
+  // --------- Test 25: Heap profile ---------
+  printf("Test 25: Heap profile...\n");
+  uint8_t* prof_heap = (uint8_t*)malloc(16384);
+  patternHeap(prof_heap, 16384, CUSTOM_PATTERN);
+  assert(mm_init(prof_heap, 16384) == 0);
+  assert(mm_profile_start(1) == 0);  // Sample (about) every byte
+  mm_free(mm_malloc(1000));  // Picks the first gap, not sampled
+  void* prof[3];
+  for (int i = 0; i < 3; i++) {
+    prof[i] = profiledSite();
+    assert(prof[i] != NULL);
+  }
+  mm_free(prof[1]);
+  mm_profile_stop();
+  assert(mm_profile_dump("runme_heap.prof", MM_PROFILE_PPROF) == 0);
+  char line[256];
+  FILE* prof_file = fopen("runme_heap.prof", "r");
+  assert(prof_file != NULL && fgets(line, sizeof(line), prof_file) != NULL);
+  assert(strcmp(line, "heap profile: 2: 2000 [3: 3000] @ heap_v2/1\n") == 0);
+  assert(fgets(line, sizeof(line), prof_file) != NULL);
+  assert(strncmp(line, "2: 2000 [3: 3000] @ 0x", 22) == 0);  // One site
+  fclose(prof_file);
+  assert(mm_profile_dump("runme_heap.folded", MM_PROFILE_FOLDED) == 0);
+  prof_file = fopen("runme_heap.folded", "r");
+  assert(prof_file != NULL && fgets(line, sizeof(line), prof_file) != NULL);
+  assert(strstr(line, " 2000\n") != NULL);  // Live bytes of the site
+  fclose(prof_file);
+  remove("runme_heap.prof");
+  remove("runme_heap.folded");
+  mm_free(prof[0]);
+  mm_free(prof[2]);
+  free(prof_heap);
+  printf("Test 25 passed.\n");
+
+  // --------- Test 26: Allocation trace recording ---------
+  printf("Test 26: Allocation trace recording...\n");
+  uint8_t* rec_heap = (uint8_t*)malloc(16384);
+  patternHeap(rec_heap, 16384, CUSTOM_PATTERN);
+  assert(mm_init(rec_heap, 16384) == 0);
+  void* before = mm_malloc(100);  // Allocated before the recording starts
+  assert(mm_record_start("runme_trace.mmr") == 0);
+  assert(mm_record_start("runme_trace.mmr") == -1);  // Already recording
+  void* rec_a = mm_malloc(1000);
+  void* rec_b = mm_malloc(2000);
+  assert(mm_write(rec_a, 10, "record", 6) == 6);
+  rec_a = mm_realloc(rec_a, 3000);
+  assert(mm_malloc(1 << 20) == NULL);  // Failed
+  mm_free(before);
+  mm_free(rec_b);
+  mm_free(rec_a);
+  assert(mm_record_stop() == 0 && mm_record_stop() == -1);
+  mm_free(mm_malloc(10));  // Not recorded
+  FILE* rec_file = fopen("runme_trace.mmr", "rb");
+  uint32_t rec_header[4];
+  uint64_t rec_start;
+  replayRecord recs[16];
+  assert(rec_file != NULL && fread(rec_header, sizeof(rec_header), 1,
+                                   rec_file) == 1);
+  assert(rec_header[0] == RECORD_MAGIC && rec_header[2] == sizeof(recs[0]));
+  assert(fread(&rec_start, sizeof(rec_start), 1, rec_file) == 1);
+  assert(fread(recs, sizeof(recs[0]), 16, rec_file) == 8);
+  fclose(rec_file);
+  remove("runme_trace.mmr");
+  // Objects are numbered in allocation order, unknown blocks are 0
+  const uint8_t rec_ops[8] = {RECORD_MALLOC, RECORD_MALLOC, RECORD_WRITE,
+                              RECORD_REALLOC, RECORD_MALLOC, RECORD_FREE,
+                              RECORD_FREE, RECORD_FREE};
+  const uint32_t rec_ids[8] = {1, 2, 1, 1, 0, 0, 2, 1};
+  for (int i = 0; i < 8; i++) {
+    assert(recs[i].op == rec_ops[i] && recs[i].id == rec_ids[i]);
+  }
+  assert(recs[0].size == 1000 && recs[2].offset == 10 && recs[2].size == 6);
+  assert(recs[3].size == 3000 && recs[4].failed == 1 && recs[5].failed == 0);
+  free(rec_heap);
+  printf("Test 26 passed.\n");
+
+  // --------- Test 27: Storm fault injection (--storm flips, --seed) ---------
+  printf("Test 27: Storm fault injection...\n");
+  uint8_t* storm_heap = (uint8_t*)malloc(65536);
+  patternHeap(storm_heap, 65536, CUSTOM_PATTERN);
+  assert(mm_init(storm_heap, 65536) == 0);
+  uint8_t storm_data[600], storm_buf[600];
+  void* storm_blocks[16];
+  for (size_t i = 0; i < sizeof(storm_data); i++) {
+    storm_data[i] = (uint8_t)(i * 7);
+  }
+  for (int i = 0; i < 16; i++) {
+    storm_blocks[i] = mm_malloc(sizeof(storm_data));
+    assert(mm_write(storm_blocks[i], 0, storm_data, 600) == 600);
+  }
+  assert(mm_storm_inject(1) == 0);  // Not started
+  assert(mm_storm_start(0, MM_STORM_HEADERS | MM_STORM_PAYLOADS, seed) == 0);
+  size_t storm_flips = mm_storm_inject(storm > 0 ? (size_t)storm : 16);
+  static mm_storm_flip flips[STORM_LOG];
+  size_t flip_count = mm_storm_log(flips, STORM_LOG);
+  assert(storm_flips > 0 && flip_count == storm_flips);
+  for (int i = 0; i < 16; i++) {  // Every hit is caught, nothing reads wrong
+    uint8_t* payload = (uint8_t*)storm_blocks[i];
+    int hit = 0;
+    for (size_t f = 0; f < flip_count; f++) {
+      hit |= flips[f].addr >= payload && flips[f].addr < payload + 600;
+    }
+    int count = mm_read(storm_blocks[i], 0, storm_buf, 600);
+    assert(count == -1 || (count == 600 && !hit &&
+                           memcmp(storm_buf, storm_data, 600) == 0));
+  }
+  mm_storm_stop();
+  printf("%zu bits flipped, seed %u\n", storm_flips, seed);
+  free(storm_heap);
+  printf("Test 27 passed.\n");
+
+  // --------- Test 28: Patrol scrubber ---------
+  printf("Test 28: Patrol scrubber...\n");
+  uint8_t* scrub_heap = (uint8_t*)malloc(65536);
+  patternHeap(scrub_heap, 65536, CUSTOM_PATTERN);
+  assert(mm_init(scrub_heap, 65536) == 0);
+  uint8_t scrub_data[600], scrub_buf[600];
+  void* scrub_blocks[8];
+  memset(scrub_data, 0x5A, sizeof(scrub_data));
+  for (int i = 0; i < 8; i++) {
+    scrub_blocks[i] = mm_malloc(sizeof(scrub_data));
+    assert(mm_write(scrub_blocks[i], 0, scrub_data, 600) == 600);
+  }
+  void* scrub_small[32];  // A slab, its slots must not be taken for damage
+  for (int i = 0; i < 32; i++) {
+    scrub_small[i] = mm_malloc(24);
+    assert(mm_write(scrub_small[i], 0, scrub_data, 24) == 24);
+  }
+  mm_free(scrub_blocks[2]);
+  assert(mm_scrub(65536 * 2) == 0);  // Healthy heap, two full passes
+  heapStats scrub_st = mm_heap_stats();
+  assert(scrub_st.scrub_passes >= 1 && scrub_st.quarantined_blocks == 0);
+  ((uint8_t*)scrub_blocks[2])[200] ^= 0x10;  // Unused space of a free block
+  ((uint8_t*)scrub_blocks[5])[300] ^= 0x01;  // Payload chunk 1
+  size_t scrub_found = 0;
+  for (size_t passes = mm_heap_stats().scrub_passes;
+       mm_heap_stats().scrub_passes < passes + 2;) {
+    scrub_found += mm_scrub(512);  // Small steps, blocks span several
+  }
+  scrub_st = mm_heap_stats();
+  assert(scrub_found == 2 && scrub_st.quarantined_blocks == 2);
+  assert(mm_read(scrub_blocks[5], 0, scrub_buf, 600) == -1);
+  for (int i = 0; i < 8; i++) {  // The others are untouched
+    if (i != 2 && i != 5) {
+      assert(mm_read(scrub_blocks[i], 0, scrub_buf, 600) == 600);
+      assert(memcmp(scrub_buf, scrub_data, 600) == 0);
+    }
+  }
+  for (int i = 0; i < 32; i++) {
+    assert(mm_read(scrub_small[i], 0, scrub_buf, 24) == 24);
+  }
+#ifdef MM_THREADS
+  assert(mm_scrub_start(4096, 1) == 0 && mm_scrub_start(4096, 1) == -1);
+  usleep(5000);
+  mm_scrub_stop();
+#else
+  assert(mm_scrub_start(4096, 1) == -1);
+#endif
+  printf("%zu bytes scrubbed in %zu passes\n", scrub_st.scrubbed_bytes,
+         scrub_st.scrub_passes);
+  free(scrub_heap);
+  printf("Test 28 passed.\n");
+
+  // --------- Test 29: Header error correction ---------
+  printf("Test 29: Header error correction...\n");
+  uint8_t* ecc_heap = (uint8_t*)malloc(65536);
+  patternHeap(ecc_heap, 65536, CUSTOM_PATTERN);
+  assert(mm_init(ecc_heap, 65536) == 0);
+  uint8_t ecc_data[100], ecc_buf[600];
+  memset(ecc_data, 0x3C, sizeof(ecc_data));
+  void* ecc_blocks[16];
+  for (int i = 0; i < 16; i++) {
+    ecc_blocks[i] = mm_malloc(i % 2 ? 1000 : 600);  // Past the slab sizes
+    assert(mm_write(ecc_blocks[i], 0, ecc_data, 100) == 100);
+  }
+  // One bit of each header byte (size, status, padding, slack, code and
+  // checksum), corrected in place by the calls that run into them. Only the
+  // patrol notices a flip in the code itself
+  for (int i = 0; i < 16; i++) {
+    ((uint8_t*)ecc_blocks[i] - sizeof(header))[i] ^= (uint8_t)(1 << (i % 8));
+  }
+  for (int i = 0; i < 16; i++) {
+    assert(mm_read(ecc_blocks[i], 0, ecc_buf, 100) == 100);
+    assert(memcmp(ecc_buf, ecc_data, 100) == 0);
+  }
+  assert(mm_heap_stats().corrected_headers == 15);
+  assert(mm_scrub(65536) == 0);
+  heapStats ecc_st = mm_heap_stats();
+  assert(ecc_st.corrected_headers == 16 && ecc_st.quarantined_blocks == 0);
+  header* ecc_hdr = (header*)((uint8_t*)ecc_blocks[3] - sizeof(header));
+  ecc_hdr->status ^= 0x04;  // Free still sees an allocated block
+  uint8_t* ecc_start = (uint8_t*)ecc_hdr - ecc_hdr->padding;
+  mm_free(ecc_blocks[3]);
+  ((header*)ecc_start)->size ^= 0x100;  // Now a free block's header
+  assert(mm_verify_free() == 0);
+  ecc_hdr = (header*)((uint8_t*)ecc_blocks[6] - sizeof(header));
+  ecc_hdr->size ^= 0x3;  // Two bits: detected, not miscorrected
+  assert(mm_read(ecc_blocks[6], 0, ecc_buf, 100) == -1);
+  ecc_hdr = (header*)((uint8_t*)ecc_blocks[7] - sizeof(header));
+  ecc_hdr->slack ^= 0x20;  // A header bit and one the checksum covers
+  ((uint8_t*)ecc_blocks[7])[1000] ^= 0x01;  // Table digest, after the payload
+  assert(mm_read(ecc_blocks[7], 0, ecc_buf, 100) == -1);
+  ecc_st = mm_heap_stats();
+  assert(ecc_st.corrected_headers == 18 && ecc_st.quarantined_blocks == 2);
+  printf("%zu headers corrected, %zu blocks quarantined\n",
+         ecc_st.corrected_headers, ecc_st.quarantined_blocks);
+  free(ecc_heap);
+  printf("Test 29 passed.\n");
+
+  // --------- Test 30: Quarantine reclamation ---------
+  printf("Test 30: Quarantine reclamation...\n");
+  uint8_t* rec_heap2 = (uint8_t*)malloc(65536);
+  patternHeap(rec_heap2, 65536, CUSTOM_PATTERN);
+  assert(mm_init(rec_heap2, 65536) == 0);
+  size_t whole = mm_heap_stats().largest_free;
+  assert(mm_reclaim() == 0);  // Nothing quarantined
+  uint8_t recl_data[600], recl_buf[600];
+  memset(recl_data, 0x69, sizeof(recl_data));
+  void* recl_blocks[8];
+  for (int i = 0; i < 8; i++) {
+    recl_blocks[i] = mm_malloc(600);
+    assert(mm_write(recl_blocks[i], 0, recl_data, 600) == 600);
+  }
+  ((uint8_t*)recl_blocks[2])[400] ^= 0x08;  // Payload, header intact
+  assert(mm_read(recl_blocks[2], 0, recl_buf, 600) == -1);
+  mm_free(recl_blocks[5]);
+  ((uint8_t*)recl_blocks[5])[100] ^= 0x40;  // Free block's unused space
+  assert(mm_verify_free() == 1);
+  header* recl_hdr = (header*)((uint8_t*)recl_blocks[6] - sizeof(header));
+  recl_hdr->size ^= 0x3;  // Header beyond correction, bounds unknown
+  assert(mm_read(recl_blocks[6], 0, recl_buf, 600) == -1);
+  heapStats recl_st = mm_heap_stats();
+  assert(recl_st.quarantined_blocks == 3);
+  size_t lost = recl_st.quarantined_bytes;  // From a corrupted size too
+  for (int i = 0; i < 8; i++) {
+    if (i != 2 && i != 5 && i != 6) {
+      mm_free(recl_blocks[i]);
+    }
+  }
+  size_t recovered = mm_reclaim();
+  recl_st = mm_heap_stats();
+  assert(recovered + 16 > lost && recl_st.recovered_bytes == recovered);
+  assert(recl_st.quarantined_blocks == 0 && recl_st.quarantined_bytes == 0);
+  assert(recl_st.recovered_blocks == 3 && recl_st.free_blocks == 1);
+  assert(recl_st.largest_free == whole && mm_verify_free() == 0);
+  void* recl_all = mm_malloc(whole - 2048);  // The space is usable again
+  assert(recl_all != NULL && mm_write(recl_all, 0, recl_data, 600) == 600);
+  printf("%zu bytes recovered from %zu blocks\n", recl_st.recovered_bytes,
+         recl_st.recovered_blocks);
+  free(rec_heap2);
+  printf("Test 30 passed.\n");
+
+  // --------- Test 31: Deferred wiping ---------
+  printf("Test 31: Deferred wiping...\n");
+  uint8_t* wipe_heap = (uint8_t*)malloc(131072);
+  patternHeap(wipe_heap, 131072, CUSTOM_PATTERN);
+  assert(mm_init(wipe_heap, 131072) == 0);
+  assert(mm_wipe_mode(2) == -1 && mm_wipe_mode(MM_WIPE_DEFERRED) == 0);
+  uint8_t wipe_data[1800], wipe_buf[1800];
+  memset(wipe_data, 0x5A, sizeof(wipe_data));
+  void* wipe_blocks[8];
+  for (int i = 0; i < 8; i++) {
+    wipe_blocks[i] = mm_malloc(1000);
+    assert(mm_write(wipe_blocks[i], 0, wipe_data, 1000) == 1000);
+  }
+  mm_free(wipe_blocks[1]);
+  mm_free(wipe_blocks[3]);
+  mm_free(wipe_blocks[2]);  // Merges both, the spans join up
+  assert(mm_heap_stats().pending_wipe_bytes > 2000);
+  assert(((uint8_t*)wipe_blocks[2])[500] == 0x5A);  // Not wiped yet
+  void* wipe_again = mm_malloc(1000);  // Part of the queued span, no wipe
+  assert(mm_write(wipe_again, 0, wipe_data, 1000) == 1000);
+  assert(mm_read(wipe_again, 0, wipe_buf, 1000) == 1000);
+  assert(memcmp(wipe_buf, wipe_data, 1000) == 0);
+  assert(mm_verify_free() == 0);  // Checks wipe what they look at
+  assert(mm_heap_stats().pending_wipe_bytes == 0);
+  mm_free(wipe_blocks[5]);
+  void* wipe_next = mm_realloc(wipe_blocks[4], 1800);  // Grows into [5]
+  assert(wipe_next == wipe_blocks[4]);
+  mm_free(wipe_blocks[0]);
+  void* wipe_prev = mm_realloc(wipe_blocks[6], 1500);  // Slides into [5]
+  assert(wipe_prev != NULL && wipe_prev != wipe_blocks[6]);
+  assert(mm_read(wipe_prev, 0, wipe_buf, 1000) == 1000);
+  assert(memcmp(wipe_buf, wipe_data, 1000) == 0);
+  assert(mm_read(wipe_next, 0, wipe_buf, 1000) == 1000);
+  assert(memcmp(wipe_buf, wipe_data, 1000) == 0);
+  assert(mm_scrub(131072 * 2) == 0);  // No false alarms from queued spans
+  assert(mm_heap_stats().pending_wipe_bytes == 0 && mm_verify_free() == 0);
+  // Corruption outside the queued spans is still found, at any offset
+  mm_free(wipe_again);
+  assert(mm_wipe_flush() > 0 && mm_heap_stats().pending_wipe_bytes == 0);
+  ((uint8_t*)wipe_again)[987] ^= 0x01;
+  assert(mm_verify_free() == 1);
+  // More separate spans than the queue holds: the rest are wiped at once
+  patternHeap(wipe_heap, 131072, CUSTOM_PATTERN);
+  assert(mm_init(wipe_heap, 131072) == 0);
+  void* wipe_many[2 * WIPE_SPANS + 8];
+  for (size_t i = 0; i < 2 * WIPE_SPANS + 8; i++) {
+    wipe_many[i] = mm_malloc(600);
+    assert(wipe_many[i] != NULL);
+    assert(mm_write(wipe_many[i], 0, wipe_data, 600) == 600);
+  }
+  for (size_t i = 0; i < 2 * WIPE_SPANS + 8; i += 2) {
+    mm_free(wipe_many[i]);
+  }
+  size_t wipe_pending = mm_heap_stats().pending_wipe_bytes;
+  assert(wipe_pending > 0 && wipe_pending < (WIPE_SPANS + 4) * 600);
+  assert(mm_scrub(131072 * 2) == 0 && mm_verify_free() == 0);
+  assert(mm_wipe_mode(MM_WIPE_EAGER) == 0);
+  printf("%zu bytes were pending with %d spans\n", wipe_pending, WIPE_SPANS);
+  free(wipe_heap);
+  printf("Test 31 passed.\n");
   printf("All tests passed successfully!\n");
   return 0;
 }
@@ -0,0 +1,250 @@
+#include "scrub.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "slab.h"
+#include "stats.h"
+#include "tcache.h"
+#include "wipe.h"
+
+#ifdef MM_THREADS
+#include <pthread.h>
+static pthread_t g_scrub_thread;
+static int g_scrub_running;  // 1 while the thread should go on
+static size_t g_scrub_budget;
+static unsigned g_scrub_period;
+#endif
+
+static size_t g_scrub_arena;  // Spread arena the next mm_scrub starts in
+
+void scrubReset(void) { memset(&g_arena->scrub, 0, sizeof(g_arena->scrub)); }
+
+// A block at a position nothing vouches for (a saved cursor, a resync):
+// blockAt has to find one and its checksum has to match
+static header* scrubFind(uint8_t* start, uint8_t** end, int* is_free) {
+  header* h = blockAt(start, end, is_free);
+  if (h == NULL || h->status == 2 ||
+      (checkSumCalc(h) != h->checksum && headerRepair(h) != 0)) {
+    return NULL;
+  }
+  return h;
+}
+
+// A block starts at start: blockAt, and if a flipped header bit hides it,
+// the header of a free block (at start) or an allocated one (after the
+// padding) corrected first
+static header* scrubAt(uint8_t* start, uint8_t** end, int* is_free) {
+  header* h = blockAt(start, end, is_free);
+  if (h == NULL && (headerRepair((header*)start) == 0 ||
+                    headerRepair((header*)(start + paddingCalc(
+                                              (header*)start))) == 0)) {
+    h = blockAt(start, end, is_free);
+  }
+  return h;
+}
+
+// Moves *start to the next position scrubFind accepts, looking at up to
+// budget bytes (or to the end of the heap). Returns the bytes passed over
+static size_t scrubResync(uint8_t** start, size_t budget) {
+  uint8_t* heap_end = g_arena->heap + g_arena->heap_size;
+  uint8_t* p = *start + 1;
+  uint8_t* end;
+  int is_free;
+  while (p < heap_end && (size_t)(p - *start) < budget &&
+         scrubFind(p, &end, &is_free) == NULL) {
+    p++;
+  }
+  size_t skipped = (size_t)(p - *start);
+  *start = p;
+  return skipped;
+}
+
+static int scrubLeased(uint8_t* start, uint8_t* end) {  // Read/write leases
+  for (size_t i = 0; g_arena->lease_count > 0 && i < MAX_LEASES; i++) {
+    lease* l = &g_arena->leases[i];
+    if (l->hdr != NULL && l->mode == LEASE_RW && (uint8_t*)l->hdr >= start &&
+        (uint8_t*)l->hdr < end) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Verifies the block at start from done bytes in on, about budget bytes of
+// it. Returns how far it got (> 0), *bad = 1 if the block is corrupted
+static size_t scrubBlock(header* h, uint8_t* start, uint8_t* end, int is_free,
+                         size_t done, size_t budget, int* bad) {
+  size_t len = (size_t)(end - start);
+  *bad = 0;
+  if (h->status == 2) {
+    return len - done;  // Already quarantined
+  }
+  if (done == 0) {
+    headerRepair(h);  // Flips of the code itself too, no checksum sees those
+  }
+  if (is_free) {
+    size_t body = sizeof(header) + sizeof(freeBlock);  // Pattern from here
+    if (done == 0) {
+      freeBlock* fb = (freeBlock*)payloadFinder(h);
+      *bad = fb->hdr != h || checkBlock(h) != 0 ||
+             !freeTagsMatch(h, footerFinder(h));
+      return *bad ? len : body;
+    }
+    size_t rest = len - sizeof(footer) - done;
+    size_t n = rest < budget ? rest : budget;
+    wipeFlush(start + done, start + done + n);  // Deferred wipes in it first
+    *bad = checkPattern(start + done, n);
+    return n == rest ? n + sizeof(footer) : n;  // The footer was checked
+  }
+  if (scrubLeased(start, end)) {
+    return len - done;  // Digests are stale until the lease is released
+  }
+  uint8_t* payload = payloadFinder(h);
+  size_t first = (size_t)(payload - start);  // Chunk 0 starts here
+  if (done == 0) {  // Header, and the payload or the digest table with it
+    *bad = checkSumCalc(h) != h->checksum ||
+           (digestBytes(h->size) > 0 && tableSumCalc(h) != digestGet(h, 0));
+    return *bad || digestBytes(h->size) == 0 ? len : first;
+  }
+  size_t chunk = (done - first) / PAYLOAD_CHUNK;
+  size_t n = 0;
+  while (chunk < chunkCount(h->size) && (n == 0 || n < budget)) {
+    if (chunkSumCalc(h, chunk) != digestGet(h, chunk + 1)) {
+      *bad = 1;
+      return len - done;
+    }
+    chunk++;
+    n += PAYLOAD_CHUNK;
+  }
+  return chunk == chunkCount(h->size) ? len - done : n;
+}
+
+static void scrubQuarantine(header* h, int is_free) {
+  if (is_free) {
+    statsCorruption(TRACE_VERIFY, h, h->size);
+    quaranFreeBlock(h);
+    return;
+  }
+  uint8_t* payload = payloadFinder(h);
+  slab* s = slabFind(payload);
+  if (s != NULL && (uint8_t*)s == payload) {
+    slabQuarantine(s);  // Same as a slab call running into it
+    return;
+  }
+  statsCorruption(TRACE_VERIFY, payload, h->size);
+  quaranBlock(h);
+}
+
+// Verifies about limit bytes of g_arena from its cursor on, with the lock
+// held. Returns the bytes covered, adds the blocks quarantined to *found
+static size_t scrubSlice(size_t limit, size_t* found) {
+  MM_LOCKED();
+  scrubCursor* c = &g_arena->scrub;
+  uint8_t* heap_end = g_arena->heap + g_arena->heap_size;
+  size_t covered = 0;
+  int trusted = c->block == 0 && c->done == 0;  // The heap starts a block
+  while (g_arena->heap != NULL && covered < limit) {
+    uint8_t* start = g_arena->heap + c->block;
+    if (start >= heap_end) {  // Pass complete, start over
+      c->block = c->done = 0;
+      c->passes++;
+      trusted = 1;
+      continue;
+    }
+    uint8_t* end;
+    int is_free;
+    header* h = trusted ? scrubAt(start, &end, &is_free)
+                        : scrubFind(start, &end, &is_free);
+    if (h == NULL) {
+      if (trusted) {  // A block must start here but nothing plausible does
+        statsCorruption(TRACE_VERIFY, start, 0);
+      }
+      size_t skipped = scrubResync(&start, limit - covered);
+      c->block = (size_t)(start - g_arena->heap);
+      c->done = 0;
+      c->lost += skipped;
+      covered += skipped;
+      trusted = 0;
+      continue;
+    }
+    if (c->done >= (size_t)(end - start)) {
+      c->done = 0;  // A shorter block took the place of the saved one
+    }
+    int bad;
+    size_t step =
+        scrubBlock(h, start, end, is_free, c->done, limit - covered, &bad);
+    covered += step;
+    c->done += step;
+    if (bad) {
+      scrubQuarantine(h, is_free);
+      (*found)++;
+    }
+    if (start + c->done >= end) {  // Next block, trusted if this one checked
+      trusted = !bad && h->status != 2;
+      c->block = (size_t)(end - g_arena->heap);
+      c->done = 0;
+    }
+  }
+  c->bytes += covered;
+  return covered;
+}
+
+size_t mm_scrub(size_t budget_bytes) {
+  size_t found = 0;
+  size_t count = g_arena_count > 0 ? g_arena_count : 1;
+  size_t i = __atomic_fetch_add(&g_scrub_arena, 1, __ATOMIC_RELAXED) % count;
+  mm_arena_t* prev = arenaEnter(&g_arenas[i]);
+  while (budget_bytes > 0) {
+    size_t slice = budget_bytes < SCRUB_SLICE ? budget_bytes : SCRUB_SLICE;
+    size_t covered = scrubSlice(slice, &found);
+    budget_bytes -= covered < budget_bytes ? covered : budget_bytes;
+    if (covered == 0) {
+      break;  // No heap
+    }
+  }
+  arenaEnter(prev);
+  return found;
+}
+
+#ifdef MM_THREADS
+static void* scrubThread(void* arg) {
+  (void)arg;
+  struct timespec period = {g_scrub_period / 1000,
+                            (long)(g_scrub_period % 1000) * 1000000};
+  while (__atomic_load_n(&g_scrub_running, __ATOMIC_ACQUIRE)) {
+    mm_scrub(g_scrub_budget);
+    nanosleep(&period, NULL);
+  }
+  return NULL;
+}
+#endif
+
+int mm_scrub_start(size_t budget_bytes, unsigned period_ms) {
+#ifdef MM_THREADS
+  if (budget_bytes == 0 ||
+      __atomic_exchange_n(&g_scrub_running, 1, __ATOMIC_ACQ_REL)) {
+    return -1;  // Failure
+  }
+  g_scrub_budget = budget_bytes;
+  g_scrub_period = period_ms;
+  if (pthread_create(&g_scrub_thread, NULL, scrubThread, NULL) != 0) {
+    __atomic_store_n(&g_scrub_running, 0, __ATOMIC_RELEASE);
+    return -1;  // Failure
+  }
+  return 0;  // Success
+#else
+  (void)budget_bytes;
+  (void)period_ms;
+  return -1;  // Failure, nothing else would run meanwhile
+#endif
+}
+
+void mm_scrub_stop(void) {
+#ifdef MM_THREADS
+  if (__atomic_exchange_n(&g_scrub_running, 0, __ATOMIC_ACQ_REL)) {
+    pthread_join(g_scrub_thread, NULL);
+  }
+#endif
+}
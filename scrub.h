@@ -0,0 +1,38 @@
+#ifndef SCRUB_H
+#define SCRUB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Patrol scrubber: walks each arena's heap block by block (blockAt) from
+// where the last step stopped, verifying headers, digest tables, payload
+// chunks, free blocks' boundary tags and their unused pattern, and
+// quarantines what fails before a caller or searchBestFree runs into it.
+// A step covers about budget_bytes, under the arena's lock in slices of
+// SCRUB_SLICE bytes, and a big block is verified a few chunks (or pattern
+// bytes) at a time across steps, so no single call pauses the allocator for
+// long. Blocks with a read/write lease are skipped (their digests are stale
+// until the release). The heap changes between steps, so a saved position is
+// only used again if a block with a valid checksum still starts there, else
+// the patrol resyncs on the next one.
+#define SCRUB_SLICE (64 * 1024)  // Bytes per lock hold
+
+typedef struct scrubCursor {  // Per arena (arena.h)
+  size_t block;               // Offset of the block the patrol is at
+  size_t done;                // Bytes of it already verified
+  size_t passes;              // Full sweeps of the heap
+  size_t bytes;               // Bytes verified or skipped, all passes
+  size_t lost;                // Bytes skipped to find a block again
+} scrubCursor;
+
+void scrubReset(void);  // arenaInit
+
+// Verifies about budget_bytes of the heap in the arenas mm_malloc uses,
+// continuing where the last call stopped. Returns the blocks it quarantined
+size_t mm_scrub(size_t budget_bytes);
+// Runs mm_scrub(budget_bytes) every period_ms on a background thread
+// (MM_THREADS builds only). 0 = Success, -1 = Failure (running, no threads)
+int mm_scrub_start(size_t budget_bytes, unsigned period_ms);
+void mm_scrub_stop(void);  // Waits for the thread's current step
+
+#endif
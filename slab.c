@@ -0,0 +1,536 @@
+#include "slab.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "tcache.h"
+#include "trace.h"
+
+int g_slab_enabled = 1;
+
+static const uint16_t slabSizes[SLAB_CLASSES] = {40,  80,  120, 160,
+                                                 240, 320, 400, 520};
+
+// The registry is read without the heap lock by slabLookupSlot, writers
+// make slabs.seq odd while they change it
+static void registryBegin(void) {
+  slabRegistry* r = &g_arena->slabs;
+  __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void registryEnd(void) {
+  slabRegistry* r = &g_arena->slabs;
+  __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+}
+
+void slabReset(void) {
+  registryBegin();
+  __atomic_store_n(&g_arena->slabs.count, 0, __ATOMIC_RELAXED);
+  registryEnd();
+  __atomic_add_fetch(&g_arena->slabs.epoch, 1, __ATOMIC_RELEASE);
+  for (size_t i = 0; i < SLAB_CLASSES; i++) {
+    g_arena->slabs.partial[i] = NULL;
+    g_arena->slabs.heap_live[i] = 0;
+    g_arena->slabs.warm[i] = 0;
+  }
+  memset(g_arena->slabs.rows, 0, sizeof(g_arena->slabs.rows));
+}
+
+int slabClass(size_t size) {
+  for (int i = 0; i < SLAB_CLASSES; i++) {
+    if (size <= slabSizes[i]) {
+      return size <= SLAB_MAX_SIZE ? i : -1;
+    }
+  }
+  return -1;
+}
+
+void slabHeapTally(size_t old_size, size_t new_size) {
+  slabRegistry* r = &g_arena->slabs;
+  int from = old_size > 0 ? slabClass(old_size) : -1;
+  int to = new_size > 0 ? slabClass(new_size) : -1;
+  if (from >= 0 && r->heap_live[from] > 0) {
+    r->heap_live[from]--;
+  }
+  if (to >= 0 && ++r->heap_live[to] >= SLAB_WARMUP) {
+    r->warm[to] = 1;
+  }
+}
+
+header* slabBlock(slab* s) {
+  return (header*)((uint8_t*)s - sizeof(header));
+}
+
+// The slab struct is the first chunk(s) of its block, so this is the header
+// check plus one chunk, O(1)
+int slabCheck(slab* s) {
+  header* h = slabBlock(s);
+  if (!isAllocated(h) || checkHeader(h) != 0 ||
+      checkChunks(h, 0, sizeof(slab)) != 0) {
+    return 1;
+  }
+  int bad = s->size_class >= SLAB_CLASSES ||
+            s->slot_size != slabSizes[s->size_class] ||
+            s->used > s->slot_count ||
+            SLAB_HDR_BYTES + (size_t)s->slot_count * s->slot_size > h->size ||
+            s->row >= MAX_SLABS;
+  if (bad) {
+    quaranBlock(h);  // Digests match but the contents don't make sense
+    return 1;
+  }
+  return 0;
+}
+
+// Update a field of the slab struct (keeps the block's digests valid)
+void slabSet(slab* s, void* field, const void* value, size_t len) {
+  patchBlock(slabBlock(s), (uint8_t*)field - (uint8_t*)s, value, len);
+}
+
+// Set (in_use = 1) or clear a slot's bitmap bit and update the used count.
+// Both live in the slab struct, so it's a single patch from the bitmap word
+// up to the count
+void slabMark(slab* s, size_t index, int in_use) {
+  slab copy;
+  uint64_t* word = &s->bitmap[index / 64];
+  size_t from = (uint8_t*)word - (uint8_t*)s;
+  size_t to = offsetof(slab, used) + sizeof(s->used);
+  memcpy((uint8_t*)&copy + from, word, to - from);
+  uint64_t bit = (uint64_t)1 << (index % 64);
+  copy.bitmap[index / 64] = in_use ? *word | bit : *word & ~bit;
+  copy.used = in_use ? s->used + 1 : s->used - 1;
+  patchBlock(slabBlock(s), from, (uint8_t*)&copy + from, to - from);
+}
+
+// Registry lookup: the last slab starting at or before ptr
+slab* slabFind(const void* ptr) {
+  size_t lo = 0, hi = g_arena->slabs.count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if ((const uint8_t*)g_arena->slabs.list[mid] <= (const uint8_t*)ptr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) {
+    return NULL;
+  }
+  slab* s = g_arena->slabs.list[lo - 1];
+  return (const uint8_t*)ptr < (uint8_t*)s + SLAB_BYTES ? s : NULL;
+}
+
+static void registryInsert(slab* s) {
+  slabRegistry* r = &g_arena->slabs;
+  registryBegin();
+  size_t i = r->count;
+  while (i > 0 && r->list[i - 1] > s) {
+    __atomic_store_n(&r->list[i], r->list[i - 1], __ATOMIC_RELAXED);
+    i--;
+  }
+  __atomic_store_n(&r->list[i], s, __ATOMIC_RELAXED);
+  __atomic_store_n(&r->count, r->count + 1, __ATOMIC_RELAXED);
+  registryEnd();
+}
+
+static void registryRemove(slab* s) {
+  slabRegistry* r = &g_arena->slabs;
+  size_t i = 0;
+  while (i < r->count && r->list[i] != s) {
+    i++;
+  }
+  if (i == r->count) {
+    return;
+  }
+  registryBegin();
+  for (; i + 1 < r->count; i++) {
+    __atomic_store_n(&r->list[i], r->list[i + 1], __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&r->count, r->count - 1, __ATOMIC_RELAXED);
+  registryEnd();
+}
+
+// slabFind + slabSlotIndex without the heap lock (thread caches). Returns the
+// size class of the allocated slot starting at ptr (and where it is) or -1.
+// Slab fields that are read may be stale, the result only counts if
+// slabs.seq didn't move.
+int slabLookupSlot(const void* ptr, slab** slot_slab, size_t* slot_index) {
+  slabRegistry* r = &g_arena->slabs;
+  for (;;) {
+    unsigned seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      continue;  // Registry is being changed
+    }
+    int cls = -1;
+    size_t lo = 0, hi = __atomic_load_n(&r->count, __ATOMIC_RELAXED);
+    while (lo < hi && hi <= MAX_SLABS) {
+      size_t mid = (lo + hi) / 2;
+      slab* s = __atomic_load_n(&r->list[mid], __ATOMIC_RELAXED);
+      if ((const uint8_t*)s <= (const uint8_t*)ptr) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    slab* s = lo > 0 ? __atomic_load_n(&r->list[lo - 1], __ATOMIC_RELAXED)
+                     : NULL;
+    const uint8_t* first = s != NULL ? (uint8_t*)s + SLAB_HDR_BYTES : NULL;
+    size_t index = SLAB_MAX_SLOTS;
+    if (s != NULL && (const uint8_t*)ptr >= first &&
+        (const uint8_t*)ptr < (uint8_t*)s + SLAB_BYTES) {
+      size_t offset = (const uint8_t*)ptr - first;
+      size_t slot_size = __atomic_load_n(&s->slot_size, __ATOMIC_RELAXED);
+      index = slot_size != 0 ? offset / slot_size : SLAB_MAX_SLOTS;
+      if (index < SLAB_MAX_SLOTS && offset % slot_size == 0 &&
+          index < __atomic_load_n(&s->slot_count, __ATOMIC_RELAXED) &&
+          (__atomic_load_n(&s->bitmap[index / 64], __ATOMIC_RELAXED) &
+           ((uint64_t)1 << (index % 64)))) {
+        cls = __atomic_load_n(&s->size_class, __ATOMIC_RELAXED);
+      }
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&r->seq, __ATOMIC_RELAXED) == seq) {
+      if (cls >= 0) {
+        *slot_slab = s;
+        *slot_index = index;
+      }
+      return cls;
+    }
+  }
+}
+
+// The slab's slabSide, also without the lock (NULL if s is stale)
+static slabSide* slabSideOf(slab* s) {
+  uint16_t row = __atomic_load_n(&s->row, __ATOMIC_RELAXED);
+  return __atomic_load_n(&g_arena->slabs.side[row % MAX_SLABS],
+                         __ATOMIC_ACQUIRE);
+}
+
+#ifdef MM_THREADS
+int slabCacheMark(slab* s, size_t index, int cached) {
+  slabSide* side = slabSideOf(s);
+  if (side == NULL) {
+    return cached;  // Not a live slab, never cache it
+  }
+  uint64_t* word = &side->cached[index / 64];
+  uint64_t bit = (uint64_t)1 << (index % 64);
+  uint64_t old = cached ? __atomic_fetch_or(word, bit, __ATOMIC_ACQ_REL)
+                        : __atomic_fetch_and(word, ~bit, __ATOMIC_ACQ_REL);
+  return (old & bit) != 0;
+}
+
+static int slabCached(slab* s, size_t index) {
+  slabSide* side = slabSideOf(s);
+  if (side == NULL) {
+    return 0;
+  }
+  uint64_t word = __atomic_load_n(&side->cached[index / 64], __ATOMIC_ACQUIRE);
+  return (word >> (index % 64)) & 1;
+}
+#endif
+
+static int slabRegistered(slab* s) {
+  return s != NULL && slabFind(s) == s;
+}
+
+int slabSlotIndex(slab* s, const void* ptr) {
+  uint8_t* first = (uint8_t*)s + SLAB_HDR_BYTES;
+  if ((const uint8_t*)ptr < first) {
+    return -1;  // Points at the slab struct
+  }
+  size_t offset = (const uint8_t*)ptr - first;
+  size_t index = offset / s->slot_size;
+  if (offset % s->slot_size != 0 || index >= s->slot_count ||
+      !(s->bitmap[index / 64] & ((uint64_t)1 << (index % 64)))) {
+    return -1;  // Not the start of an allocated slot
+  }
+#ifdef MM_THREADS
+  if (slabCached(s, index)) {
+    return -1;  // Freed into a thread's cache
+  }
+#endif
+  return (int)index;
+}
+
+int slabCheckSlot(slab* s, const void* ptr) {
+  if (slabCheck(s) != 0 || slabSlotIndex(s, ptr) < 0) {
+    return 1;
+  }
+  return checkChunks(slabBlock(s), (const uint8_t*)ptr - (uint8_t*)s,
+                     s->slot_size);
+}
+
+// Slot contents changed behind patchBlock's back (read/write lease)
+void slabResealSlot(slab* s, const void* ptr) {
+  resealChunks(slabBlock(s), (const uint8_t*)ptr - (uint8_t*)s, s->slot_size);
+}
+
+// A new slab's row, its slabSide all clear. -1 if none is left (a
+// quarantined slab keeps its row until mm_init, its struct can't be trusted)
+// or the slabSide can't be allocated
+static int slabRowTake(void) {
+  slabRegistry* r = &g_arena->slabs;
+  for (size_t w = 0; w < MAX_SLABS / 64; w++) {
+    if (~r->rows[w] == 0) {
+      continue;
+    }
+    size_t row = w * 64 + (size_t)__builtin_ctzll(~r->rows[w]);
+    slabSide* side = r->side[row];
+    if (side == NULL) {  // First slab in this row, kept for the next ones
+      side = (slabSide*)calloc(1, sizeof(slabSide));
+      if (side == NULL) {
+        return -1;
+      }
+      __atomic_store_n(&r->side[row], side, __ATOMIC_RELEASE);
+    } else {
+      memset(side->slack, 0, sizeof(side->slack));
+#ifdef MM_THREADS
+      for (size_t i = 0; i < SLAB_BITMAP_WORDS; i++) {
+        __atomic_store_n(&side->cached[i], 0, __ATOMIC_RELAXED);
+      }
+#endif
+    }
+    r->rows[w] |= (uint64_t)1 << (row % 64);
+    return (int)row;
+  }
+  return -1;
+}
+
+static void slabRowGive(slab* s) {
+  slabRegistry* r = &g_arena->slabs;
+  r->rows[s->row / 64] &= ~((uint64_t)1 << (s->row % 64));
+}
+
+void slabSetSize(slab* s, size_t index, size_t size) {
+  slabSide* side = slabSideOf(s);
+  if (side != NULL) {
+    __atomic_store_n(&side->slack[index], (uint8_t)(s->slot_size - size),
+                     __ATOMIC_RELAXED);
+  }
+}
+
+size_t slabSize(slab* s, const void* ptr) {
+  int index = slabSlotIndex(s, ptr);
+  slabSide* side = slabSideOf(s);
+  if (index < 0 || side == NULL) {
+    return 0;
+  }
+  return s->slot_size - __atomic_load_n(&side->slack[index], __ATOMIC_RELAXED);
+}
+
+// Partial list, all links live inside (checked) slab blocks
+static void partialPush(slab* s) {
+  slab* head = g_arena->slabs.partial[s->size_class];
+  slab* none = NULL;
+  slabSet(s, &s->prev, &none, sizeof(none));
+  slabSet(s, &s->next, &head, sizeof(head));
+  if (head != NULL) {
+    slabSet(head, &head->prev, &s, sizeof(s));
+  }
+  g_arena->slabs.partial[s->size_class] = s;
+}
+
+static void partialRemove(slab* s) {
+  slab* next = s->next;
+  slab* prev = s->prev;
+  if (prev != NULL && slabRegistered(prev)) {
+    slabSet(prev, &prev->next, &next, sizeof(next));
+  } else if (g_arena->slabs.partial[s->size_class] == s) {
+    g_arena->slabs.partial[s->size_class] = slabRegistered(next) ? next : NULL;
+  }
+  if (next != NULL && slabRegistered(next)) {
+    slabSet(next, &next->prev, &prev, sizeof(prev));
+  }
+  slab* none = NULL;
+  slabSet(s, &s->next, &none, sizeof(none));
+  slabSet(s, &s->prev, &none, sizeof(none));
+}
+
+// After a corrupted slab the list can't be trusted, rebuild it from the
+// registry (only on that rare path)
+static void partialRebuild(int cls) {
+  g_arena->slabs.partial[cls] = NULL;
+  for (size_t i = 0; i < g_arena->slabs.count; i++) {
+    slab* s = g_arena->slabs.list[i];
+    if (s->size_class == cls && s->used < s->slot_count &&
+        slabCheck(s) == 0) {
+      partialPush(s);
+    }
+  }
+}
+
+// A corrupted slab is dropped from the registry with every object in it, the
+// block itself stays quarantined in the heap
+void slabQuarantine(slab* s) {
+  statsCorruption(TRACE_SLAB, s, SLAB_BYTES);
+  __atomic_add_fetch(&g_arena->slabs.quarantines, 1, __ATOMIC_RELEASE);
+  quaranBlock(slabBlock(s));
+  registryRemove(s);
+  for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+    slab* head = g_arena->slabs.partial[cls];
+    if (head == s || (head != NULL && !slabRegistered(head))) {
+      partialRebuild(cls);
+    }
+  }
+}
+
+// Whether a new slab of class cls may come out of the heap (slab.h)
+static int slabRoom(int cls) {
+  slabRegistry* r = &g_arena->slabs;
+  size_t quarter = g_arena->heap_size / 4;
+  return r->warm[cls] && r->count < MAX_SLABS &&
+         (r->count + 1) * SLAB_BYTES <= quarter &&
+         g_arena->stats.free_bytes >= SLAB_BYTES + quarter;
+}
+
+static slab* slabCreate(int cls) {
+  if (!slabRoom(cls)) {
+    return NULL;
+  }
+  slab* s = (slab*)heapMalloc(SLAB_BYTES);
+  if (s == NULL) {
+    return NULL;
+  }
+  int row = slabRowTake();
+  if (row < 0) {
+    heapFree(s);
+    return NULL;
+  }
+  memset(s, 0, sizeof(slab));
+  s->slot_size = slabSizes[cls];
+  s->slot_count = (SLAB_BYTES - SLAB_HDR_BYTES) / s->slot_size;
+  s->size_class = (uint8_t)cls;
+  s->row = (uint16_t)row;
+  patternFill((uint8_t*)s + sizeof(slab), SLAB_BYTES - sizeof(slab));
+  sealBlock(slabBlock(s));  // The only full pass over a slab
+  registryInsert(s);
+  partialPush(s);
+  return s;
+}
+
+void* slabMalloc(size_t size) {
+  int cls = slabClass(size);
+  if (cls < 0 || size == 0) {
+    return NULL;
+  }
+  slab* s = g_arena->slabs.partial[cls];
+  while (s != NULL && slabCheck(s) != 0) {
+    slabQuarantine(s);
+    s = g_arena->slabs.partial[cls];
+  }
+  if (s == NULL) {
+    s = slabCreate(cls);
+    if (s == NULL) {
+      return NULL;  // No room or still warming up, the caller uses the heap
+    }
+  }
+  // First clear bit of the occupancy bitmap
+  for (size_t w = 0; w < SLAB_BITMAP_WORDS; w++) {
+    uint64_t freeBits = ~s->bitmap[w];
+    if (freeBits == 0) {
+      continue;
+    }
+    size_t index = w * 64 + (size_t)__builtin_ctzll(freeBits);
+    if (index >= s->slot_count) {
+      break;
+    }
+    uint8_t* slot = (uint8_t*)s + SLAB_HDR_BYTES + index * s->slot_size;
+    if (checkChunks(slabBlock(s), slot - (uint8_t*)s, s->slot_size) != 0) {
+      slabQuarantine(s);  // Bit flip in free space
+      return slabMalloc(size);
+    }
+    slabMark(s, index, 1);
+    slabSetSize(s, index, size);
+    if (s->used == s->slot_count) {
+      partialRemove(s);  // Full
+    }
+    return slot;
+  }
+  // Listed as partial but has no free slot, the struct lied
+  slabQuarantine(s);
+  return slabMalloc(size);
+}
+
+int slabFree(slab* s, void* ptr) {
+  if (slabCheck(s) != 0) {
+    slabQuarantine(s);
+    return -1;
+  }
+  int index = slabSlotIndex(s, ptr);
+  if (index < 0) {
+    MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_NOT_ALLOCATED);
+    return -1;
+  }
+  size_t offset = (uint8_t*)ptr - (uint8_t*)s;
+  if (checkChunks(slabBlock(s), offset, s->slot_size) != 0) {
+    slabQuarantine(s);
+    return -1;
+  }
+  // Wipe the slot back to the unused pattern (through the digests)
+  uint8_t wipe[SLAB_MAX_SIZE + ALIGN];
+  patternWrite(wipe, (uint8_t*)ptr - g_arena->heap, s->slot_size);
+  patchBlock(slabBlock(s), offset, wipe, s->slot_size);
+  int wasFull = s->used == s->slot_count;
+  slabMark(s, index, 0);
+  if (wasFull) {
+    partialPush(s);
+  } else if (s->used == 0 && (s->prev != NULL || s->next != NULL)) {
+    // Empty and not the last slab of its class: give it back to the heap
+    partialRemove(s);
+    registryRemove(s);
+    slabRowGive(s);
+    heapFree(s);
+  }
+  return 0;
+}
+
+int slabRead(slab* s, void* ptr, size_t offset, void* buf, size_t len) {
+  if (slabCheck(s) != 0) {
+    slabQuarantine(s);
+    return -1;
+  }
+  size_t size = slabSize(s, ptr);
+  if (size == 0) {
+    MM_TRACE_ERROR(TRACE_READ, ptr, len, TRACE_INVALID_PTR);
+    return -1;
+  }
+  if (len == 0 || offset >= size) {
+    return 0;  // Nothing to read
+  }
+  size_t available = size - offset;
+  size_t to_read = (len < available) ? len : available;
+  size_t start = (uint8_t*)ptr + offset - (uint8_t*)s;
+  if (checkChunks(slabBlock(s), start, to_read) != 0) {
+    slabQuarantine(s);
+    return -1;
+  }
+  memcpy(buf, (uint8_t*)ptr + offset, to_read);
+  return to_read;
+}
+
+int slabWrite(slab* s, void* ptr, size_t offset, const void* src, size_t len) {
+  if (slabCheck(s) != 0) {
+    slabQuarantine(s);
+    return -1;
+  }
+  size_t size = slabSize(s, ptr);
+  if (size == 0) {
+    MM_TRACE_ERROR(TRACE_WRITE, ptr, len, TRACE_INVALID_PTR);
+    return -1;
+  }
+  if (len == 0 || offset >= size) {
+    return 0;  // Nothing to write
+  }
+  size_t available = size - offset;
+  size_t to_write = (len < available) ? len : available;
+  size_t start = (uint8_t*)ptr + offset - (uint8_t*)s;
+  if (checkChunks(slabBlock(s), start, to_write) != 0) {
+    slabQuarantine(s);
+    return -1;
+  }
+  patchBlock(slabBlock(s), start, src, to_write);
+  return to_write;
+}
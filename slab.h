@@ -0,0 +1,101 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+
+// Slab layer for small objects (<= SLAB_MAX_SIZE bytes).
+// A slab is one ordinary allocated block of SLAB_BYTES from the main heap:
+// [Slab struct][Slot 0][Slot 1]...[Slot N-1]
+// Slots are ALIGN sized multiples and start ALIGN aligned, so they need no
+// header or padding of their own. The slab struct and the slots are covered
+// by the block's chunk digests, every change goes through patchBlock so it
+// costs O(bytes changed). Free slots hold the unused pattern.
+// Each slab also owns a row of the registry, whose slabSide holds per-slot
+// state outside the digests, so a thread cache can update it without the
+// lock. It keeps every slot's requested size, and reads, writes, leases and
+// mm_usable_size stop there just as they do at a heap block's size. A row's
+// slabSide is allocated (calloc) the first time a slab takes the row and
+// kept for the next one, so there are only as many as slabs ever existed.
+// A class only gets its first slab once SLAB_WARMUP of its blocks are on the
+// heap at the same time, so a few small objects still reuse and coalesce
+// with the heap as before. Slabs never take more than a quarter of the heap
+// and a new one must leave another quarter free, else the heap serves it.
+#define SLAB_BYTES 8000  // Payload of a slab block (multiple of ALIGN)
+#define SLAB_MAX_SIZE 512
+#define SLAB_CLASSES 8
+#define SLAB_MAX_SLOTS (SLAB_BYTES / ALIGN)
+#define SLAB_BITMAP_WORDS ((SLAB_MAX_SLOTS + 63) / 64)
+#define MAX_SLABS 2048  // Registry size, small mallocs use the heap past this
+#define SLAB_WARMUP 8   // Live heap blocks of a class before it gets a slab
+
+typedef struct slab {
+  struct slab* next;  // Next slab of this class with free slots
+  struct slab* prev;
+  uint64_t bitmap[SLAB_BITMAP_WORDS];  // Bit set = slot in use
+  uint16_t slot_size;
+  uint16_t slot_count;
+  uint16_t used;
+  uint8_t size_class;
+  uint16_t row;  // Its row of slabs.side
+} slab;
+
+typedef struct slabSide {  // Per-slot state of a slab, outside the digests
+  uint8_t slack[SLAB_MAX_SLOTS];  // Slot size - requested size (< 256)
+#ifdef MM_THREADS
+  uint64_t cached[SLAB_BITMAP_WORDS];  // Bit set = slot is in a thread cache
+#endif
+} slabSide;
+
+// Slot 0 starts at the first ALIGN boundary after the slab struct
+#define SLAB_HDR_BYTES ((sizeof(slab) + ALIGN - 1) / ALIGN * ALIGN)
+
+typedef struct slabRegistry {  // Per arena (arena.h)
+  slab* list[MAX_SLABS];  // Every live slab, sorted by address
+  size_t count;
+  slab* partial[SLAB_CLASSES];  // Slabs with free slots
+  unsigned seq;                 // Odd while the registry changes
+  unsigned epoch;               // Bumped by slabReset (mm_init)
+  unsigned quarantines;         // Bumped by slabQuarantine
+  uint32_t heap_live[SLAB_CLASSES];  // Small blocks of each class on the heap
+  uint8_t warm[SLAB_CLASSES];        // Had SLAB_WARMUP of them at once
+  uint64_t rows[MAX_SLABS / 64];     // Bit set = row taken by a slab
+  slabSide* side[MAX_SLABS];         // Per row, NULL until first taken
+} slabRegistry;
+
+extern int g_slab_enabled;
+
+// Slab helpers
+void slabReset(void);
+int slabClass(size_t size);  // -1 if size is too big for a slab
+// A heap block's payload went from old_size to new_size bytes (0 = none)
+void slabHeapTally(size_t old_size, size_t new_size);
+header* slabBlock(slab* s);  // Heap block holding the slab
+int slabCheck(slab* s);      // 0 = Valid, 1 = Invalid
+void slabSet(slab* s, void* field, const void* value, size_t len);
+void slabMark(slab* s, size_t index, int in_use);
+slab* slabFind(const void* ptr);        // Slab that ptr points into, or NULL
+// Lock-free: class of the live slot at ptr (-1 if none) and where it is
+int slabLookupSlot(const void* ptr, slab** s, size_t* index);
+int slabSlotIndex(slab* s, const void* ptr);  // -1 if not an allocated slot
+int slabCheckSlot(slab* s, const void* ptr);  // 0 = Valid, 1 = Invalid
+void slabResealSlot(slab* s, const void* ptr);
+void slabQuarantine(slab* s);
+void slabSetSize(slab* s, size_t index, size_t size);  // Requested size
+size_t slabSize(slab* s, const void* ptr);  // 0 if not an allocated slot
+#ifdef MM_THREADS
+// Sets (cached = 1) or clears a slot's slabSide cached bit, lock-free. Returns
+// the bit's previous value, so of two threads caching the same slot only one
+// sees 0
+int slabCacheMark(slab* s, size_t index, int cached);
+#endif
+
+// Small object functions used by the mm_* API
+void* slabMalloc(size_t size);
+int slabFree(slab* s, void* ptr);  // 0 = Freed, -1 = Invalid/corrupted
+int slabRead(slab* s, void* ptr, size_t offset, void* buf, size_t len);
+int slabWrite(slab* s, void* ptr, size_t offset, const void* src, size_t len);
+
+#endif
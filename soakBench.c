@@ -0,0 +1,240 @@
+// soakBench.c
+// Fragmentation soak: millions of mm_malloc/mm_free calls on one fixed heap,
+// freed in random order, with the live set following ramp/plateau/drain
+// phases (10% of the heap up to 70%, held, back down, repeated). Sizes are
+// power-law (Pareto, alpha 1.2, 16 B - 64 KB) or bimodal (16-128 B and
+// 2-16 KB). Every --every calls it samples utilization (live payload / heap),
+// largest free block / free bytes, free blocks, blocks looked at per placement
+// search, failed mallocs and malloc/free latency percentiles of the window.
+// Usage: ./soak_bench [--ops n] [--heap bytes] [--dist powerlaw|bimodal|all]
+//                     [--policy name] [--every n] [--csv file]
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "allocator.h"
+
+#define OPS 10000000
+#define HEAP_SIZE (16 * 1024 * 1024)
+#define ROWS 40             // Default --every: the run in this many samples
+#define SLOTS (1 << 18)     // Live objects at most
+#define PHASE_OPS 1000000   // Ramp, plateau and drain take this long each
+#define MAX_SIZE 65536
+
+enum sizeDist { DIST_POWERLAW, DIST_BIMODAL, DISTS };
+static const char* const distNames[DISTS] = {"powerlaw", "bimodal"};
+
+typedef struct window {  // Latencies since the last sample, in ticks
+  uint64_t* malloc_ticks;
+  uint64_t* free_ticks;
+  size_t mallocs, frees, failed;
+} window;
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  return (uint64_t)ns_time();
+#endif
+}
+
+static double g_ns_per_tick = 1.0;
+
+static void calibrate(void) {
+  long long t0 = ns_time();
+  uint64_t c0 = ticks();
+  while (ns_time() - t0 < 50000000) {  // 50 ms
+  }
+  g_ns_per_tick = (double)(ns_time() - t0) / (double)(ticks() - c0);
+}
+
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+
+static inline uint64_t next(void) {  // xorshift64*
+  g_rng ^= g_rng >> 12;
+  g_rng ^= g_rng << 25;
+  g_rng ^= g_rng >> 27;
+  return g_rng * 0x2545F4914F6CDD1Dull;
+}
+
+static inline double uniform(void) {  // (0, 1]
+  return ((next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static size_t drawSize(int dist) {
+  if (dist == DIST_POWERLAW) {
+    double size = 16.0 / pow(uniform(), 1.0 / 1.2);
+    return size < MAX_SIZE ? (size_t)size : MAX_SIZE;
+  }
+  return next() % 10 < 7 ? 16 + next() % 113 : 2048 + next() % 14337;
+}
+
+// Live bytes the phase at call t aims for
+static size_t target(size_t t, size_t heap_size) {
+  double low = 0.10 * heap_size, high = 0.70 * heap_size;
+  size_t phase = t % (3 * PHASE_OPS);
+  if (phase < PHASE_OPS) {
+    return (size_t)(low + (high - low) * phase / PHASE_OPS);  // Ramp
+  } else if (phase < 2 * PHASE_OPS) {
+    return (size_t)high;  // Plateau
+  }
+  return (size_t)(high - (high - low) * (phase - 2 * PHASE_OPS) / PHASE_OPS);
+}
+
+static int compareTicks(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(uint64_t* samples, size_t n, double q) {
+  return n > 0 ? samples[(size_t)(q * (double)(n - 1))] * g_ns_per_tick : 0;
+}
+
+static void runSoak(int dist, size_t ops, size_t every, uint8_t* heap,
+                    size_t heap_size, const char* policy, FILE* csv) {
+  static void* live[SLOTS];
+  static size_t sizes[SLOTS];
+  memset(live, 0, sizeof(live));
+  uint8_t pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+  for (size_t i = 0; i < heap_size; i++) heap[i] = pattern[i % 5];
+  if ((policy != NULL ? mm_init_policy(heap, heap_size, policy)
+                      : mm_init(heap, heap_size)) != 0) {
+    printf("mm_init failed (heap %zu bytes, policy %s)\n", heap_size,
+           policy != NULL ? policy : "default");
+    exit(1);
+  }
+  window w = {malloc(every * sizeof(uint64_t)),
+              malloc(every * sizeof(uint64_t)), 0, 0, 0};
+  if (w.malloc_ticks == NULL || w.free_ticks == NULL) exit(1);
+  size_t live_bytes = 0;
+  size_t last_searches = 0;
+  double last_visits = 0;
+  double first_p50 = 0, first_search = 0;
+
+  printf("\n%s sizes, %zu calls, heap %zu\n", distNames[dist], ops,
+         heap_size);
+  printf("%10s %6s %7s %8s %7s %7s %9s %9s %9s %9s\n", "calls", "util",
+         "largest", "holes", "search", "failed", "malloc50", "malloc99",
+         "free50", "free99");
+  for (size_t t = 0; t < ops; t++) {
+    size_t k = next() % SLOTS;
+    size_t goal = target(t, heap_size);
+    if (live[k] != NULL) {
+      if (live_bytes > goal || next() % 4 == 0) {  // Churn on the plateau
+        uint64_t start = ticks();
+        mm_free(live[k]);
+        w.free_ticks[w.frees++] = ticks() - start;
+        live[k] = NULL;
+        live_bytes -= sizes[k];
+      }
+    } else if (live_bytes < goal) {
+      size_t size = drawSize(dist);
+      uint64_t start = ticks();
+      live[k] = mm_malloc(size);
+      w.malloc_ticks[w.mallocs++] = ticks() - start;
+      if (live[k] != NULL) {
+        sizes[k] = size;
+        live_bytes += size;
+      } else {
+        w.failed++;
+      }
+    }
+    if ((t + 1) % every != 0) {
+      continue;
+    }
+    heapStats st = mm_heap_stats();
+    double visits = st.avg_search * st.searches;
+    double search = st.searches > last_searches
+                        ? (visits - last_visits) / (st.searches - last_searches)
+                        : 0;
+    last_visits = visits;
+    last_searches = st.searches;
+    qsort(w.malloc_ticks, w.mallocs, sizeof(uint64_t), compareTicks);
+    qsort(w.free_ticks, w.frees, sizeof(uint64_t), compareTicks);
+    double m50 = percentile(w.malloc_ticks, w.mallocs, 0.5);
+    double m99 = percentile(w.malloc_ticks, w.mallocs, 0.99);
+    double f50 = percentile(w.free_ticks, w.frees, 0.5);
+    double f99 = percentile(w.free_ticks, w.frees, 0.99);
+    double util = (double)live_bytes / heap_size;
+    double largest =
+        st.free_bytes > 0 ? (double)st.largest_free / st.free_bytes : 0;
+    if (t + 1 == every) {
+      first_p50 = m50;
+      first_search = search;
+    }
+    printf("%10zu %6.3f %7.3f %8zu %7.2f %7zu %9.0f %9.0f %9.0f %9.0f\n",
+           t + 1, util, largest, st.free_blocks, search, w.failed, m50, m99,
+           f50, f99);
+    if (csv != NULL) {
+      fprintf(csv, "%s,%zu,%.4f,%.4f,%zu,%.3f,%zu,%.1f,%.1f,%.1f,%.1f\n",
+              distNames[dist], t + 1, util, largest, st.free_blocks, search,
+              w.failed, m50, m99, f50, f99);
+    }
+    if (t + 1 + every > ops) {
+      printf("first -> last window: malloc p50 %.0f -> %.0f ns, search "
+             "%.2f -> %.2f blocks\n", first_p50, m50, first_search, search);
+    }
+    w.mallocs = w.frees = w.failed = 0;
+  }
+  for (size_t k = 0; k < SLOTS; k++) {
+    mm_free(live[k]);
+  }
+  free(w.malloc_ticks);
+  free(w.free_ticks);
+}
+
+int main(int argc, char* argv[]) {
+  size_t ops = OPS;
+  size_t heap_size = HEAP_SIZE;
+  size_t every = 0;
+  const char* policy = NULL;
+  const char* csv_path = NULL;
+  int first = DIST_POWERLAW, last = DISTS - 1;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--ops") == 0) {
+      ops = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--heap") == 0) {
+      heap_size = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--every") == 0) {
+      every = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--policy") == 0) {
+      policy = argv[i + 1];
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      csv_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--dist") == 0) {
+      for (int d = 0; d < DISTS; d++) {
+        if (strcmp(argv[i + 1], distNames[d]) == 0) {
+          first = last = d;
+        }
+      }
+    }
+  }
+  if (every == 0) {
+    every = ops / ROWS > 0 ? ops / ROWS : 1;
+  }
+  uint8_t* heap = malloc(heap_size);
+  if (!heap || ops == 0) return 1;
+  FILE* csv = csv_path != NULL ? fopen(csv_path, "w") : NULL;
+  if (csv != NULL) {
+    fprintf(csv, "dist,calls,util,largest_ratio,free_blocks,avg_search,"
+                 "failed,malloc_p50_ns,malloc_p99_ns,free_p50_ns,"
+                 "free_p99_ns\n");
+  }
+  calibrate();
+  for (int d = first; d <= last; d++) {
+    runSoak(d, ops, every, heap, heap_size, policy, csv);
+  }
+  if (csv != NULL) {
+    fclose(csv);
+  }
+  free(heap);
+  return 0;
+}
@@ -0,0 +1,148 @@
+#include "stats.h"
+
+#include <string.h>
+
+#include "arena.h"
+#include "policy.h"
+#include "tcache.h"
+
+void statsReset(void) { memset(&g_arena->stats, 0, sizeof(g_arena->stats)); }
+
+static inline size_t statsBucket(size_t size) {
+  if (size < 64) {
+    return 0;
+  }
+  size_t bucket = 63 - __builtin_clzll(size) - 5;  // [64, 128) is 1
+  return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+void statsFreeCount(arenaStats* st, size_t size) {
+  st->free_bytes += size;
+  st->free_blocks++;
+  st->free_squares += (unsigned __int128)size * size;
+  st->free_hist[statsBucket(size)]++;
+}
+
+void statsFreeAdd(size_t size) { statsFreeCount(&g_arena->stats, size); }
+
+// Clamped: a corrupted size must not wrap the totals around
+void statsFreeRemove(size_t size) {
+  arenaStats* st = &g_arena->stats;
+  unsigned __int128 square = (unsigned __int128)size * size;
+  st->free_bytes -= size < st->free_bytes ? size : st->free_bytes;
+  st->free_blocks -= st->free_blocks > 0;
+  st->free_squares -= square < st->free_squares ? square : st->free_squares;
+  st->free_hist[statsBucket(size)] -= st->free_hist[statsBucket(size)] > 0;
+}
+
+size_t statsQuarantine(header* h) {
+  arenaStats* st = &g_arena->stats;
+  size_t size = h->status == 1 ? blockSize(h) : h->size;  // Free: whole block
+  if (size > g_arena->heap_size) {
+    size = 0;  // Corrupted size, the block is counted but not its bytes
+  }
+  if (h->status == 0) {
+    statsFreeRemove(size);
+  } else if (h->status == 1) {
+    st->payload_bytes -=
+        h->size < st->payload_bytes ? h->size : st->payload_bytes;
+  }
+  st->quarantined_blocks++;
+  st->quarantined_bytes += size;
+  return size;
+}
+
+void statsCorrected(void) { g_arena->stats.corrected_headers++; }
+
+// The policies count search_visits themselves, visits is this search's share
+void statsSearch(size_t visits) {
+  arenaStats* st = &g_arena->stats;
+  st->searches++;
+  if (visits > st->max_search) {
+    st->max_search = visits;
+  }
+}
+
+void statsCorruption(int path, const void* ptr, size_t size) {
+  g_arena->stats.checksum_failures[path]++;
+  MM_TRACE_ERROR(path, ptr, size, TRACE_CORRUPTED);
+}
+
+// Adds the current arena to a snapshot. free_squares goes into fragmentation
+// as a raw sum, mm_heap_stats turns it into the index once every arena is in
+static void statsAdd(heapStats* out, long double* squares, int largest) {
+  MM_LOCKED();
+  arenaStats* st = &g_arena->stats;
+  size_t taken = st->free_bytes + st->quarantined_bytes;
+  size_t in_use = g_arena->heap_size > taken ? g_arena->heap_size - taken : 0;
+  out->heap_bytes += g_arena->heap_size;
+  out->in_use_bytes += in_use;
+  out->payload_bytes += st->payload_bytes;
+  out->overhead_bytes +=
+      in_use > st->payload_bytes ? in_use - st->payload_bytes : 0;
+  out->free_bytes += st->free_bytes;
+  out->free_blocks += st->free_blocks;
+  if (largest && g_arena->heap != NULL) {
+    size_t size = policyActive()->largest();
+    if (size > out->largest_free) {
+      out->largest_free = size;
+    }
+  }
+  out->quarantined_blocks += st->quarantined_blocks;
+  out->quarantined_bytes += st->quarantined_bytes;
+  out->corrected_headers += st->corrected_headers;
+  out->recovered_blocks += st->recovered_blocks;
+  out->recovered_bytes += st->recovered_bytes;
+  out->searches += st->searches;
+  out->scrub_passes += g_arena->scrub.passes;
+  out->scrubbed_bytes += g_arena->scrub.bytes;
+  out->pending_wipe_bytes += g_arena->wipe.pending;
+  out->avg_search += st->search_visits;  // Total for now
+  if (st->max_search > out->max_search) {
+    out->max_search = st->max_search;
+  }
+  for (int i = 0; i < TRACE_PATHS; i++) {
+    out->checksum_failures[i] += st->checksum_failures[i];
+    out->ops[i] += __atomic_load_n(&st->ops[i], __ATOMIC_RELAXED);
+  }
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    out->free_hist[i] += st->free_hist[i];
+  }
+  *squares += (long double)st->free_squares;
+}
+
+static void statsFinish(heapStats* out, long double squares) {
+  long double free_bytes = out->free_bytes;
+  out->fragmentation =
+      out->free_bytes > 0
+          ? (double)(1.0L - squares / (free_bytes * free_bytes))
+          : 0.0;
+  out->avg_search = out->searches > 0 ? out->avg_search / out->searches : 0.0;
+}
+
+heapStats statsCollect(int largest) {
+  heapStats out;
+  memset(&out, 0, sizeof(out));
+  long double squares = 0;
+  for (size_t i = 0; i < g_arena_count; i++) {
+    mm_arena_t* prev = arenaEnter(&g_arenas[i]);
+    statsAdd(&out, &squares, largest);
+    arenaEnter(prev);
+  }
+  statsFinish(&out, squares);
+  return out;
+}
+
+// Usage, integrity and search statistics of the arenas mm_malloc uses
+heapStats mm_heap_stats(void) { return statsCollect(1); }
+
+heapStats mm_arena_stats(mm_arena_t* arena) {
+  heapStats out;
+  memset(&out, 0, sizeof(out));
+  long double squares = 0;
+  mm_arena_t* prev = arenaEnter(arena);
+  statsAdd(&out, &squares, 1);
+  arenaEnter(prev);
+  statsFinish(&out, squares);
+  return out;
+}
@@ -0,0 +1,54 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+#include "trace.h"
+
+// Counters behind mm_heap_stats, always on and kept per arena where blocks
+// change state (createFreeBlock, claimFreeBlock, quaranBlock, searchBestFree,
+// ...) under the arena's lock, so a snapshot is O(1) instead of a heap walk.
+// Fragmentation is 1 - sum(size^2) / sum(size)^2 over the free blocks: 0 for
+// a single free block, towards 1 as the free space splits into many small
+// ones. The sum of squares is updated with every free block that comes or
+// goes. Sizes read from corrupted headers can make the free space figures
+// drift, mm_verify_free (which walks the free blocks anyway) recounts them.
+typedef struct arenaStats {  // Per arena (arena.h)
+  size_t free_bytes;
+  size_t free_blocks;
+  unsigned __int128 free_squares;  // Sum of the free block sizes squared
+  size_t payload_bytes;            // Of allocated blocks (slabs count fully)
+  size_t quarantined_blocks;
+  size_t quarantined_bytes;
+  size_t corrected_headers;  // Single bit flips headerRepair corrected
+  size_t recovered_blocks;   // Quarantined blocks mm_reclaim freed
+  size_t recovered_bytes;
+  size_t searches;       // Placement searches (searchBestFree)
+  size_t search_visits;  // Free blocks they looked at
+  size_t max_search;
+  size_t checksum_failures[TRACE_PATHS];
+  size_t ops[TRACE_PATHS];  // Bumped without the lock, see MM_STAT_INC
+  size_t free_hist[STATS_BUCKETS];
+} arenaStats;
+
+// Counters the thread caches' lock-free paths also update
+#ifdef MM_THREADS
+#define MM_STAT_INC(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+#else
+#define MM_STAT_INC(counter) ((counter)++)
+#endif
+
+void statsReset(void);  // arenaInit
+void statsFreeAdd(size_t size);
+void statsFreeRemove(size_t size);
+void statsFreeCount(arenaStats* st, size_t size);  // statsFreeAdd into st
+size_t statsQuarantine(header* h);  // Before status 2, returns bytes counted
+void statsCorrected(void);        // A header corrected in place
+void statsSearch(size_t visits);
+void statsCorruption(int path, const void* ptr, size_t size);  // Also traced
+// mm_heap_stats, largest_free only if largest (a scan under list policies)
+heapStats statsCollect(int largest);
+
+#endif
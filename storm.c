@@ -0,0 +1,229 @@
+#include "storm.h"
+
+#include <math.h>
+#include <time.h>
+
+#include "tcache.h"
+
+int g_storm;
+
+static int g_storm_targets;      // 0 = Not started
+static double g_storm_rate;      // Flips per call
+static unsigned g_storm_epoch;   // Bumped by every start
+static uint64_t g_storm_rng;
+static int g_storm_busy;         // Lock of everything below
+static mm_storm_flip g_storm_log[STORM_LOG];
+static size_t g_storm_log_first;  // Oldest unread flip
+static size_t g_storm_log_count;
+static stormStats g_storm_stats;
+static MM_TLS int64_t g_storm_countdown;  // Calls to the next flip
+static MM_TLS unsigned g_storm_thread_epoch;
+
+typedef struct stormPick {  // Reservoir of one byte, weighted by length
+  uint64_t weight;          // Bytes offered so far
+  mm_storm_flip flip;
+} stormPick;
+
+static void stormLock(void) {
+  while (__atomic_exchange_n(&g_storm_busy, 1, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static void stormUnlock(void) {
+  __atomic_store_n(&g_storm_busy, 0, __ATOMIC_RELEASE);
+}
+
+static uint64_t stormNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t stormRandom(void) {  // xorshift64*, with the lock held
+  g_storm_rng ^= g_storm_rng >> 12;
+  g_storm_rng ^= g_storm_rng << 25;
+  g_storm_rng ^= g_storm_rng >> 27;
+  return g_storm_rng * 0x2545F4914F6CDD1Dull;
+}
+
+// Calls to the next flip: geometric with mean 1 / g_storm_rate
+static int64_t stormInterval(void) {
+  if (g_storm_rate >= 1.0) {
+    return 1;
+  }
+  double u = ((stormRandom() >> 11) + 1) * (1.0 / 9007199254740992.0);
+  return (int64_t)(log(u) / log(1.0 - g_storm_rate)) + 1;
+}
+
+static void stormOffer(stormPick* pick, uint8_t* start, size_t len,
+                       int target, uint8_t* block, uint8_t* block_end) {
+  if (len == 0 || (g_storm_targets & target) == 0) {
+    return;
+  }
+  pick->weight += len;
+  if (stormRandom() % pick->weight < len) {
+    pick->flip.addr = start + stormRandom() % len;
+    pick->flip.block = block;
+    pick->flip.block_end = block_end;
+    pick->flip.target = (uint8_t)target;
+  }
+}
+
+// Flips one bit of the targets in g_arena, with its lock and the storm lock
+// held. 0 = Success, -1 = Nothing to flip
+static int stormFlip(void) {
+  if (g_arena->heap == NULL) {
+    return -1;  // Failure
+  }
+  stormPick pick = {0, {NULL, NULL, NULL, 0, 0}};
+  uint8_t* heap_end = g_arena->heap + g_arena->heap_size;
+  uint8_t* start = g_arena->heap;
+  while (start < heap_end) {
+    uint8_t* end;
+    int is_free;
+    header* h = blockAt(start, &end, &is_free);
+    if (h == NULL) {
+      break;  // Lost the block boundaries
+    }
+    if (is_free) {
+      uint8_t* unused = payloadFinder(h) + sizeof(freeBlock);
+      stormOffer(&pick, start, sizeof(header), MM_STORM_HEADERS, start, end);
+      stormOffer(&pick, payloadFinder(h), sizeof(freeBlock),
+                 MM_STORM_FREE_LINKS, start, end);
+      stormOffer(&pick, unused, h->size - MIN_FREE_BLOCK, MM_STORM_PADDING,
+                 start, end);
+      stormOffer(&pick, end - sizeof(footer), sizeof(footer),
+                 MM_STORM_HEADERS, start, end);
+    } else {
+      uint8_t* payload = payloadFinder(h);
+      uint8_t* payload_end = payload + h->size + digestBytes(h->size);
+      stormOffer(&pick, start, (uint8_t*)h - start, MM_STORM_PADDING, start,
+                 end);
+      stormOffer(&pick, (uint8_t*)h, sizeof(header), MM_STORM_HEADERS, start,
+                 end);
+      stormOffer(&pick, payload, payload_end - payload, MM_STORM_PAYLOADS,
+                 start, end);
+      stormOffer(&pick, payload_end, end - payload_end, MM_STORM_PADDING,
+                 start, end);
+    }
+    start = end;
+  }
+  if (start < heap_end && g_storm_targets == MM_STORM_ALL) {
+    stormOffer(&pick, start, heap_end - start, MM_STORM_ALL, start,
+               heap_end);
+  }
+  if (pick.weight == 0) {
+    g_storm_stats.missed++;
+    return -1;  // Failure
+  }
+  pick.flip.bit = (uint8_t)(stormRandom() % 8);
+  *pick.flip.addr ^= (uint8_t)(1u << pick.flip.bit);
+  g_storm_stats.flips++;
+  if (g_storm_log_count == STORM_LOG) {  // Full, the oldest one goes
+    g_storm_log_first = (g_storm_log_first + 1) % STORM_LOG;
+    g_storm_log_count--;
+    g_storm_stats.dropped++;
+  }
+  g_storm_log[(g_storm_log_first + g_storm_log_count++) % STORM_LOG] =
+      pick.flip;
+  return 0;  // Success
+}
+
+// Up to flips bit flips in arena. Returns how many it made
+static size_t stormInject(mm_arena_t* arena, size_t flips) {
+  mm_arena_t* prev = arenaEnter(arena);
+  size_t done = 0;
+  {
+    MM_LOCKED();
+    stormLock();
+    uint64_t start = stormNow();
+    while (done < flips && g_storm_targets != 0 && stormFlip() == 0) {
+      done++;
+    }
+    g_storm_stats.inject_ns += stormNow() - start;
+    stormUnlock();
+  }
+  arenaEnter(prev);
+  return done;
+}
+
+void stormTick(mm_arena_t* arena) {
+  unsigned epoch = __atomic_load_n(&g_storm_epoch, __ATOMIC_RELAXED);
+  if (g_storm_thread_epoch != epoch) {  // First call since the start
+    g_storm_thread_epoch = epoch;
+    stormLock();
+    g_storm_countdown = stormInterval();
+    stormUnlock();
+  }
+  if (--g_storm_countdown > 0) {
+    return;
+  }
+  size_t flips = 1;
+  stormLock();
+  if (g_storm_rate >= 1.0) {  // Several per call
+    double whole = floor(g_storm_rate);
+    double fraction = g_storm_rate - whole;
+    flips = (size_t)whole + ((stormRandom() >> 11) * (1.0 / 9007199254740992.0)
+                             < fraction);
+  }
+  g_storm_countdown = stormInterval();
+  stormUnlock();
+  stormInject(arena, flips);
+}
+
+int mm_storm_start(double rate, int targets, uint64_t seed) {
+  if (rate < 0 || targets <= 0 || targets > MM_STORM_ALL) {
+    return -1;  // Failure
+  }
+  stormLock();
+  g_storm_rng = seed * 0x9E3779B97F4A7C15ull + 0x632BE59BD9B4E019ull;
+  g_storm_rng = g_storm_rng != 0 ? g_storm_rng : 1;
+  g_storm_targets = targets;
+  g_storm_rate = rate;
+  g_storm_log_first = g_storm_log_count = 0;
+  g_storm_stats = (stormStats){0, 0, 0, 0};
+  __atomic_add_fetch(&g_storm_epoch, 1, __ATOMIC_RELAXED);
+  stormUnlock();
+  __atomic_store_n(&g_storm, rate > 0, __ATOMIC_RELEASE);
+  return 0;  // Success
+}
+
+void mm_storm_stop(void) {
+  __atomic_store_n(&g_storm, 0, __ATOMIC_RELAXED);
+  stormLock();
+  g_storm_targets = 0;
+  stormUnlock();
+}
+
+size_t mm_storm_inject(size_t flips) {
+  size_t done = 0;
+  for (size_t i = 0; i < flips; i++) {
+    stormLock();
+    size_t arena = g_arena_count > 1 ? stormRandom() % g_arena_count : 0;
+    stormUnlock();
+    if (stormInject(&g_arenas[arena], 1) == 0) {
+      break;  // Not started, or nothing left to flip
+    }
+    done++;
+  }
+  return done;
+}
+
+size_t mm_storm_log(mm_storm_flip* out, size_t max) {
+  stormLock();
+  size_t n = g_storm_log_count < max ? g_storm_log_count : max;
+  for (size_t i = 0; i < n; i++) {
+    out[i] = g_storm_log[(g_storm_log_first + i) % STORM_LOG];
+  }
+  g_storm_log_first = (g_storm_log_first + n) % STORM_LOG;
+  g_storm_log_count -= n;
+  stormUnlock();
+  return n;
+}
+
+stormStats mm_storm_stats(void) {
+  stormLock();
+  stormStats st = g_storm_stats;
+  stormUnlock();
+  return st;
+}
@@ -0,0 +1,64 @@
+#ifndef STORM_H
+#define STORM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Storm fault injection, opt-in at run time (mm_storm_start). Flips random
+// bits in the heap of the arena a call used, about rate flips per mm_* call
+// (gaps are geometrically distributed), or on demand with mm_storm_inject.
+// Bits are picked uniformly among the bytes of the chosen targets, found by
+// walking the heap block by block (blockAt). Where the walk can't go on past
+// a corrupted block the rest of the heap only counts for MM_STORM_ALL.
+// The PRNG is seeded, so a single-threaded run flips the same bits every time.
+#define MM_STORM_HEADERS 1     // Headers and footers, free blocks' too
+#define MM_STORM_PAYLOADS 2    // Payloads and digest tables (slabs included)
+#define MM_STORM_FREE_LINKS 4  // freeBlock next/prev/hdr pointers
+#define MM_STORM_PADDING 8     // Alignment padding, slack, unused free space
+#define MM_STORM_ALL 15
+#define STORM_LOG 1024         // Flips kept until mm_storm_log reads them
+
+typedef struct mm_storm_flip {
+  uint8_t* addr;
+  uint8_t* block;  // Start of the block it hit (padding included)
+  uint8_t* block_end;
+  uint8_t bit;     // 0-7
+  uint8_t target;  // MM_STORM_*, MM_STORM_ALL past the end of the walk
+} mm_storm_flip;
+
+typedef struct stormStats {
+  size_t flips;
+  size_t missed;       // No byte of the targets left to flip
+  size_t dropped;      // Flips that fell out of the log unread
+  uint64_t inject_ns;  // Time spent walking and flipping
+} stormStats;
+
+extern int g_storm;  // 1 while a storm with a rate is on
+
+void stormTick(mm_arena_t* arena);  // Counts down the calls to the next flip
+
+#ifdef MM_THREADS
+#define MM_STORM_ON() __atomic_load_n(&g_storm, __ATOMIC_RELAXED)
+#else
+#define MM_STORM_ON() g_storm
+#endif
+#define MM_STORM_TICK(arena) \
+  do {                       \
+    if (MM_STORM_ON()) {     \
+      stormTick(arena);      \
+    }                        \
+  } while (0)
+
+// Seeds the PRNG and starts flipping bits of targets (MM_STORM_* flags) at
+// rate flips per call, 0 = only mm_storm_inject. 0 = Success
+int mm_storm_start(double rate, int targets, uint64_t seed);
+void mm_storm_stop(void);
+// Flips bits now in the arenas mm_malloc uses. Returns how many it flipped
+size_t mm_storm_inject(size_t flips);
+// Moves up to max of the flips since the last call to out, oldest first
+size_t mm_storm_log(mm_storm_flip* out, size_t max);
+stormStats mm_storm_stats(void);
+
+#endif
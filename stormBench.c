@@ -0,0 +1,211 @@
+// stormBench.c
+// Throughput and detection under storms: random mm_malloc/mm_write, mm_read
+// and mm_free calls on SLOTS objects of 16 B - 4 KB while storm.c flips bits
+// at each --rates level (flips per million calls), every level in a child
+// process so a crash only ends its own line. Every read is checked against
+// the data that was written:
+//   detected:    the read failed and a flip hit the object's block
+//   missed:      the read succeeded with wrong data (a false negative)
+//   false alarm: the read failed but no flip hit the block (a false positive,
+//                or damage spread from a flip elsewhere, e.g. a free link)
+// Capacity is the heap share not quarantined, sampled every --every calls
+// (the timeline) and at the end, fixed the header flips corrected in place
+// (ecc.h). Injection time isn't counted in Mops/s.
+// Usage: ./storm_bench [--ops n] [--heap bytes] [--seed n] [--every n]
+//                      [--rates r,r,...] [--targets all|headers|payloads|
+//                       links|padding]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "storm.h"
+
+#define OPS 1000000
+#define HEAP_SIZE (8 * 1024 * 1024)
+#define SLOTS 2048
+#define MAX_SIZE 4096
+#define MAX_RATES 16
+
+typedef struct stormObject {
+  uint8_t* ptr;
+  size_t size;
+  const uint8_t* data;  // What was written, in g_noise
+  int hit;  // A flip landed in its block since it was written
+} stormObject;
+
+typedef struct stormResult {
+  size_t reads, detected, missed, false_alarms;
+  size_t failed_mallocs;
+} stormResult;
+
+static const struct {
+  const char* name;
+  int targets;
+} targetNames[] = {{"all", MM_STORM_ALL},
+                   {"headers", MM_STORM_HEADERS},
+                   {"payloads", MM_STORM_PAYLOADS},
+                   {"links", MM_STORM_FREE_LINKS},
+                   {"padding", MM_STORM_PADDING}};
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint8_t g_noise[2 * MAX_SIZE];  // Object contents start anywhere in it
+
+// Marks the objects in the blocks of the flips since the last call
+static void markHits(stormObject* objects) {
+  mm_storm_flip flips[64];
+  size_t n;
+  while ((n = mm_storm_log(flips, 64)) > 0) {
+    for (size_t f = 0; f < n; f++) {
+      for (size_t k = 0; k < SLOTS; k++) {
+        objects[k].hit |= objects[k].ptr >= flips[f].block &&
+                          objects[k].ptr < flips[f].block_end;
+      }
+    }
+  }
+}
+
+static double capacity(size_t heap_size) {
+  heapStats st = mm_heap_stats();
+  return 1.0 - (double)st.quarantined_bytes / (double)heap_size;
+}
+
+// One storm level, in the child process
+static void runLevel(double rate, int targets, size_t ops, size_t every,
+                     uint64_t seed, uint8_t* heap, size_t heap_size) {
+  static stormObject objects[SLOTS];
+  static uint8_t buf[MAX_SIZE];
+  uint8_t pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+  for (size_t i = 0; i < heap_size; i++) heap[i] = pattern[i % 5];
+  if (mm_init(heap, heap_size) != 0 ||
+      mm_storm_start(rate / 1e6, targets, seed) != 0) {
+    printf("mm_init or mm_storm_start failed\n");
+    return;
+  }
+  stormResult r = {0, 0, 0, 0, 0};
+  srand((unsigned)seed);
+  long long t0 = ns_time();
+  for (size_t t = 0; t < ops; t++) {
+    stormObject* o = &objects[(size_t)rand() % SLOTS];
+    if (o->ptr == NULL) {
+      o->size = 16 + (size_t)rand() % (MAX_SIZE - 15);
+      o->ptr = mm_malloc(o->size);
+      if (o->ptr == NULL) {
+        r.failed_mallocs++;
+        continue;
+      }
+      o->data = g_noise + (size_t)rand() % MAX_SIZE;
+      o->hit = 0;
+      if (mm_write(o->ptr, 0, o->data, o->size) != (int)o->size) {
+        o->ptr = NULL;  // Landed on a flip already, leave it be
+      }
+    } else if (rand() % 2 == 0) {
+      int count = mm_read(o->ptr, 0, buf, o->size);
+      markHits(objects);
+      r.reads++;
+      if (count < 0) {
+        r.detected += o->hit;
+        r.false_alarms += !o->hit;
+        o->ptr = NULL;  // Quarantined
+      } else if (memcmp(buf, o->data, o->size) != 0) {
+        r.missed++;
+      }
+    } else {
+      mm_free(o->ptr);
+      o->ptr = NULL;
+    }
+    markHits(objects);
+    if (every > 0 && (t + 1) % every == 0) {
+      printf("  %10zu calls  capacity %6.2f%%  flips %zu\n", t + 1,
+             100.0 * capacity(heap_size), mm_storm_stats().flips);
+    }
+  }
+  long long elapsed = ns_time() - t0;
+  stormStats st = mm_storm_stats();
+  mm_storm_stop();
+  double busy = (double)(elapsed - (long long)st.inject_ns);
+  size_t bad = r.detected + r.missed;
+  printf("%9.0f %8zu %8.2f %8zu %8zu %8zu %8.2f%% %8.3f%% %8.3f%% %8.2f%% "
+         "%7zu %7zu\n", rate, st.flips, busy > 0 ? 1e3 * ops / busy : 0,
+         r.detected, r.missed, r.false_alarms,
+         bad > 0 ? 100.0 * r.detected / bad : 100.0,
+         r.reads > 0 ? 100.0 * r.missed / r.reads : 0,
+         r.reads > 0 ? 100.0 * r.false_alarms / r.reads : 0,
+         100.0 * capacity(heap_size), r.failed_mallocs,
+         mm_heap_stats().corrected_headers);
+}
+
+int main(int argc, char* argv[]) {
+  size_t ops = OPS;
+  size_t heap_size = HEAP_SIZE;
+  size_t every = 0;
+  uint64_t seed = 1;
+  int targets = MM_STORM_ALL;
+  double rates[MAX_RATES] = {0, 1, 10, 100, 1000};
+  size_t rate_count = 5;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--ops") == 0) {
+      ops = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--heap") == 0) {
+      heap_size = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      seed = (uint64_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--every") == 0) {
+      every = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--rates") == 0) {
+      rate_count = 0;
+      for (char* r = strtok(argv[i + 1], ","); r != NULL && rate_count <
+           MAX_RATES; r = strtok(NULL, ",")) {
+        rates[rate_count++] = atof(r);
+      }
+    } else if (strcmp(argv[i], "--targets") == 0) {
+      targets = 0;
+      for (size_t t = 0; t < sizeof(targetNames) / sizeof(targetNames[0]);
+           t++) {
+        if (strcmp(argv[i + 1], targetNames[t].name) == 0) {
+          targets = targetNames[t].targets;
+        }
+      }
+    }
+  }
+  for (size_t i = 0; i < sizeof(g_noise); i++) {
+    g_noise[i] = (uint8_t)rand();
+  }
+  uint8_t* heap = malloc(heap_size);
+  if (!heap || ops == 0 || targets == 0) {
+    printf("Usage: %s [--ops n] [--heap bytes] [--seed n] [--every n] "
+           "[--rates r,r,...] [--targets all|headers|payloads|links|"
+           "padding]\n", argv[0]);
+    return 1;
+  }
+
+  printf("\n%zu calls per level, %d objects, heap %zu, seed %llu\n", ops,
+         SLOTS, heap_size, (unsigned long long)seed);
+  printf("%9s %8s %8s %8s %8s %8s %9s %9s %9s %9s %7s %7s\n", "flips/M",
+         "flips", "Mops", "detected", "missed", "alarms", "detect", "FN", "FP",
+         "capacity", "nomem", "fixed");
+  for (size_t i = 0; i < rate_count; i++) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+      runLevel(rates[i], targets, ops, every, seed, heap, heap_size);
+      fflush(stdout);
+      _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (WIFSIGNALED(status)) {
+      printf("%9.0f crashed (signal %d)\n", rates[i], WTERMSIG(status));
+    }
+  }
+  free(heap);
+  return 0;
+}
@@ -0,0 +1,266 @@
+#include "tcache.h"
+
+#ifdef MM_THREADS
+
+#include <pthread.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "arena.h"
+#include "trace.h"
+
+static pthread_once_t g_tcache_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_tcache_key;  // Only used for its exit destructor
+static __thread tcache g_tcache;    // One per thread
+static __thread remoteFree g_remote[REMOTE_NODES];  // This thread's nodes
+static __thread size_t g_remote_next;               // Where the search starts
+
+static void tcacheExit(void* unused) {
+  (void)unused;
+  tcacheFlush();
+}
+
+static void tcacheInit(void) {
+  arenaLocksInit();
+  pthread_key_create(&g_tcache_key, tcacheExit);
+}
+
+mm_arena_t* heapLock(void) {
+  pthread_once(&g_tcache_once, tcacheInit);
+  pthread_mutex_lock(&g_arena->lock);
+  return g_arena;
+}
+
+void heapUnlock(void) { pthread_mutex_unlock(&g_arena->lock); }
+
+void heapUnlockAt(mm_arena_t** locked) {
+  pthread_mutex_unlock(&(*locked)->lock);
+}
+
+static int tcacheStale(tcache* c) {
+  slabRegistry* r = &c->arena->slabs;
+  return c->epoch != __atomic_load_n(&r->epoch, __ATOMIC_ACQUIRE) ||
+         c->quarantines != __atomic_load_n(&r->quarantines, __ATOMIC_ACQUIRE);
+}
+
+// Catch up with mm_init (slots belong to an old heap, forget them) or a slab
+// quarantine (drop the slots of slabs that are gone). Heap lock held.
+static void tcacheRevalidate(tcache* c) {
+  if (c->epoch != g_arena->slabs.epoch) {
+    memset(c->count, 0, sizeof(c->count));
+  } else {
+    for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+      size_t keep = 0;
+      for (size_t i = 0; i < c->count[cls]; i++) {
+        if (slabFind(c->slots[cls][i]) != NULL) {
+          c->slots[cls][keep++] = c->slots[cls][i];
+        }
+      }
+      c->count[cls] = (uint8_t)keep;
+    }
+  }
+  c->epoch = g_arena->slabs.epoch;
+  c->quarantines = g_arena->slabs.quarantines;
+}
+
+// Make sure tcacheExit runs when the thread exits
+static void tcacheRegister(tcache* c) {
+  if (!c->registered) {  // First use in this thread
+    pthread_once(&g_tcache_once, tcacheInit);
+    pthread_setspecific(g_tcache_key, c);
+    c->registered = 1;
+  }
+}
+
+// The calling thread's cache, bound to g_arena
+static tcache* tcacheGet(void) {
+  tcache* c = &g_tcache;
+  tcacheRegister(c);
+  if (c->arena != g_arena) {  // Moved to another arena, give the slots back
+    tcacheFlush();
+    c->arena = g_arena;
+    c->epoch = __atomic_load_n(&g_arena->slabs.epoch, __ATOMIC_ACQUIRE);
+    c->quarantines = g_arena->slabs.quarantines;
+  }
+  if (tcacheStale(c)) {
+    heapLock();
+    tcacheRevalidate(c);
+    heapUnlock();
+  }
+  return c;
+}
+
+// Sets or clears a slot's cached bit (slabSide), returns its previous value
+// (-1 if ptr isn't a live slot)
+static int tcacheMark(const void* ptr, int cached) {
+  slab* s;
+  size_t index;
+  if (slabLookupSlot(ptr, &s, &index) < 0) {
+    return -1;
+  }
+  return slabCacheMark(s, index, cached);
+}
+
+// Give the n oldest slots of a class back to their slabs
+static void tcacheDrain(tcache* c, int cls, size_t n) {
+  void* batch[TCACHE_SLOTS];
+  memcpy(batch, c->slots[cls], n * sizeof(void*));
+  memmove(c->slots[cls], c->slots[cls] + n,
+          (c->count[cls] - n) * sizeof(void*));
+  c->count[cls] -= (uint8_t)n;  // Out of the cache before slabFree checks
+  heapLock();
+  for (size_t i = 0; i < n; i++) {
+    slab* s = slabFind(batch[i]);
+    if (s != NULL) {  // Else its slab was quarantined meanwhile
+      tcacheMark(batch[i], 0);
+      slabFree(s, batch[i]);
+    }
+  }
+  heapUnlock();
+}
+
+void* tcacheMalloc(size_t size) {
+  int cls = slabClass(size);
+  if (cls < 0) {
+    return NULL;
+  }
+  tcache* c = tcacheGet();
+  if (c->count[cls] == 0) {  // Refill, lowest address on top
+    void* batch[TCACHE_BATCH];
+    size_t n = 0;
+    heapLock();
+    while (n < TCACHE_BATCH && (batch[n] = slabMalloc(size)) != NULL) {
+      tcacheMark(batch[n++], 1);
+    }
+    heapUnlock();
+    for (size_t i = 0; i < n; i++) {
+      c->slots[cls][n - 1 - i] = batch[i];
+    }
+    c->count[cls] = (uint8_t)n;
+    if (n == 0) {
+      return NULL;
+    }
+  }
+  void* slot = c->slots[cls][--c->count[cls]];
+  slab* s;
+  size_t index;
+  if (slabLookupSlot(slot, &s, &index) >= 0) {
+    slabSetSize(s, index, size);  // Seen by whoever sees the bit cleared
+    slabCacheMark(s, index, 0);
+  }
+  return slot;
+}
+
+int tcacheFree(void* ptr) {
+  if (__atomic_load_n(&g_arena->lease_count, __ATOMIC_RELAXED) != 0) {
+    return 0;  // Lease checks need the lock
+  }
+  slab* s;
+  size_t index;
+  int cls = slabLookupSlot(ptr, &s, &index);
+  if (cls < 0 || cls >= SLAB_CLASSES) {
+    return 0;  // Heap block or invalid, the slow path sorts it out
+  }
+  if (g_tcache.arena != NULL && g_tcache.arena != g_arena) {
+    return 0;  // Slot of another arena than the cached ones
+  }
+  tcache* c = tcacheGet();
+  if (slabCacheMark(s, index, 1) != 0) {  // Already in some thread's cache
+    MM_TRACE_ERROR(TRACE_FREE, ptr, 0, TRACE_NOT_ALLOCATED);
+    return 1;
+  }
+  if (c->count[cls] == TCACHE_SLOTS) {
+    tcacheDrain(c, cls, TCACHE_BATCH);
+  }
+  c->slots[cls][c->count[cls]++] = ptr;
+  return 1;
+}
+
+// Wait until none of this thread's nodes is queued anymore, by draining the
+// arenas that still hold one. Their memory goes away with the thread.
+static void remoteFlush(void) {
+  for (size_t i = 0; i < REMOTE_NODES; i++) {
+    if (__atomic_load_n(&g_remote[i].ptr, __ATOMIC_ACQUIRE) != NULL) {
+      mm_arena_t* prev = arenaEnter(g_remote[i].arena);
+      remoteDrain();
+      arenaEnter(prev);
+    }
+  }
+}
+
+void tcacheFlush(void) {
+  tcache* c = &g_tcache;
+  remoteFlush();
+  if (c->arena == NULL) {
+    return;  // Never used
+  }
+  mm_arena_t* prev = arenaEnter(c->arena);
+  heapLock();
+  if (c->epoch != g_arena->slabs.epoch) {
+    memset(c->count, 0, sizeof(c->count));  // Old heap
+  }
+  for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+    tcacheDrain(c, cls, c->count[cls]);
+  }
+  heapUnlock();
+  arenaEnter(prev);
+}
+
+int remotePush(void* ptr) {
+  mm_arena_t* home = arenaPick();
+  if (g_arena == home || g_arena < &g_arenas[0] ||
+      g_arena >= &g_arenas[g_arena_count] || !in_heap(ptr)) {
+    return 0;  // Own arena, a handle's or not a block of it: locked path
+  }
+  for (size_t i = 0; i < REMOTE_NODES; i++) {
+    remoteFree* n = &g_remote[(g_remote_next + i) % REMOTE_NODES];
+    if (__atomic_load_n(&n->ptr, __ATOMIC_ACQUIRE) != NULL) {
+      continue;  // Still queued
+    }
+    tcacheRegister(&g_tcache);
+    g_remote_next = (size_t)(n - g_remote) + 1;
+    n->ptr = ptr;
+    n->arena = g_arena;
+    n->next = __atomic_load_n(&g_arena->remote, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_arena->remote, &n->next, n, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    return 1;
+  }
+  return 0;  // Every node is queued, free it under the lock (which drains)
+}
+
+// Takes the whole stack, so the frees happen in one lock hold and in the
+// order they were pushed
+void remoteDrain(void) {
+  if (__atomic_load_n(&g_arena->remote, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+  MM_LOCKED();
+  remoteFree* n = __atomic_exchange_n(&g_arena->remote, NULL, __ATOMIC_ACQUIRE);
+  remoteFree* order = NULL;  // Reversed, oldest first
+  while (n != NULL) {
+    remoteFree* next = n->next;
+    n->next = order;
+    order = n;
+    n = next;
+  }
+  while (order != NULL) {
+    remoteFree* next = order->next;
+    void* ptr = order->ptr;
+    __atomic_store_n(&order->ptr, NULL, __ATOMIC_RELEASE);  // Node is free
+    arenaFreeLocked(ptr);
+    order = next;
+  }
+}
+
+void remoteDiscard(void) {
+  remoteFree* n = __atomic_exchange_n(&g_arena->remote, NULL, __ATOMIC_ACQUIRE);
+  while (n != NULL) {
+    remoteFree* next = n->next;
+    __atomic_store_n(&n->ptr, NULL, __ATOMIC_RELEASE);
+    n = next;
+  }
+}
+
+#endif
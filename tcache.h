@@ -0,0 +1,73 @@
+#ifndef TCACHE_H
+#define TCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "slab.h"
+
+// Thread-safe build (make THREADS=1, -DMM_THREADS).
+// Every mm_* function runs under its arena's (recursive) lock, except for
+// small objects: each thread keeps up to TCACHE_SLOTS freed slab slots per
+// class and malloc/free of those only touches the thread's own cache. The
+// cache is refilled from and drained to the slabs TCACHE_BATCH slots at a time
+// under the lock. Cached slots stay allocated in their slab (bitmap bit set,
+// digests valid), so the slabs' checksums never change without the lock.
+// Instead a slot's cached bit (slabSide, slab.h) says it's in a cache. A free
+// sets it with one atomic fetch-or, so when two threads free the same slot
+// only the first caches it and the other reports the double free.
+// A cache holds slots of one arena at a time, the one the thread last
+// allocated from.
+// Remote frees: with mm_init_arenas, a free into a spread arena that isn't the
+// thread's own doesn't take that arena's lock. It's pushed onto the arena's
+// remote stack with one CAS and the next malloc in that arena frees the whole
+// stack in one go under the lock. The nodes belong to the freeing thread, not
+// to the block, so a queued block isn't touched and its checksums stay valid
+// (corruption meanwhile is caught when it's really freed). ABA can't happen:
+// nothing is popped one by one, the drain takes the whole stack with one
+// exchange, and a node is only reused once the drain has handed it back.
+
+#define TCACHE_SLOTS 32
+#define TCACHE_BATCH 16  // Slots moved per refill/drain
+#define REMOTE_NODES 128  // Remote frees a thread can have queued at once
+
+#ifdef MM_THREADS
+
+typedef struct tcache {
+  mm_arena_t* arena;                        // Arena the slots belong to
+  void* slots[SLAB_CLASSES][TCACHE_SLOTS];  // LIFO per class
+  uint8_t count[SLAB_CLASSES];
+  unsigned epoch;        // slabs.epoch the slots belong to
+  unsigned quarantines;  // slabs.quarantines when the slots were checked
+  int registered;        // Flushed when the thread exits
+} tcache;
+
+typedef struct remoteFree {  // Queued free, node owned by the freeing thread
+  struct remoteFree* next;
+  void* ptr;          // NULL = node available
+  mm_arena_t* arena;  // Arena whose remote stack holds it
+} remoteFree;
+
+mm_arena_t* heapLock(void);  // Locks g_arena and returns it
+void heapUnlock(void);
+void heapUnlockAt(mm_arena_t** locked);  // Cleanup handler for MM_LOCKED
+
+// Holds the current arena's lock until the end of the enclosing block
+#define MM_LOCKED() \
+  mm_arena_t* mm_locked __attribute__((cleanup(heapUnlockAt))) = heapLock()
+
+void* tcacheMalloc(size_t size);            // NULL = use the heap
+int tcacheFree(void* ptr);                  // 1 = Handled, 0 = slow path
+void tcacheFlush(void);                     // Give every cached slot back
+
+int remotePush(void* ptr);  // 1 = Queued on g_arena's remote stack
+void remoteDrain(void);     // Free what's queued on g_arena (takes the lock)
+void remoteDiscard(void);   // Forget it, the blocks are gone (arenaInit)
+
+#else
+
+#define MM_LOCKED() ((void)0)
+
+#endif
+
+#endif
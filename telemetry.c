@@ -0,0 +1,140 @@
+#include "telemetry.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "stats.h"
+
+telemetrySegment* g_telemetry = NULL;
+static char g_telemetry_name[64];
+static int g_telemetry_busy;  // Held while publishing or closing
+static MM_TLS unsigned g_telemetry_countdown;
+
+static void telemetryLock(void) {
+  while (__atomic_exchange_n(&g_telemetry_busy, 1, __ATOMIC_ACQUIRE)) {
+  }
+}
+
+static void telemetryUnlock(void) {
+  __atomic_store_n(&g_telemetry_busy, 0, __ATOMIC_RELEASE);
+}
+
+static void telemetryWrite(telemetrySegment* seg) {
+  heapStats st = statsCollect(0);
+  telemetryCounters c;
+  c.heap_bytes = st.heap_bytes;
+  c.in_use_bytes = st.in_use_bytes;
+  c.payload_bytes = st.payload_bytes;
+  c.overhead_bytes = st.overhead_bytes;
+  c.free_bytes = st.free_bytes;
+  c.free_blocks = st.free_blocks;
+  c.quarantined_blocks = st.quarantined_blocks;
+  c.quarantined_bytes = st.quarantined_bytes;
+  c.fragmentation_ppm = (uint64_t)(st.fragmentation * 1e6);
+  c.avg_search_milli = (uint64_t)(st.avg_search * 1e3);
+  c.max_search = st.max_search;
+  c.searches = st.searches;
+  for (int i = 0; i < TRACE_PATHS; i++) {
+    c.checksum_failures[i] = st.checksum_failures[i];
+    c.ops[i] = st.ops[i];
+  }
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    c.free_hist[i] = st.free_hist[i];
+  }
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  // Sequence count: odd, counters, even again (release orders the counters
+  // before it, the fence keeps them after the odd one)
+  uint64_t seq = seg->seq;
+  __atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  uint64_t* dst = (uint64_t*)&seg->counters;
+  const uint64_t* src = (const uint64_t*)&c;
+  for (size_t i = 0; i < sizeof(c) / sizeof(uint64_t); i++) {
+    __atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&seg->updated_ns,
+                   (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec,
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&seg->updates, seg->updates + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void mm_telemetry_publish(void) {
+  telemetryLock();
+  telemetrySegment* seg = __atomic_load_n(&g_telemetry, __ATOMIC_RELAXED);
+  if (seg != NULL) {
+    telemetryWrite(seg);
+  }
+  telemetryUnlock();
+}
+
+void telemetryTick(void) {
+  if (g_telemetry_countdown-- > 0) {
+    return;
+  }
+  g_telemetry_countdown = TELEMETRY_PERIOD - 1;
+  // Another thread is on it: skip rather than wait on the hot path
+  if (!__atomic_exchange_n(&g_telemetry_busy, 1, __ATOMIC_ACQUIRE)) {
+    telemetrySegment* seg = __atomic_load_n(&g_telemetry, __ATOMIC_RELAXED);
+    if (seg != NULL) {
+      telemetryWrite(seg);
+    }
+    telemetryUnlock();
+  }
+}
+
+int mm_telemetry_open(const char* name) {
+  if (g_telemetry != NULL) {
+    return -1;  // Failure
+  }
+  if (name == NULL) {
+    snprintf(g_telemetry_name, sizeof(g_telemetry_name), "%s%d",
+             TELEMETRY_NAME, (int)getpid());
+  } else if (snprintf(g_telemetry_name, sizeof(g_telemetry_name), "%s",
+                      name) >= (int)sizeof(g_telemetry_name)) {
+    return -1;  // Failure
+  }
+  int fd = shm_open(g_telemetry_name, O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    return -1;  // Failure
+  }
+  if (ftruncate(fd, sizeof(telemetrySegment)) != 0) {
+    close(fd);
+    shm_unlink(g_telemetry_name);
+    return -1;  // Failure
+  }
+  telemetrySegment* seg =
+      (telemetrySegment*)mmap(NULL, sizeof(telemetrySegment),
+                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (seg == MAP_FAILED) {
+    shm_unlink(g_telemetry_name);
+    return -1;  // Failure
+  }
+  memset(seg, 0, sizeof(*seg));
+  seg->pid = (uint32_t)getpid();
+  seg->period = TELEMETRY_PERIOD;
+  seg->version = TELEMETRY_VERSION;
+  telemetryWrite(seg);
+  __atomic_store_n(&seg->magic, TELEMETRY_MAGIC, __ATOMIC_RELEASE);  // Ready
+  __atomic_store_n(&g_telemetry, seg, __ATOMIC_RELEASE);
+  return 0;  // Success
+}
+
+void mm_telemetry_close(void) {
+  telemetryLock();  // Waits out a publishing thread
+  telemetrySegment* seg = g_telemetry;
+  __atomic_store_n(&g_telemetry, NULL, __ATOMIC_RELAXED);
+  telemetryUnlock();
+  if (seg != NULL) {
+    munmap(seg, sizeof(*seg));
+    shm_unlink(g_telemetry_name);
+  }
+}
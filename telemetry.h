@@ -0,0 +1,73 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+
+// Live telemetry, opt-in at run time (mm_telemetry_open). The heap statistics
+// (mm_heap_stats) are published into a POSIX shared memory segment that
+// mm_top (telemetryTop.c) attaches to and shows while the process runs.
+// Every TELEMETRY_PERIOD mm_* calls a thread republishes them, with relaxed
+// atomic stores under a sequence count (odd while being written) so readers
+// can retry torn snapshots. Until the segment is open the calls pay one load
+// and branch; after that, a snapshot amortized over the period.
+#define TELEMETRY_PERIOD 4096  // mm_* calls per thread between updates
+#define TELEMETRY_MAGIC 0x4C544D4Du  // "MMTL"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_NAME "/mm_telemetry."  // Default name: this plus the pid
+
+typedef struct telemetryCounters {  // heapStats as 64-bit words
+  uint64_t heap_bytes;
+  uint64_t in_use_bytes;
+  uint64_t payload_bytes;
+  uint64_t overhead_bytes;
+  uint64_t free_bytes;
+  uint64_t free_blocks;
+  uint64_t quarantined_blocks;
+  uint64_t quarantined_bytes;
+  uint64_t fragmentation_ppm;  // Fragmentation index * 1e6
+  uint64_t avg_search_milli;   // Free blocks per placement search * 1000
+  uint64_t max_search;
+  uint64_t searches;
+  uint64_t checksum_failures[TRACE_PATHS];
+  uint64_t ops[TRACE_PATHS];
+  uint64_t free_hist[STATS_BUCKETS];
+} telemetryCounters;
+
+typedef struct telemetrySegment {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t pid;
+  uint32_t period;
+  uint64_t seq;         // Odd while the counters are being written
+  uint64_t updated_ns;  // CLOCK_MONOTONIC of the last update
+  uint64_t updates;
+  telemetryCounters counters;
+} telemetrySegment;
+
+extern telemetrySegment* g_telemetry;  // NULL unless a segment is open
+
+void telemetryTick(void);  // Counts down the calls until the next update
+
+#ifdef MM_THREADS
+#define MM_TELEMETRY_ON() \
+  (__atomic_load_n(&g_telemetry, __ATOMIC_RELAXED) != NULL)
+#else
+#define MM_TELEMETRY_ON() (g_telemetry != NULL)
+#endif
+#define MM_TELEMETRY_TICK()  \
+  do {                       \
+    if (MM_TELEMETRY_ON()) { \
+      telemetryTick();       \
+    }                        \
+  } while (0)
+
+// Creates the segment name (NULL = TELEMETRY_NAME<pid>) and starts publishing
+// into it. 0 = Success, -1 = Failure (already open, shm_open/mmap failed)
+int mm_telemetry_open(const char* name);
+void mm_telemetry_publish(void);  // Update now, e.g. from an idle loop
+void mm_telemetry_close(void);    // Stops publishing and unlinks the segment
+
+#endif
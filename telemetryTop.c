@@ -0,0 +1,146 @@
+// telemetryTop.c
+// Live view of a process's allocator (telemetry.h), refreshed like top:
+// heap usage, op rates, checksum failures and the free size histogram.
+// Usage: ./mm_top <pid | segment name> [-i interval ms] [-n refreshes]
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry.h"
+
+// Consistent copy of the counters, retried while the process writes them
+static int readSegment(const telemetrySegment* seg, telemetrySegment* out) {
+  for (int tries = 0; tries < 1000; tries++) {
+    uint64_t seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      continue;
+    }
+    const uint64_t* src = (const uint64_t*)seg;
+    uint64_t* dst = (uint64_t*)out;
+    for (size_t i = 0; i < sizeof(*out) / sizeof(uint64_t); i++) {
+      dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == seq) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static uint64_t nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void show(const telemetrySegment* s, const telemetrySegment* last,
+                 double seconds) {
+  const telemetryCounters* c = &s->counters;
+  printf("pid %u  updates %llu  last %.1f s ago  (every %u calls)\n", s->pid,
+         (unsigned long long)s->updates, (nowNs() - s->updated_ns) / 1e9,
+         s->period);
+  printf("heap %llu  in use %llu  payload %llu  overhead %llu\n",
+         (unsigned long long)c->heap_bytes, (unsigned long long)c->in_use_bytes,
+         (unsigned long long)c->payload_bytes,
+         (unsigned long long)c->overhead_bytes);
+  printf("free %llu in %llu blocks  fragmentation %.3f  quarantined %llu "
+         "(%llu bytes)\n",
+         (unsigned long long)c->free_bytes, (unsigned long long)c->free_blocks,
+         c->fragmentation_ppm / 1e6, (unsigned long long)c->quarantined_blocks,
+         (unsigned long long)c->quarantined_bytes);
+  printf("searches %llu  avg %.2f  max %llu blocks\n\n",
+         (unsigned long long)c->searches, c->avg_search_milli / 1e3,
+         (unsigned long long)c->max_search);
+  printf("%-10s %14s %12s %10s\n", "op", "calls", "per second", "corrupted");
+  for (int i = 0; i < TRACE_PATHS; i++) {
+    uint64_t delta = last != NULL ? c->ops[i] - last->counters.ops[i] : 0;
+    printf("%-10s %14llu %12.0f %10llu\n", traceOpName(i),
+           (unsigned long long)c->ops[i], seconds > 0 ? delta / seconds : 0.0,
+           (unsigned long long)c->checksum_failures[i]);
+  }
+  uint64_t most = 1;
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    most = c->free_hist[i] > most ? c->free_hist[i] : most;
+  }
+  printf("\nfree blocks by size\n");
+  for (int i = 0; i < STATS_BUCKETS; i++) {
+    char bar[41];
+    int len = (int)(c->free_hist[i] * 40 / most);
+    memset(bar, '#', len);
+    bar[len] = '\0';
+    printf("%s %8llu %10llu %s\n", i == STATS_BUCKETS - 1 ? ">=" : "< ",
+           i == STATS_BUCKETS - 1 ? 32ull << i : 64ull << i,
+           (unsigned long long)c->free_hist[i], bar);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    printf("Usage: %s <pid | segment name> [-i ms] [-n refreshes]\n",
+           argv[0]);
+    return 1;
+  }
+  char name[64];
+  if (argv[1][0] == '/') {
+    snprintf(name, sizeof(name), "%s", argv[1]);
+  } else {
+    snprintf(name, sizeof(name), "%s%s", TELEMETRY_NAME, argv[1]);
+  }
+  int interval_ms = 1000;
+  long refreshes = -1;  // Until the segment goes away
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "-i") == 0) {
+      interval_ms = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-n") == 0) {
+      refreshes = atol(argv[i + 1]);
+    }
+  }
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0) {
+    printf("No telemetry segment %s (mm_telemetry_open)\n", name);
+    return 1;
+  }
+  telemetrySegment* seg = (telemetrySegment*)mmap(
+      NULL, sizeof(telemetrySegment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (seg == MAP_FAILED ||
+      __atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != TELEMETRY_MAGIC ||
+      seg->version != TELEMETRY_VERSION) {
+    printf("Not a version %d telemetry segment: %s\n", TELEMETRY_VERSION,
+           name);
+    return 1;
+  }
+  int tty = isatty(STDOUT_FILENO);
+  telemetrySegment last, now;
+  int have_last = 0;
+  uint64_t last_ns = 0;
+  for (long n = 0; refreshes < 0 || n < refreshes; n++) {
+    if (n > 0) {
+      usleep((useconds_t)interval_ms * 1000);
+    }
+    if (kill((pid_t)seg->pid, 0) != 0 && refreshes < 0) {
+      printf("Process %u exited\n", seg->pid);
+      break;
+    }
+    if (readSegment(seg, &now) != 0) {
+      continue;  // Writer kept it busy, try again next time
+    }
+    uint64_t ns = nowNs();
+    if (tty) {
+      printf("\033[H\033[2J");  // Clear the screen
+    }
+    show(&now, have_last ? &last : NULL, have_last ? (ns - last_ns) / 1e9 : 0);
+    fflush(stdout);
+    last = now;
+    last_ns = ns;
+    have_last = 1;
+  }
+  munmap(seg, sizeof(*seg));
+  return 0;
+}
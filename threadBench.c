@@ -0,0 +1,202 @@
+// threadBench.c
+// Multithreaded scaling (MM_THREADS build): malloc + free throughput with 1, 2,
+// 4 ... --threads threads in three scenarios, each run on one shared arena
+// (mm_init), one arena per thread (mm_init_arenas) and the system malloc.
+//   local:  every thread keeps WINDOW live objects and replaces a random one
+//           per step, so most operations hit the thread's cache.
+//   larson: every thread replaces random objects in a slot array, and the
+//           arrays rotate to the next thread every round (Larson), so blocks
+//           are freed by other threads than the ones that allocated them.
+//   shared: all threads replace random objects in one pool, swapping them out
+//           atomically: frees from anywhere, contended pool cache lines.
+// Reports Mops/s (a malloc and a free are two ops) and speedup over 1 thread.
+// Usage: ./thread_bench [--threads n] [--ops n] [--csv file]
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocator.h"
+
+#define HEAP_SIZE (32 * 1024 * 1024)
+#define OPS 400000    // Default, malloc + free pairs per thread
+#define WINDOW 64
+#define MAX_THREADS 64
+#define SLOTS 1024    // Larson objects per thread
+#define ROUNDS 16     // Larson rotations
+#define POOL 4096     // Shared pool objects
+
+enum benchScenario { SCENARIO_LOCAL, SCENARIO_LARSON, SCENARIO_SHARED,
+                     SCENARIOS };
+static const char* const scenarioNames[SCENARIOS] = {"local", "larson",
+                                                     "shared"};
+
+typedef struct benchAllocator {
+  const char* name;
+  void* (*malloc)(size_t size);
+  void (*free)(void* ptr);
+  int arenas;  // mm_init_arenas with one arena per thread
+} benchAllocator;
+
+static const benchAllocator allocators[] = {
+    {"mm", mm_malloc, mm_free, 0},
+    {"mm-arenas", mm_malloc, mm_free, 1},
+    {"system", malloc, free, 0},
+};
+#define NALLOCATORS (sizeof(allocators) / sizeof(allocators[0]))
+
+typedef struct benchThread {
+  pthread_t thread;
+  unsigned seed;
+  int index;
+} benchThread;
+
+static const benchAllocator* g_alloc;
+static size_t g_ops, g_threads;
+static void* g_slots[MAX_THREADS][SLOTS];
+static void* g_pool[POOL];
+static pthread_barrier_t g_round;
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void* local(void* arg) {
+  benchThread* self = arg;
+  void* live[WINDOW] = {0};
+  for (size_t i = 0; i < g_ops; i++) {
+    size_t k = rand_r(&self->seed) % WINDOW;
+    g_alloc->free(live[k]);
+    live[k] = g_alloc->malloc(8 + rand_r(&self->seed) % 248);
+  }
+  for (size_t k = 0; k < WINDOW; k++) {
+    g_alloc->free(live[k]);
+  }
+  return NULL;
+}
+
+static void* larson(void* arg) {
+  benchThread* self = arg;
+  for (size_t round = 0; round < ROUNDS; round++) {
+    void** slots = g_slots[(self->index + round) % g_threads];
+    for (size_t i = 0; i < g_ops / ROUNDS; i++) {
+      size_t k = rand_r(&self->seed) % SLOTS;
+      g_alloc->free(slots[k]);
+      slots[k] = g_alloc->malloc(8 + rand_r(&self->seed) % 248);
+    }
+    pthread_barrier_wait(&g_round);  // Hand the array to the next thread
+  }
+  return NULL;
+}
+
+static void* shared(void* arg) {
+  benchThread* self = arg;
+  for (size_t i = 0; i < g_ops; i++) {
+    size_t k = rand_r(&self->seed) % POOL;
+    void* ptr = g_alloc->malloc(8 + rand_r(&self->seed) % 248);
+    g_alloc->free(__atomic_exchange_n(&g_pool[k], ptr, __ATOMIC_ACQ_REL));
+  }
+  return NULL;
+}
+
+static void* (*const scenarios[SCENARIOS])(void*) = {local, larson, shared};
+
+// Mops/s of one scenario with n threads
+static double run(int scenario, const benchAllocator* a, size_t n,
+                  uint8_t* heap) {
+  uint8_t pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+  if (a->malloc == mm_malloc) {
+    for (size_t i = 0; i < HEAP_SIZE; i++) heap[i] = pattern[i % 5];
+    if (a->arenas) {
+      mm_init_arenas(heap, HEAP_SIZE, n, MM_SPREAD_THREAD);
+    } else {
+      mm_init(heap, HEAP_SIZE);
+    }
+  }
+  g_alloc = a;
+  g_threads = n;
+  pthread_barrier_init(&g_round, NULL, (unsigned)n);
+  benchThread threads[MAX_THREADS];
+  long long t0 = ns_time();
+  for (size_t t = 0; t < n; t++) {
+    threads[t].seed = (unsigned)t + 1;
+    threads[t].index = (int)t;
+    pthread_create(&threads[t].thread, NULL, scenarios[scenario],
+                   &threads[t]);
+  }
+  for (size_t t = 0; t < n; t++) {
+    pthread_join(threads[t].thread, NULL);
+  }
+  long long t1 = ns_time();
+  pthread_barrier_destroy(&g_round);
+  for (size_t t = 0; t < n; t++) {  // Leftovers, not timed
+    for (size_t k = 0; k < SLOTS; k++) {
+      a->free(g_slots[t][k]);
+      g_slots[t][k] = NULL;
+    }
+  }
+  for (size_t k = 0; k < POOL; k++) {
+    a->free(g_pool[k]);
+    g_pool[k] = NULL;
+  }
+  return 2.0 * (double)(g_ops * n) / (double)(t1 - t0) * 1000.0;
+}
+
+int main(int argc, char* argv[]) {
+  size_t max_threads = 8;
+  const char* csv_path = NULL;
+  g_ops = OPS;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--threads") == 0) {
+      max_threads = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--ops") == 0) {
+      g_ops = (size_t)atol(argv[i + 1]);
+    } else if (strcmp(argv[i], "--csv") == 0) {
+      csv_path = argv[i + 1];
+    }
+  }
+  if (max_threads == 0 || max_threads > MAX_THREADS || g_ops < ROUNDS) {
+    printf("Usage: %s [--threads 1-%d] [--ops n >= %d] [--csv file]\n",
+           argv[0], MAX_THREADS, ROUNDS);
+    return 1;
+  }
+  uint8_t* heap = malloc(HEAP_SIZE);
+  if (!heap) return 1;
+  FILE* csv = csv_path != NULL ? fopen(csv_path, "w") : NULL;
+  if (csv != NULL) {
+    fprintf(csv, "scenario,allocator,threads,mops,speedup\n");
+  }
+
+  printf("\n%zu malloc + free pairs per thread, %ld cores\n", g_ops,
+         sysconf(_SC_NPROCESSORS_ONLN));
+  for (int s = 0; s < SCENARIOS; s++) {
+    printf("%-7s %-7s", scenarioNames[s], "threads");
+    for (size_t a = 0; a < NALLOCATORS; a++) {
+      printf(" %10s Mops %7s", allocators[a].name, "speedup");
+    }
+    printf("\n");
+    double base[NALLOCATORS];
+    for (size_t n = 1; n <= max_threads; n *= 2) {
+      printf("%-7s %-7zu", "", n);
+      for (size_t a = 0; a < NALLOCATORS; a++) {
+        double mops = run(s, &allocators[a], n, heap);
+        base[a] = n == 1 ? mops : base[a];
+        printf(" %15.2f %6.2fx", mops, mops / base[a]);
+        if (csv != NULL) {
+          fprintf(csv, "%s,%s,%zu,%.3f,%.3f\n", scenarioNames[s],
+                  allocators[a].name, n, mops, mops / base[a]);
+        }
+      }
+      printf("\n");
+    }
+  }
+  if (csv != NULL) {
+    fclose(csv);
+  }
+  free(heap);
+  return 0;
+}
@@ -0,0 +1,179 @@
+#include "tlsf.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+
+static size_t flsIndex(uint64_t x) {  // Index of the highest set bit
+  return 63 - (size_t)__builtin_clzll(x);
+}
+
+static size_t ffsIndex(uint64_t x) {  // Index of the lowest set bit
+  return (size_t)__builtin_ctzll(x);
+}
+
+void tlsfReset(void) {
+  for (size_t fl = 0; fl < TLSF_FL; fl++) {
+    for (size_t sl = 0; sl < TLSF_SL; sl++) {
+      g_arena->tlsf.bins[fl][sl] = NULL;
+    }
+    g_arena->tlsf.sl_bitmap[fl] = 0;
+  }
+  g_arena->tlsf.fl_bitmap = 0;
+}
+
+// Bin of a block of exactly size bytes
+void tlsfMapping(size_t size, size_t* fl, size_t* sl) {
+  if (size < TLSF_SL) {  // Never a real free block, keeps the shift valid
+    size = TLSF_SL;
+  }
+  *fl = flsIndex(size);
+  *sl = (size >> (*fl - TLSF_SL_BITS)) & (TLSF_SL - 1);
+}
+
+void tlsfInsert(header* freeHdr) {
+  size_t fl, sl;
+  tlsfMapping(freeHdr->size, &fl, &sl);
+  insert_free(&g_arena->tlsf.bins[fl][sl], (freeBlock*)payloadFinder(freeHdr));
+  g_arena->tlsf.sl_bitmap[fl] |= (uint32_t)1 << sl;
+  g_arena->tlsf.fl_bitmap |= (uint64_t)1 << fl;
+}
+
+// The bin is found from the size, but a corrupted size (quarantine) must not
+// make remove_free overwrite some other bin's head, so a list head that isn't
+// where its size says is looked up in every bin instead
+void tlsfRemove(header* freeHdr) {
+  freeBlock* fb = (freeBlock*)payloadFinder(freeHdr);
+  size_t fl, sl;
+  tlsfMapping(freeHdr->size, &fl, &sl);
+  freeBlock** head = &g_arena->tlsf.bins[fl][sl];
+  freeBlock* orphan = NULL;  // Stand-in head for a block that heads no bin
+  if (fb->prev == NULL && *head != fb) {
+    head = &orphan;
+    for (size_t i = 0; i < TLSF_FL && head == &orphan; i++) {
+      for (size_t j = 0; j < TLSF_SL; j++) {
+        if (g_arena->tlsf.bins[i][j] == fb) {
+          head = &g_arena->tlsf.bins[i][j];
+          fl = i;
+          sl = j;
+          break;
+        }
+      }
+    }
+  }
+  remove_free(head, fb);
+  if (head != &orphan && g_arena->tlsf.bins[fl][sl] == NULL) {
+    g_arena->tlsf.sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+    if (g_arena->tlsf.sl_bitmap[fl] == 0) {
+      g_arena->tlsf.fl_bitmap &= ~((uint64_t)1 << fl);
+    }
+  }
+}
+
+// Round size up to the next bin boundary, then take the first non-empty bin
+// at or above it. Every block in that bin is at least size bytes.
+header* tlsfFind(size_t size) {
+  if (size < TLSF_SL) {
+    size = TLSF_SL;
+  }
+  size_t round = ((size_t)1 << (flsIndex(size) - TLSF_SL_BITS)) - 1;
+  if (size > SIZE_MAX - round) {
+    return NULL;
+  }
+  size_t fl, sl;
+  tlsfMapping(size + round, &fl, &sl);
+  uint32_t sl_map = g_arena->tlsf.sl_bitmap[fl] & (~(uint32_t)0 << sl);
+  if (sl_map == 0) {  // Nothing left in this class, go to a bigger one
+    uint64_t fl_map = fl + 1 < TLSF_FL ? g_arena->tlsf.fl_bitmap &
+                                             (~(uint64_t)0 << (fl + 1))
+                                       : 0;
+    if (fl_map == 0) {
+      return NULL;  // No block big enough
+    }
+    fl = ffsIndex(fl_map);
+    sl_map = g_arena->tlsf.sl_bitmap[fl];
+  }
+  sl = ffsIndex(sl_map);
+  g_arena->stats.search_visits++;
+  return g_arena->tlsf.bins[fl][sl]->hdr;
+}
+
+// Blocks between min_size and max_size may or may not fit depending on their
+// alignment padding. Try a bounded number of them, from the smallest bin up.
+header* tlsfFindNear(size_t request, size_t min_size, size_t max_size) {
+  size_t fl, sl, last_fl, last_sl;
+  tlsfMapping(min_size, &fl, &sl);
+  tlsfMapping(max_size, &last_fl, &last_sl);
+  size_t tried = 0;
+  while (fl < last_fl || (fl == last_fl && sl <= last_sl)) {
+    for (freeBlock* curr = g_arena->tlsf.bins[fl][sl]; curr != NULL;
+         curr = curr->next) {
+      if (in_heap(curr) == 0) {
+        break;  // Broken link, malloc's checks will catch the block later
+      }
+      g_arena->stats.search_visits++;
+      if (curr->hdr->size >= fitSize(curr->hdr, request)) {
+        return curr->hdr;
+      }
+      if (++tried == TLSF_NEAR_FIT_SCAN) {
+        return NULL;
+      }
+    }
+    if (++sl == TLSF_SL) {
+      sl = 0;
+      fl++;
+    }
+  }
+  return NULL;
+}
+
+// Placement policy search. Padding depends on where the block starts, so ask
+// for the worst case (ALIGN - 1 bytes) and any block in the bin found fits
+header* tlsfSearch(size_t size_requested) {
+  size_t exact = sizeof(header) + size_requested + digestBytes(size_requested);
+  size_t worst = exact + ALIGN - 1;
+  if (exact < MIN_FREE_BLOCK) {
+    exact = MIN_FREE_BLOCK;
+  }
+  if (worst < MIN_FREE_BLOCK) {
+    worst = MIN_FREE_BLOCK;
+  }
+  header* found = tlsfFind(worst);
+  if (found == NULL) {
+    // Nearly full heap: a smaller block may still fit with less padding
+    found = tlsfFindNear(size_requested, exact, worst);
+  }
+  return found;
+}
+
+void tlsfForEach(freeVisitFn visit, void* ctx) {
+  for (size_t fl = 0; fl < TLSF_FL; fl++) {
+    for (size_t sl = 0; sl < TLSF_SL; sl++) {
+      freeBlock* curr = g_arena->tlsf.bins[fl][sl];
+      while (curr != NULL && in_heap(curr)) {
+        freeBlock* next = curr->next;  // visit may unlink curr
+        visit(freeHeaderOf(curr), ctx);
+        curr = next;
+      }
+    }
+  }
+}
+
+size_t tlsfLargest(void) {
+  uint64_t fl_map = g_arena->tlsf.fl_bitmap;
+  if (fl_map == 0) {
+    return 0;
+  }
+  size_t fl = flsIndex(fl_map);
+  size_t sl = flsIndex(g_arena->tlsf.sl_bitmap[fl]);
+  size_t largest = 0;
+  for (freeBlock* curr = g_arena->tlsf.bins[fl][sl];
+       curr != NULL && in_heap(curr); curr = curr->next) {
+    if (curr->hdr->size > largest) {
+      largest = curr->hdr->size;
+    }
+  }
+  return largest;
+}
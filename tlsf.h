@@ -0,0 +1,37 @@
+#ifndef TLSF_H
+#define TLSF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+#include "policy.h"
+
+// Two-Level Segregated Fit index over the free blocks.
+// First level: power of two size class (fl = floor(log2(size))).
+// Second level: TLSF_SL linear subdivisions of that class.
+// Each (fl, sl) bin is one of the doubly-linked free lists (insert_free /
+// remove_free), and two bitmaps track the non-empty bins so a search is a
+// couple of find-first-set operations, O(1) regardless of fragmentation.
+#define TLSF_SL_BITS 4
+#define TLSF_SL (1 << TLSF_SL_BITS)  // Second level bins per first level class
+#define TLSF_FL 64                   // One first level class per size_t bit
+#define TLSF_NEAR_FIT_SCAN 16        // Max blocks tried by tlsfFindNear
+
+typedef struct tlsfIndex {  // Per arena (arena.h)
+  freeBlockHeader* bins[TLSF_FL][TLSF_SL];  // Free list head of every bin
+  uint64_t fl_bitmap;           // Bit fl set = some bin in fl non-empty
+  uint32_t sl_bitmap[TLSF_FL];  // Bit sl set = bin (fl, sl) non-empty
+} tlsfIndex;
+
+void tlsfReset(void);
+void tlsfMapping(size_t size, size_t* fl, size_t* sl);
+void tlsfInsert(header* freeHdr);
+void tlsfRemove(header* freeHdr);
+header* tlsfFind(size_t size);  // Head of a bin where every block >= size
+header* tlsfFindNear(size_t request, size_t min_size, size_t max_size);
+header* tlsfSearch(size_t request);  // Placement policy entry point
+void tlsfForEach(freeVisitFn visit, void* ctx);
+size_t tlsfLargest(void);  // Scans only the highest non-empty bin
+
+#endif
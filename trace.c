@@ -0,0 +1,152 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+
+static const char* const opNames[TRACE_OPS] = {
+    "init",    "malloc",  "free",   "realloc", "read",       "write",
+    "acquire", "release", "verify", "slab",    "place",      "split",
+    "merge-next", "merge-prev", "wipe", "expand", "shrink"};
+
+static const char* const outcomeNames[TRACE_OUTCOMES] = {
+    "ok",        "invalid size", "invalid argument", "invalid pointer",
+    "not allocated", "corrupted", "leased", "not leased", "lease violated",
+    "no space",  "limit"};
+
+const char* traceOpName(int op) {
+  return op >= 0 && op < TRACE_OPS ? opNames[op] : "?";
+}
+
+const char* traceOutcomeName(int outcome) {
+  return outcome >= 0 && outcome < TRACE_OUTCOMES ? outcomeNames[outcome]
+                                                  : "?";
+}
+
+#if MM_TRACE >= 1
+
+typedef struct traceRing {
+  traceEvent events[TRACE_EVENTS];
+  uint64_t head;  // Events written so far, the next goes to head % size
+} traceRing;
+
+static traceRing g_trace_rings[TRACE_RINGS];
+static unsigned g_trace_ring_count;  // Rings handed out
+static MM_TLS traceRing* g_trace_ring;
+static MM_TLS int g_trace_untraced;  // Thread came after the last ring
+static MM_TLS uint8_t g_trace_outcome;  // First error of the current op
+
+static inline uint64_t traceCycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static traceRing* traceRingGet(void) {
+  if (g_trace_ring == NULL && !g_trace_untraced) {
+    unsigned n = __atomic_fetch_add(&g_trace_ring_count, 1, __ATOMIC_RELAXED);
+    if (n < TRACE_RINGS) {
+      g_trace_ring = &g_trace_rings[n];
+    } else {
+      g_trace_untraced = 1;
+    }
+  }
+  return g_trace_ring;
+}
+
+static void tracePut(int op, const void* ptr, size_t size, int outcome,
+                     uint64_t cycles, uint64_t elapsed) {
+  traceRing* r = traceRingGet();
+  if (r == NULL) {
+    return;
+  }
+  traceEvent* e = &r->events[r->head % TRACE_EVENTS];
+  e->cycles = cycles;
+  e->ptr = (uint64_t)(uintptr_t)ptr;
+  e->size = size;
+  e->elapsed = elapsed > UINT32_MAX ? UINT32_MAX : (uint32_t)elapsed;
+  e->op = (uint8_t)op;
+  e->outcome = (uint8_t)outcome;
+  e->thread = (uint16_t)(r - g_trace_rings);
+  __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);  // Publish
+}
+
+void traceRecord(int op, const void* ptr, size_t size, int outcome) {
+  if (outcome != TRACE_OK && g_trace_outcome == TRACE_OK) {
+    g_trace_outcome = (uint8_t)outcome;
+  }
+  tracePut(op, ptr, size, outcome, traceCycles(), 0);
+}
+
+uint64_t traceBegin(void) {
+  g_trace_outcome = TRACE_OK;
+  return traceCycles();
+}
+
+void traceEnd(int op, const void* ptr, size_t size, uint64_t start) {
+  uint64_t now = traceCycles();
+  tracePut(op, ptr, size, g_trace_outcome, start, now - start);
+  g_trace_outcome = TRACE_OK;
+}
+
+// The ring's events, oldest first. A ring that's being written meanwhile may
+// yield a torn newest event
+static size_t traceCopy(traceRing* r, traceEvent* out, size_t max) {
+  uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+  uint64_t count = head < TRACE_EVENTS ? head : TRACE_EVENTS;
+  if (count > max) {
+    count = max;  // The newest ones
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    out[i] = r->events[(head - count + i) % TRACE_EVENTS];
+  }
+  return (size_t)count;
+}
+
+size_t mm_trace_events(traceEvent* out, size_t max) {
+  traceRing* r = traceRingGet();
+  return r != NULL ? traceCopy(r, out, max) : 0;
+}
+
+int mm_trace_dump(const char* path) {
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) {
+    return -1;
+  }
+  unsigned rings = __atomic_load_n(&g_trace_ring_count, __ATOMIC_ACQUIRE);
+  if (rings > TRACE_RINGS) {
+    rings = TRACE_RINGS;
+  }
+  uint32_t header[4] = {TRACE_MAGIC, TRACE_VERSION, sizeof(traceEvent), rings};
+  int ok = fwrite(header, sizeof(header), 1, f) == 1;
+  static traceEvent events[TRACE_EVENTS];  // 128 KB, one dump at a time
+  for (unsigned i = 0; ok && i < rings; i++) {
+    uint32_t count = (uint32_t)traceCopy(&g_trace_rings[i], events,
+                                         TRACE_EVENTS);
+    uint32_t ring[2] = {i, count};
+    ok = fwrite(ring, sizeof(ring), 1, f) == 1 &&
+         fwrite(events, sizeof(traceEvent), count, f) == count;
+  }
+  return fclose(f) == 0 && ok ? 0 : -1;
+}
+
+#else
+
+size_t mm_trace_events(traceEvent* out, size_t max) {
+  (void)out;
+  (void)max;
+  return 0;  // Tracing compiled out
+}
+
+int mm_trace_dump(const char* path) {
+  (void)path;
+  return -1;  // Tracing compiled out
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Event tracing, levels picked at compile time (make TRACE_LEVEL=n, -DMM_TRACE)
+// 0: Off, every trace macro compiles to nothing (release builds)
+// 1: Errors (invalid pointers, double frees, corruption, ...)
+// 2: Plus one event per malloc/free/realloc/read/write with its duration
+// 3: Plus the steps inside them (placement, splits, merges, wipes, ...)
+// Events are fixed size and go into a per-thread ring buffer (no lock, the
+// ring has a single writer). mm_trace_dump writes every ring to a file that
+// trace_decode (traceDecode.c) turns into text.
+#ifndef MM_TRACE
+#define MM_TRACE 0
+#endif
+
+#define TRACE_EVENTS 4096  // Per ring, the oldest events are overwritten
+#define TRACE_RINGS 16     // Threads past this aren't traced
+
+#define TRACE_MAGIC 0x52544D4Du  // "MMTR"
+#define TRACE_VERSION 1
+
+enum traceOp {
+  TRACE_INIT,
+  TRACE_MALLOC,
+  TRACE_FREE,
+  TRACE_REALLOC,
+  TRACE_READ,
+  TRACE_WRITE,
+  TRACE_ACQUIRE,
+  TRACE_RELEASE,
+  TRACE_VERIFY,
+  TRACE_SLAB,        // Small object slab (slab.c)
+  // Up to here the ops are also the paths mm_heap_stats counts by
+  TRACE_PLACE,       // Block carved out of a free block (ptr = header)
+  TRACE_SPLIT,       // Rest of the free block split off (ptr = its start)
+  TRACE_MERGE_NEXT,  // Freed block merged with the free block after it
+  TRACE_MERGE_PREV,  // ... and with the one before it
+  TRACE_WIPE,        // Free space re-patterned (size = bytes)
+  TRACE_EXPAND,      // Realloc grew the block in place
+  TRACE_SHRINK,      // Realloc shrank the block in place
+  TRACE_OPS
+};
+#define TRACE_PATHS (TRACE_SLAB + 1)
+
+enum traceOutcome {
+  TRACE_OK,
+  TRACE_INVALID_SIZE,
+  TRACE_INVALID_ARG,     // Unknown policy, bad arena count, ...
+  TRACE_INVALID_PTR,     // NULL, outside the heap or not a block
+  TRACE_NOT_ALLOCATED,   // Already free (double free) or quarantined
+  TRACE_CORRUPTED,       // Checksum mismatch, quarantined where possible
+  TRACE_LEASED,
+  TRACE_NOT_LEASED,
+  TRACE_LEASE_VIOLATED,  // Written through a read-only lease
+  TRACE_NO_SPACE,
+  TRACE_LIMIT,           // Out of leases, arenas, ...
+  TRACE_OUTCOMES
+};
+
+typedef struct traceEvent {  // 32 bytes
+  uint64_t cycles;   // When (TSC on x86, else ns), op events: the start
+  uint64_t ptr;
+  uint64_t size;
+  uint32_t elapsed;  // Cycles the operation took (level 2 op events)
+  uint8_t op;        // traceOp
+  uint8_t outcome;   // traceOutcome, ops: the first error they hit
+  uint16_t thread;   // Ring number
+} traceEvent;
+
+#if MM_TRACE >= 1
+void traceRecord(int op, const void* ptr, size_t size, int outcome);
+uint64_t traceBegin(void);  // Start of an op, returns the cycle count
+void traceEnd(int op, const void* ptr, size_t size, uint64_t start);
+#define MM_TRACE_ERROR(op, ptr, size, outcome) \
+  traceRecord(op, ptr, size, outcome)
+#else
+#define MM_TRACE_ERROR(op, ptr, size, outcome) ((void)(ptr), (void)(size))
+#endif
+
+#if MM_TRACE >= 2
+#define MM_TRACE_BEGIN() uint64_t trace_start = traceBegin()
+#define MM_TRACE_END(op, ptr, size) traceEnd(op, ptr, size, trace_start)
+#else
+#define MM_TRACE_BEGIN() ((void)0)
+#define MM_TRACE_END(op, ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+#if MM_TRACE >= 3
+#define MM_TRACE_STEP(op, ptr, size) traceRecord(op, ptr, size, TRACE_OK)
+#else
+#define MM_TRACE_STEP(op, ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+const char* traceOpName(int op);
+const char* traceOutcomeName(int outcome);
+
+// Copies the calling thread's events, oldest first. Returns how many
+size_t mm_trace_events(traceEvent* out, size_t max);
+// Writes every ring to path: header {magic, version, event size, rings}, then
+// per ring {thread, count} and its events oldest first. 0 = Success
+int mm_trace_dump(const char* path);
+
+#endif
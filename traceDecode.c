@@ -0,0 +1,59 @@
+// traceDecode.c
+// Prints an mm_trace_dump file (trace.h) as text, one event per line:
+// thread, cycles since the first event, op, pointer, size, duration, outcome.
+// Usage: ./trace_decode trace.bin
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    printf("Usage: %s <trace file>\n", argv[0]);
+    return 1;
+  }
+  FILE* f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    printf("Could not read trace %s\n", argv[1]);
+    return 1;
+  }
+  uint32_t header[4];
+  if (fread(header, sizeof(header), 1, f) != 1 || header[0] != TRACE_MAGIC ||
+      header[1] != TRACE_VERSION || header[2] != sizeof(traceEvent)) {
+    printf("Not a version %d trace file: %s\n", TRACE_VERSION, argv[1]);
+    fclose(f);
+    return 1;
+  }
+  printf("%-6s %14s %-10s %-18s %10s %10s  %s\n", "thread", "cycles", "op",
+         "ptr", "size", "elapsed", "outcome");
+  uint64_t first = 0;
+  int have_first = 0;
+  size_t total = 0;
+  for (uint32_t i = 0; i < header[3]; i++) {
+    uint32_t ring[2];  // {thread, count}
+    if (fread(ring, sizeof(ring), 1, f) != 1) {
+      printf("Truncated trace file\n");
+      break;
+    }
+    for (uint32_t j = 0; j < ring[1]; j++) {
+      traceEvent e;
+      if (fread(&e, sizeof(e), 1, f) != 1) {
+        printf("Truncated trace file\n");
+        fclose(f);
+        return 1;
+      }
+      if (!have_first) {
+        first = e.cycles;
+        have_first = 1;
+      }
+      printf("%-6u %14lld %-10s 0x%016llx %10llu %10u  %s\n", e.thread,
+             (long long)(e.cycles - first), traceOpName(e.op),
+             (unsigned long long)e.ptr, (unsigned long long)e.size,
+             e.elapsed, traceOutcomeName(e.outcome));
+      total++;
+    }
+  }
+  fclose(f);
+  printf("%zu events in %u rings\n", total, header[3]);
+  return 0;
+}
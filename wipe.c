@@ -0,0 +1,136 @@
+#include "wipe.h"
+
+#include <string.h>
+
+#include "arena.h"
+#include "tcache.h"
+
+static int g_wipe_mode = MM_WIPE_EAGER;
+
+void wipeReset(void) { memset(&g_arena->wipe, 0, sizeof(g_arena->wipe)); }
+
+// Takes the heap offsets [from, to) off the queue, patterning them first if
+// wipe. A span cut in two whose tail doesn't fit anymore is wiped right away
+static void wipeRemove(size_t from, size_t to, int wipe) {
+  wipeQueue* q = &g_arena->wipe;
+  size_t i = 0;
+  while (i < q->count) {
+    wipeSpan* s = &q->spans[i];
+    size_t a = s->start > from ? s->start : from;
+    size_t b = s->end < to ? s->end : to;
+    if (a >= b) {
+      i++;
+      continue;
+    }
+    if (wipe) {
+      patternFill(g_arena->heap + a, b - a);
+    }
+    q->pending -= b - a;
+    if (s->start < a && s->end > b) {  // [from, to) is inside the span
+      if (q->count < WIPE_SPANS) {
+        q->spans[q->count].start = b;
+        q->spans[q->count++].end = s->end;
+      } else {
+        patternFill(g_arena->heap + b, s->end - b);
+        q->pending -= s->end - b;
+      }
+      s->end = a;
+    } else if (s->start < a) {
+      s->end = a;
+    } else if (s->end > b) {
+      s->start = b;
+    } else {
+      *s = q->spans[--q->count];  // Gone, look at the moved one next
+      continue;
+    }
+    i++;
+  }
+}
+
+void wipeDefer(uint8_t* start, uint8_t* end) {
+  if (end <= start) {
+    return;
+  }
+  if (__atomic_load_n(&g_wipe_mode, __ATOMIC_RELAXED) != MM_WIPE_DEFERRED) {
+    patternFill(start, end - start);
+    return;
+  }
+  wipeQueue* q = &g_arena->wipe;
+  size_t from = (size_t)(start - g_arena->heap);
+  size_t to = (size_t)(end - g_arena->heap);
+  wipeRemove(from, to, 0);  // Nothing queued is in use, so nothing normally
+  wipeSpan* before = NULL;  // Span ending at from
+  wipeSpan* after = NULL;   // Span starting at to
+  for (size_t i = 0; i < q->count; i++) {
+    if (q->spans[i].end == from) {
+      before = &q->spans[i];
+    } else if (q->spans[i].start == to) {
+      after = &q->spans[i];
+    }
+  }
+  if (before != NULL) {
+    before->end = after != NULL ? after->end : to;
+    if (after != NULL) {
+      *after = q->spans[--q->count];
+    }
+  } else if (after != NULL) {
+    after->start = from;
+  } else if (q->count < WIPE_SPANS) {
+    q->spans[q->count].start = from;
+    q->spans[q->count++].end = to;
+  } else {
+    patternFill(start, end - start);  // Queue full
+    return;
+  }
+  q->pending += to - from;
+}
+
+void wipeFlush(uint8_t* start, uint8_t* end) {
+  if (g_arena->wipe.count > 0 && end > start) {
+    wipeRemove((size_t)(start - g_arena->heap), (size_t)(end - g_arena->heap),
+               1);
+  }
+}
+
+void wipeDrop(uint8_t* start, uint8_t* end) {
+  if (g_arena->wipe.count > 0 && end > start) {
+    wipeRemove((size_t)(start - g_arena->heap), (size_t)(end - g_arena->heap),
+               0);
+  }
+}
+
+int wipeQueued(const uint8_t* p) {
+  wipeQueue* q = &g_arena->wipe;
+  size_t offset = (size_t)(p - g_arena->heap);
+  for (size_t i = 0; i < q->count; i++) {
+    if (offset >= q->spans[i].start && offset < q->spans[i].end) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int mm_wipe_mode(int mode) {
+  if (mode != MM_WIPE_EAGER && mode != MM_WIPE_DEFERRED) {
+    return -1;  // Failure
+  }
+  __atomic_store_n(&g_wipe_mode, mode, __ATOMIC_RELAXED);
+  return 0;  // Success
+}
+
+static size_t arenaWipeFlush(void) {
+  MM_LOCKED();
+  size_t pending = g_arena->wipe.pending;
+  wipeFlush(g_arena->heap, g_arena->heap + g_arena->heap_size);
+  return pending;
+}
+
+size_t mm_wipe_flush(void) {
+  size_t wiped = 0;
+  for (size_t i = 0; i < g_arena_count; i++) {
+    mm_arena_t* prev = arenaEnter(&g_arenas[i]);
+    wiped += arenaWipeFlush();
+    arenaEnter(prev);
+  }
+  return wiped;
+}
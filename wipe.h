@@ -0,0 +1,51 @@
+#ifndef WIPE_H
+#define WIPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Deferred wiping: with MM_WIPE_DEFERRED, the bytes a free or a realloc
+// gives back (wipeFreeBody's dirty range) aren't re-patterned right away but
+// queued as a span of the arena. The pattern only matters once free space is
+// checked, so a span is wiped when something checks the bytes under it
+// (checkFreePattern, mm_verify_free, the patrol scrubber) or by mm_wipe_flush,
+// and dropped unwiped when its bytes are handed out again (heapMalloc, realloc
+// growth) or become a free block's tags (createFreeBlock). Spans only ever
+// cover the unused space of free blocks, and one that continues another is
+// merged into it, so freeing next to a recently freed block stays one span.
+// When the queue is full the range is wiped at once, as in MM_WIPE_EAGER.
+// Freed data stays readable in the heap until its span is wiped.
+#define WIPE_SPANS 64  // Pending spans per arena
+
+#define MM_WIPE_EAGER 0     // wipeFreeBody patterns the range (default)
+#define MM_WIPE_DEFERRED 1  // wipeFreeBody queues it
+
+typedef struct wipeSpan {  // [start, end) as heap offsets
+  size_t start;
+  size_t end;
+} wipeSpan;
+
+typedef struct wipeQueue {  // Per arena (arena.h)
+  wipeSpan spans[WIPE_SPANS];
+  size_t count;
+  size_t pending;  // Bytes in the spans
+} wipeQueue;
+
+void wipeReset(void);  // arenaInit
+// wipeFreeBody: patterns [start, end) or queues it in MM_WIPE_DEFERRED
+void wipeDefer(uint8_t* start, uint8_t* end);
+// Patterns the queued bytes in [start, end) and takes them off the queue
+void wipeFlush(uint8_t* start, uint8_t* end);
+// Takes [start, end) off the queue without wiping it (no longer unused space)
+void wipeDrop(uint8_t* start, uint8_t* end);
+// 1 if p is in a queued span. Old headers there still verify, but no block
+// starts in unused space (blockAt)
+int wipeQueued(const uint8_t* p);
+
+// Selects MM_WIPE_EAGER or MM_WIPE_DEFERRED for every arena. Spans already
+// queued stay until they are checked or flushed. 0 = Success, -1 = Failure
+int mm_wipe_mode(int mode);
+// Patterns every queued span in the arenas mm_malloc uses. Returns the bytes
+size_t mm_wipe_flush(void);
+
+#endif
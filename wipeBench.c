@@ -0,0 +1,89 @@
+// wipeBench.c
+// Cost of re-patterning freed space: the old byte loop (a modulo per byte)
+// against patternFill, and mm_free of a big block (the malloc that takes the
+// space again isn't timed) with eager and deferred wiping (wipe.h)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "allocator.h"
+#include "wipe.h"
+
+#define HEAP_SIZE (8 * 1024 * 1024)
+#define ITERS 200  // Fills or free/malloc cycles per block size
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static uint8_t g_pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+
+// ns per free of a size byte block (and the malloc after it) in mode
+static double freeCycle(uint8_t* heap, size_t size, int mode) {
+  for (size_t i = 0; i < HEAP_SIZE; i++) heap[i] = g_pattern[i % 5];
+  mm_init(heap, HEAP_SIZE);
+  mm_wipe_mode(mode);
+  void* p = mm_malloc(size);
+  void* guard = mm_malloc(64);  // Keeps p's space apart from the tail
+  (void)guard;
+  long long busy = 0;
+  for (size_t i = 0; i < ITERS; i++) {
+    long long t0 = ns_time();
+    mm_free(p);
+    busy += ns_time() - t0;
+    p = mm_malloc(size);  // Same space again, the queued span is dropped
+    if (p == NULL) return -1;
+  }
+  if (mm_verify_free() != 0) {
+    printf("FREE SPACE CORRUPTED\n");
+    return -1;
+  }
+  mm_wipe_mode(MM_WIPE_EAGER);
+  return (double)busy / ITERS;
+}
+
+int main() {
+  static const size_t sizes[] = {4096, 16384, 65536, 262144, 1024 * 1024};
+  size_t nsizes = sizeof(sizes) / sizeof(sizes[0]);
+  uint8_t* heap = malloc(HEAP_SIZE);
+  if (!heap) return 1;
+  double bytewise[5], fill[5], eager[5], deferred[5];
+
+  for (size_t s = 0; s < nsizes; s++) {
+    for (size_t i = 0; i < HEAP_SIZE; i++) heap[i] = g_pattern[i % 5];
+    mm_init(heap, HEAP_SIZE);  // patternFill works in the default arena
+    uint8_t* dst = heap + 3;   // Any phase
+    long long t0 = ns_time();
+    for (size_t n = 0; n < ITERS; n++) {
+      size_t absolute_offset = (size_t)(dst - heap) + n % 5;
+      for (size_t i = 0; i < sizes[s]; i++) {
+        dst[i] = g_pattern[(absolute_offset + i) % 5];
+      }
+      __asm__ volatile("" : : "r"(dst) : "memory");
+    }
+    long long t1 = ns_time();
+    bytewise[s] = (double)(t1 - t0) / ITERS;
+    t0 = ns_time();
+    for (size_t n = 0; n < ITERS; n++) {
+      patternFill(dst + n % 5, sizes[s]);
+      __asm__ volatile("" : : "r"(dst) : "memory");
+    }
+    t1 = ns_time();
+    fill[s] = (double)(t1 - t0) / ITERS;
+    eager[s] = freeCycle(heap, sizes[s], MM_WIPE_EAGER);
+    deferred[s] = freeCycle(heap, sizes[s], MM_WIPE_DEFERRED);
+  }
+
+  printf("\n%-10s %12s %12s %8s %12s %12s   (ns)\n", "block", "byte loop",
+         "patternFill", "speedup", "free eager", "deferred");
+  for (size_t s = 0; s < nsizes; s++) {
+    printf("%-10zu %12.0f %12.0f %7.1fx %12.0f %12.0f\n", sizes[s],
+           bytewise[s], fill[s], bytewise[s] / fill[s], eager[s],
+           deferred[s]);
+  }
+  free(heap);
+  return 0;
+}
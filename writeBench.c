@@ -0,0 +1,75 @@
+// writeBench.c
+// Cost of a small mm_write into big blocks: patched digests vs full reseal
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "allocator.h"
+#include "checksum.h"
+
+#define HEAP_SIZE (4 * 1024 * 1024)
+#define WRITE_LEN 64  // Bytes patched per write
+#define ITERS 20000   // Writes per block size
+
+static inline long long ns_time() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int main() {
+  static const size_t sizes[] = {4096, 16384, 65536, 262144, 1024 * 1024};
+  size_t nsizes = sizeof(sizes) / sizeof(sizes[0]);
+  uint8_t* heap = malloc(HEAP_SIZE);
+  uint8_t* record = malloc(1024 * 1024);
+  if (!heap || !record) return 1;
+  uint8_t pattern[5] = {0xE1, 0xD2, 0xC3, 0xB4, 0xA5};
+  for (size_t i = 0; i < HEAP_SIZE; i++) heap[i] = pattern[i % 5];
+  for (size_t i = 0; i < 1024 * 1024; i++) record[i] = (uint8_t)i;
+  uint8_t field[WRITE_LEN];
+  double partial[5], full[5];
+
+  srand(123);
+  for (size_t s = 0; s < nsizes; s++) {
+    mm_init(heap, HEAP_SIZE);  // Allocator logging happens before the table
+    void* p = mm_malloc(sizes[s]);
+    if (!p || mm_write(p, 0, record, sizes[s]) != (int)sizes[s]) return 1;
+    header* h = (header*)((uint8_t*)p - sizeof(header));
+
+    // Partial write: digests patched from the old and new bytes
+    long long t0 = ns_time();
+    for (size_t i = 0; i < ITERS; i++) {
+      memset(field, (int)i, WRITE_LEN);
+      mm_write(p, (size_t)rand() % (sizes[s] - WRITE_LEN), field, WRITE_LEN);
+    }
+    long long t1 = ns_time();
+    partial[s] = (double)(t1 - t0) / ITERS;
+
+    // Old behaviour: patch the bytes and reseal the whole block
+    t0 = ns_time();
+    for (size_t i = 0; i < ITERS; i++) {
+      memset(field, (int)i, WRITE_LEN);
+      memcpy((uint8_t*)p + (size_t)rand() % (sizes[s] - WRITE_LEN), field,
+             WRITE_LEN);
+      sealBlock(h);
+    }
+    t1 = ns_time();
+    full[s] = (double)(t1 - t0) / ITERS;
+    if (checkBlock(h) != 0) {
+      printf("BLOCK CORRUPTED\n");
+      return 1;
+    }
+  }
+
+  printf("\n%-10s %12s %12s %9s   (ns per %d byte write, %s kernel)\n",
+         "block", "partial", "reseal", "speedup", WRITE_LEN,
+         checksumActive()->name);
+  for (size_t s = 0; s < nsizes; s++) {
+    printf("%-10zu %12.1f %12.1f %8.1fx\n", sizes[s], partial[s], full[s],
+           full[s] / partial[s]);
+  }
+  free(record);
+  free(heap);
+  return 0;
+}